@@ -30,7 +30,10 @@ apt-get install -y \
 	wget \
 	autoconf \
 	iputils-ping \
-	binutils-dev
+	binutils-dev \
+	pkg-config \
+	fuse3 \
+	libfuse3-dev
 
 pip3 install \
 	click \
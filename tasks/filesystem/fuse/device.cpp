@@ -0,0 +1,329 @@
+#include "device.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include "pram.hpp"
+
+namespace mycpu {
+
+namespace {
+
+uint64_t nanoseconds(std::chrono::steady_clock::duration d) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+}  // namespace
+
+Device::Device(size_t units, size_t threads, JitConfig jit)
+    : units_(units),
+      threads_(threads ? threads : std::max(std::thread::hardware_concurrency(), 1u)),
+      jit_(std::move(jit)) {}
+
+Device::~Device() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  workCv_.notify_all();
+  for (auto &w : workers_) w.join();
+}
+
+void Device::Start(std::string_view command) {
+  std::vector<size_t> started;
+  const char* p = command.data();
+  const char* end = p + command.size();
+  for (;;) {
+    while (p != end && std::isspace((unsigned char)*p)) p++;
+    if (p == end) break;
+    size_t unit = 0;
+    auto [next, ec] = std::from_chars(p, end, unit);
+    if (ec != std::errc() || (next != end && !std::isspace((unsigned char)*next))) {
+      throw std::invalid_argument("ctrl: bad unit number");
+    }
+    if (unit >= units_.size()) throw std::invalid_argument("ctrl: no unit " + std::to_string(unit));
+    started.push_back(unit);
+    p = next;
+  }
+
+  // Запуск берет готовую программу или снимок pram: компиляция (для C++ - секунды) идет
+  // в потоке пула и не держит запись в ctrl и блокировки юнита
+  std::vector<Task> tasks;
+  std::vector<Completion> finished;
+  for (size_t unit : started) {
+    Unit &u = units_[unit];
+    std::lock_guard lock(u.programMutex);
+    MemoryImage pram = u.pram.Snapshot();
+    if (u.program && u.programVersion == pram.Version()) {
+      if (u.program->steps.empty() && u.program->library.empty()) {
+        finished.push_back({unit, {}});
+      } else {
+        tasks.push_back({unit, u.program, {}, {}});
+      }
+    } else if (pram.Size() == 0) {
+      finished.push_back({unit, {}});
+    } else {
+      tasks.push_back({unit, nullptr, std::move(pram), {}});
+    }
+  }
+
+  {
+    std::lock_guard lock(mutex_);
+    done_.insert(done_.end(), finished.begin(), finished.end());
+    Clock::time_point now = Clock::now();
+    for (auto &t : tasks) {
+      t.queued = now;
+      queue_.push_back(std::move(t));
+    }
+    while (!tasks.empty() && workers_.size() < threads_) workers_.emplace_back([this] { WorkerLoop(); });
+  }
+  if (!finished.empty()) {
+    doneCv_.notify_all();
+    if (completionListener_) completionListener_();
+  }
+  for (size_t i = 0; i < tasks.size(); i++) workCv_.notify_one();
+}
+
+void Device::WorkerLoop() {
+  std::unique_lock lock(mutex_);
+  for (;;) {
+    workCv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+    Task task = std::move(queue_.front());
+    queue_.pop_front();
+    running_++;
+    lock.unlock();
+
+    Completion c{task.unit, {}};
+    Clock::duration wait = Clock::now() - task.queued;
+    try {
+      auto program = task.program ? std::move(task.program) : Compiled(task.unit, task.pram);
+      task.pram = {};
+      if (!program->steps.empty() || !program->library.empty()) Execute(task.unit, *program, wait);
+    } catch (const std::exception &e) {
+      c.error = e.what();
+    }
+
+    lock.lock();
+    running_--;
+    done_.push_back(std::move(c));
+    doneCv_.notify_all();
+    if (completionListener_) {
+      lock.unlock();
+      completionListener_();
+      lock.lock();
+    }
+  }
+}
+
+bool Device::WaitCompletion(std::unique_lock<std::mutex> &lock) {
+  doneCv_.wait(lock, [&] { return !done_.empty() || (queue_.empty() && running_ == 0); });
+  return !done_.empty();
+}
+
+std::optional<Completion> Device::Wait() {
+  std::unique_lock lock(mutex_);
+  if (!WaitCompletion(lock)) return std::nullopt;
+  Completion c = std::move(done_.front());
+  done_.pop_front();
+  return c;
+}
+
+std::string Device::ReadCtrl(size_t size, bool block) {
+  std::unique_lock lock(mutex_);
+  std::string out;
+  if (!block && done_.empty() && (!queue_.empty() || running_ != 0)) {
+    throw std::system_error(EAGAIN, std::generic_category(), "ctrl: no completions yet");
+  }
+  if (!WaitCompletion(lock)) return out;
+  while (!done_.empty()) {
+    const Completion &c = done_.front();
+    std::string line = std::to_string(c.unit) + (c.error.empty() ? "" : " error: " + c.error) + "\n";
+    if (!out.empty() && out.size() + line.size() > size) break;
+    out += line;
+    done_.pop_front();
+  }
+  if (out.size() > size) out.resize(size);
+  return out;
+}
+
+bool Device::HasCompletions() {
+  std::lock_guard lock(mutex_);
+  return !done_.empty();
+}
+
+void Device::Run(size_t unit) { Execute(unit, *Compiled(unit), {}); }
+
+void Device::Execute(size_t unit, const Program &program, Clock::duration wait) {
+  Unit &u = units_[unit];
+  Clock::time_point begin = Clock::now();
+  size_t bytes = 0;
+  std::vector<bool> executed;
+  auto account = [&](bool error) {
+    u.stats.AddRun(program, executed, nanoseconds(wait), nanoseconds(Clock::now() - begin), bytes, error);
+  };
+  try {
+    if (program.library.empty()) {
+      bytes = u.lram.Modify(
+          [&](uint8_t* data, size_t size) { return runProgram(program, data, size, true, &executed); });
+    } else {
+      bytes = u.lram.ModifyFd([&](int fd, uint8_t* data, size_t size) {
+        jit_.Run(program.library, fd, data, size);
+        return size;
+      });
+    }
+  } catch (...) {
+    account(true);
+    throw;
+  }
+  account(false);
+}
+
+std::string Device::Stats(size_t unit) const { return formatStats(units_[unit].stats.Load()); }
+
+std::string Device::Stats() {
+  StatsSnapshot total;
+  std::optional<size_t> slowest;
+  uint64_t slowestNs = 0;
+  for (size_t i = 0; i < units_.size(); i++) {
+    StatsSnapshot s = units_[i].stats.Load();
+    if (s.runs && (!slowest || s.lastNs > slowestNs)) {
+      slowest = i;
+      slowestNs = s.lastNs;
+    }
+    total += s;
+  }
+  size_t queued, running;
+  {
+    std::lock_guard lock(mutex_);
+    queued = queue_.size();
+    running = running_;
+  }
+  std::string out = "units " + std::to_string(units_.size()) + "\nqueued " + std::to_string(queued) + "\nrunning " +
+                    std::to_string(running) + "\n";
+  if (slowest) out += "slowest_unit " + std::to_string(*slowest) + "\n";
+  return out + formatStats(total);
+}
+
+Program Device::Build(std::string_view source) {
+  Program program;
+  if (isNativeSource(source)) {
+    program.library = jit_.Build(source);
+  } else {
+    program = compileProgram(source);
+  }
+  return program;
+}
+
+void Device::SetBroadcastMask(std::string_view mask) {
+  std::vector<bool> units(units_.size());
+  const char* p = mask.data();
+  const char* end = p + mask.size();
+  auto number = [&](size_t &value) {
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) throw std::invalid_argument("broadcast: bad unit number");
+    if (value >= units_.size()) throw std::invalid_argument("broadcast: no unit " + std::to_string(value));
+    p = next;
+  };
+  for (;;) {
+    while (p != end && std::isspace((unsigned char)*p)) p++;
+    if (p == end) break;
+    if (end - p >= 3 && std::string_view(p, 3) == "all" && (end - p == 3 || std::isspace((unsigned char)p[3]))) {
+      units.assign(units.size(), true);
+      p += 3;
+      continue;
+    }
+    size_t first = 0, last = 0;
+    number(first);
+    last = first;
+    if (p != end && *p == '-') {
+      p++;
+      number(last);
+      if (last < first) throw std::invalid_argument("broadcast: bad unit range");
+    }
+    if (p != end && !std::isspace((unsigned char)*p)) throw std::invalid_argument("broadcast: bad unit number");
+    for (size_t i = first; i <= last; i++) units[i] = true;
+  }
+  std::lock_guard lock(broadcastMutex_);
+  broadcastMask_ = std::move(units);
+}
+
+std::string Device::BroadcastMask() {
+  std::vector<size_t> units = MaskedUnits();
+  std::string out;
+  for (size_t i = 0; i < units.size();) {
+    size_t j = i;
+    while (j + 1 < units.size() && units[j + 1] == units[j] + 1) j++;
+    if (!out.empty()) out += ' ';
+    out += std::to_string(units[i]);
+    if (j > i) {
+      out += '-';
+      out += std::to_string(units[j]);
+    }
+    i = j + 1;
+  }
+  return out.empty() ? out : out + "\n";
+}
+
+std::vector<size_t> Device::MaskedUnits() {
+  std::lock_guard lock(broadcastMutex_);
+  std::vector<size_t> units;
+  for (size_t i = 0; i < units_.size(); i++) {
+    if (broadcastMask_.empty() || broadcastMask_[i]) units.push_back(i);
+  }
+  return units;
+}
+
+void Device::PublishPram() {
+  MemoryImage image = broadcastPram_.Snapshot();
+  auto shared = std::make_shared<SharedProgram>();
+  for (size_t unit : MaskedUnits()) {
+    Unit &u = units_[unit];
+    std::lock_guard lock(u.programMutex);
+    u.broadcastVersion = u.pram.Assign(image);
+    u.broadcast = shared;
+  }
+}
+
+void Device::PublishLram() {
+  MemoryImage image = broadcastLram_.Snapshot();
+  for (size_t unit : MaskedUnits()) units_[unit].lram.Assign(image);
+}
+
+std::shared_ptr<const Program> Device::Compiled(size_t unit) { return Compiled(unit, units_[unit].pram.Snapshot()); }
+
+std::shared_ptr<const Program> Device::Compiled(size_t unit, const MemoryImage &pram) {
+  Unit &u = units_[unit];
+  std::shared_ptr<SharedProgram> shared;
+  {
+    std::lock_guard lock(u.programMutex);
+    if (u.program && u.programVersion == pram.Version()) return u.program;
+    if (u.broadcast && u.broadcastVersion == pram.Version()) shared = u.broadcast;
+  }
+  auto build = [&] {
+    return std::make_shared<const Program>(Build(std::string_view((const char*)pram.Data(), pram.Size())));
+  };
+  std::shared_ptr<const Program> program;
+  if (shared) {
+    // Юниты одной рассылки ждут первую сборку, а не собирают программу параллельно
+    std::lock_guard lock(shared->mutex);
+    if (!shared->program) shared->program = build();
+    program = shared->program;
+  } else {
+    program = build();
+  }
+  // Пока шла компиляция, pram могла измениться и скомпилироваться: более новая программа не заменяется
+  std::lock_guard lock(u.programMutex);
+  if (!u.program || u.programVersion < pram.Version()) {
+    u.program = program;
+    u.programVersion = pram.Version();
+  }
+  return program;
+}
+
+}  // namespace mycpu
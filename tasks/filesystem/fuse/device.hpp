@@ -0,0 +1,159 @@
+#pragma once
+
+// Модель устройства mycpu: юниты с памятью программ (pram) и данных (lram) и очередь
+// запусков ctrl с пулом потоков исполнения. Не зависит от FUSE: драйвер mycpufs.cpp только отображает ее на файлы.
+// Все методы потокобезопасны - драйвер обслуживает запросы в нескольких потоках.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "jit.hpp"
+#include "memory.hpp"
+#include "pram.hpp"
+#include "stats.hpp"
+
+namespace mycpu {
+
+// Программа одной рассылки pram, общая для юнитов маски: компилируется при первом запуске
+struct SharedProgram {
+  std::mutex mutex;
+  std::shared_ptr<const Program> program;
+};
+
+struct Unit {
+  Memory pram;
+  Memory lram;
+
+  // Скомпилированная программа и версия pram, из которой она получена
+  std::mutex programMutex;
+  std::shared_ptr<const Program> program;
+  uint64_t programVersion = 0;
+  // Последняя рассылка pram и версия pram после нее
+  std::shared_ptr<SharedProgram> broadcast;
+  uint64_t broadcastVersion = 0;
+
+  UnitStats stats;
+};
+
+// Завершение юнита для чтения ctrl
+struct Completion {
+  size_t unit = 0;
+  std::string error;  // Пусто - программа исполнена
+};
+
+class Device {
+ public:
+  // threads - потоки исполнения юнитов, 0 - по числу ядер; jit - сборка нативных программ
+  explicit Device(size_t units, size_t threads = 0, JitConfig jit = {});
+  ~Device();
+
+  size_t Units() const { return units_.size(); }
+  Unit &unit(size_t i) { return units_[i]; }
+  Jit &jit() { return jit_; }
+
+  // Функция разбора записи в ctrl: номера юнитов через пробельные символы запускаются
+  // со снимком программы на момент записи. Неверный номер - std::invalid_argument,
+  // тогда не запускается ни один юнит. Юниты с пустой программой завершаются сразу,
+  // остальные исполняются пулом потоков параллельно. Start не компилирует: снимок pram
+  // компилируется в потоке пула, ошибка компиляции - завершение юнита с ошибкой.
+  void Start(std::string_view command);
+
+  // Функция ожидания завершения: первое по времени непрочитанное завершение. Блокирует,
+  // только если завершений нет, а запущенные юниты есть; если нет и их - nullopt.
+  std::optional<Completion> Wait();
+
+  // Функция чтения ctrl: ждет как Wait и возвращает строки "N\n" (ошибка - "N error: ...\n")
+  // всех готовых завершений, сколько помещается в size байт (первое - всегда, с обрезкой).
+  // Пустая строка - запущенных юнитов нет. Без block вместо ожидания - system_error EAGAIN.
+  std::string ReadCtrl(size_t size, bool block = true);
+  // Функция проверки, есть ли непрочитанные завершения (чтение ctrl не ждет)
+  bool HasCompletions();
+  // Функция подписки на завершения (для poll): listener вызывается после появления новых
+  // завершений, вне блокировок устройства, из потока пула или из Start. Задается до запусков.
+  void SetCompletionListener(std::function<void()> listener) { completionListener_ = std::move(listener); }
+
+  // Функция исполнения программы юнита над его lram
+  void Run(size_t unit);
+
+  // Рассылка (/broadcast): образ pram или lram пишется в broadcastPram() или broadcastLram(),
+  // затем Publish делает его содержимым памяти юнитов из маски. Память юнитов общая с образом
+  // до первого изменения (memory.hpp). Publish не компилирует pram: программу рассылки собирает
+  // первый запуск юнита из маски в потоке пула, остальные юниты берут готовую.
+  Memory &broadcastPram() { return broadcastPram_; }
+  Memory &broadcastLram() { return broadcastLram_; }
+  // Функция задания маски рассылки: номера юнитов и диапазоны N-M через пробельные символы
+  // или all. Неверная маска - std::invalid_argument. По умолчанию - все юниты.
+  void SetBroadcastMask(std::string_view mask);
+  // Функция чтения маски рассылки в виде "0 2 5-7\n"; пустая маска - пустая строка
+  std::string BroadcastMask();
+  void PublishPram();
+  void PublishLram();
+
+  // Функции чтения статистики (stats.hpp): юнита и сводной по устройству - суммы по юнитам,
+  // текущие длины очереди и самый медленный по последнему исполнению юнит
+  std::string Stats(size_t unit) const;
+  std::string Stats();
+
+  // Функция получения скомпилированной программы юнита: текст разбирается (исходник C++
+  // собирается) один раз на версию pram, пока pram не меняется, запуски берут готовую программу
+  std::shared_ptr<const Program> Compiled(size_t unit);
+  // То же для снимка pram юнита; компиляция идет вне блокировок юнита и его pram
+  std::shared_ptr<const Program> Compiled(size_t unit, const MemoryImage &pram);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Task {
+    size_t unit;
+    std::shared_ptr<const Program> program;  // Пусто - компилируется из pram в потоке пула
+    MemoryImage pram;
+    Clock::time_point queued;
+  };
+
+  // Функция компиляции текста pram: исходник C++ собирается, остальное разбирается в инструкции
+  Program Build(std::string_view source);
+  std::vector<size_t> MaskedUnits();
+
+  void WorkerLoop();
+  // Функция исполнения программы над lram юнита: инструкции - в драйвере, нативная - в исполнителе.
+  // Исполнение учитывается в статистике юнита, в том числе завершившееся ошибкой.
+  void Execute(size_t unit, const Program &program, Clock::duration wait);
+  // Функция ожидания завершения под блокировкой mutex_; false - запущенных юнитов нет
+  bool WaitCompletion(std::unique_lock<std::mutex> &lock);
+
+  std::vector<Unit> units_;
+  size_t threads_;
+  Jit jit_;
+
+  Memory broadcastPram_;
+  Memory broadcastLram_;
+  std::mutex broadcastMutex_;
+  std::vector<bool> broadcastMask_;
+
+  std::mutex mutex_;
+  std::condition_variable workCv_;  // Для потоков пула: новая задача или остановка
+  std::condition_variable doneCv_;  // Для читателей ctrl: новое завершение
+  std::function<void()> completionListener_;
+  std::deque<Task> queue_;          // Запущены, но еще не исполняются
+  size_t running_ = 0;              // Исполняются сейчас
+  std::deque<Completion> done_;     // Завершены, но еще не прочитаны
+  bool stop_ = false;
+  // Пул создается при первом запуске юнита, а не в конструкторе: драйвер уходит в фон
+  // через fork (fuse_daemonize) после создания устройства, а потоки fork не переживают
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace mycpu
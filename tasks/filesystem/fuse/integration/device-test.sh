@@ -30,6 +30,13 @@ assert echo 123 '>' $MNTDIR/unit7/lram
 assert echo 321 '>' $MNTDIR/unit7/pram
 assert echo 123 '|' diff - $MNTDIR/unit7/lram
 assert echo 321 '|' diff - $MNTDIR/unit7/pram
+# Overwriting with shorter content leaves no tail of the old one
+assert printf abcdef '>' $MNTDIR/unit7/lram
+assert printf ab '>' $MNTDIR/unit7/lram
+assert printf ab '|' diff - $MNTDIR/unit7/lram
+assert echo 4321 '>' $MNTDIR/unit7/pram
+assert echo 1 '>' $MNTDIR/unit7/pram
+assert echo 1 '|' diff - $MNTDIR/unit7/pram
 
 # End of test section
 
@@ -0,0 +1,394 @@
+// Нагрузочный тест драйвера через смонтированное дерево файлов. Для каждого драйвера
+// из командной строки монтирует его во временный каталог (<driver> --units=N -f <mnt>)
+// и гоняет все юниты одновременно: поток юнита в каждом цикле пишет образ lram и программу
+// pram, запускает юнит записью в ctrl, ждет завершения и читает lram обратно со сверкой.
+// Завершения из ctrl читает один общий поток: строки ctrl не привязаны к читателю.
+//
+// Печатает юниты в секунду, MB/s по данным lram и pram в обе стороны и перцентили
+// задержки от записи в ctrl до строки завершения. Несколько драйверов - таблица для сравнения,
+// например эталонного эмулятора и нативного драйвера:
+//   mycpu_load --units=8 integration/emulator/cpuemu build/mycpu
+//
+// Программа - [u8:0:H]add(u8:0:H,u8:H:2H) над байтами меньше 128: ее одинаково исполняют
+// эталон (вычисления в целых Python, переполнение - ошибка) и драйвер. ctrl пишется по номеру
+// за запись: эталон понимает только так.
+//
+// Использование: mycpu_load [--units=N] [--size=KB] [--rounds=N] [--mounted=DIR] <driver>...
+//   --units=N    число юнитов и потоков (по умолчанию 8)
+//   --size=KB    размер образа lram (по умолчанию 1024)
+//   --rounds=N   циклов на юнит (по умолчанию 20)
+//   --mounted=DIR  нагружать уже смонтированное устройство; драйверы не запускаются
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+constexpr size_t kChunk = 1 << 20;  // Порция read и write
+constexpr auto kMountTimeout = std::chrono::seconds(30);
+constexpr auto kCompletionTimeout = std::chrono::seconds(600);
+
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+struct Options {
+  size_t units = 8;
+  size_t sizeKB = 1024;
+  size_t rounds = 20;
+  std::string mounted;
+  std::vector<std::string> drivers;
+};
+
+struct Result {
+  std::string driver;
+  double seconds = 0;
+  size_t cycles = 0;
+  size_t errors = 0;              // Завершения с ошибкой и несовпадения lram
+  uint64_t bytes = 0;             // Записано и прочитано из pram и lram
+  std::vector<double> latencies;  // Секунды от записи в ctrl до строки завершения
+};
+
+class Fd {
+ public:
+  Fd(const std::string &path, int flags) : fd_(open(path.c_str(), flags | O_CLOEXEC)) {
+    if (fd_ < 0) throwErrno("open " + path);
+  }
+  ~Fd() { close(fd_); }
+  Fd(const Fd &) = delete;
+  Fd &operator=(const Fd &) = delete;
+  int get() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+void writeFile(const std::string &path, const void* data, size_t size) {
+  Fd fd(path, O_WRONLY | O_TRUNC);
+  const char* p = static_cast<const char*>(data);
+  for (size_t done = 0; done < size;) {
+    ssize_t n = write(fd.get(), p + done, std::min(kChunk, size - done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) throwErrno("write " + path);
+    done += (size_t)n;
+  }
+}
+
+std::string readFile(const std::string &path, size_t expected) {
+  Fd fd(path, O_RDONLY);
+  std::string out(expected, '\0');
+  size_t done = 0;
+  for (;;) {
+    if (done == out.size()) out.resize(out.size() + kChunk);
+    ssize_t n = read(fd.get(), out.data() + done, std::min(kChunk, out.size() - done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) throwErrno("read " + path);
+    if (n == 0) break;
+    done += (size_t)n;
+  }
+  out.resize(done);
+  return out;
+}
+
+// Смонтированный драйвер: процесс в foreground и временная точка монтирования
+class Mount {
+ public:
+  Mount(const std::string &driver, size_t units) {
+    char dir[] = "/tmp/mycpu-load-XXXXXX";
+    if (!mkdtemp(dir)) throwErrno("mkdtemp");
+    path_ = dir;
+    std::vector<std::string> args;
+    std::istringstream words(driver);
+    for (std::string word; words >> word;) args.push_back(word);
+    if (args.empty()) throw std::invalid_argument("empty driver command");
+    args.push_back("--units=" + std::to_string(units));
+    args.push_back("-f");
+    args.push_back(path_);
+    if (spawn(args, &pid_) != 0) {
+      rmdir(path_.c_str());
+      throw std::runtime_error("cannot start " + args[0]);
+    }
+    // Смонтировано - когда в каталоге появился ctrl
+    auto deadline = Clock::now() + kMountTimeout;
+    struct stat st;
+    while (stat((path_ + "/ctrl").c_str(), &st) != 0) {
+      int status;
+      bool exited = waitpid(pid_, &status, WNOHANG) == pid_;
+      if (exited || Clock::now() > deadline) {
+        if (!exited) Stop();
+        pid_ = -1;
+        rmdir(path_.c_str());
+        throw std::runtime_error(driver + ": device is not mounted");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  ~Mount() {
+    Stop();
+    rmdir(path_.c_str());
+  }
+
+  Mount(const Mount &) = delete;
+  Mount &operator=(const Mount &) = delete;
+
+  const std::string &path() const { return path_; }
+
+ private:
+  static int spawn(const std::vector<std::string> &args, pid_t* pid) {
+    std::vector<char*> argv;
+    for (const std::string &arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    return posix_spawnp(pid, argv[0], nullptr, nullptr, argv.data(), environ);
+  }
+
+  // Размонтирование через fusermount; драйвер, не завершившийся за секунду, получает SIGTERM,
+  // а за 10 секунд - SIGKILL
+  void Stop() {
+    if (pid_ < 0) return;
+    pid_t umount;
+    if (spawn({"fusermount", "-u", path_}, &umount) == 0) waitpid(umount, nullptr, 0);
+    for (int i = 0; i < 1000 && waitpid(pid_, nullptr, WNOHANG) == 0; i++) {
+      if (i == 100) kill(pid_, SIGTERM);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (waitpid(pid_, nullptr, WNOHANG) == 0) {
+      kill(pid_, SIGKILL);
+      waitpid(pid_, nullptr, 0);
+    }
+    pid_ = -1;
+  }
+
+  std::string path_;
+  pid_t pid_ = -1;
+};
+
+// Нагрузка на смонтированное устройство
+class Load {
+ public:
+  Load(std::string root, const Options &options)
+      : root_(std::move(root)), options_(options), done_(options.units) {}
+
+  Result Run() {
+    Fd ctrl(root_ + "/ctrl", O_RDWR);
+    ctrl_ = ctrl.get();
+    // Завершения, оставшиеся от прошлых запусков, не относятся к нагрузке
+    while (ReadCtrl().size()) {
+    }
+    Result result;
+    result.latencies.resize(options_.units * options_.rounds);
+    std::vector<uint64_t> bytes(options_.units);
+    std::vector<size_t> errors(options_.units);
+
+    auto start = Clock::now();
+    std::thread collector([&] { Collect(); });
+    std::vector<std::thread> threads;
+    for (size_t unit = 0; unit < options_.units; unit++) {
+      threads.emplace_back([&, unit] {
+        try {
+          RunUnit(unit, result.latencies.data() + unit * options_.rounds, bytes[unit], errors[unit]);
+        } catch (const std::exception &e) {
+          Fail(e.what());
+        }
+      });
+    }
+    for (std::thread &t : threads) t.join();
+    stop_ = true;
+    collector.join();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!failure_.empty()) throw std::runtime_error(failure_);
+
+    result.cycles = options_.units * options_.rounds;
+    for (size_t unit = 0; unit < options_.units; unit++) {
+      result.bytes += bytes[unit];
+      result.errors += errors[unit];
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+  }
+
+ private:
+  void RunUnit(size_t unit, double* latencies, uint64_t &bytes, size_t &errors) {
+    std::string dir = root_ + "/unit" + std::to_string(unit);
+    size_t half = options_.sizeKB * 1024 / 2;
+    std::string h = std::to_string(half), h2 = std::to_string(2 * half);
+    std::string program = "[u8:0:" + h + "]add(u8:0:" + h + ",u8:" + h + ":" + h2 + ")\n";
+    std::string image(2 * half, '\0');
+    std::string start = std::to_string(unit) + "\n";
+    uint32_t seed = (uint32_t)unit * 2654435761u + 1;
+    for (size_t round = 0; round < options_.rounds; round++) {
+      for (char &c : image) {
+        seed = seed * 1664525u + 1013904223u;
+        c = (char)(seed >> 25);  // 0..127: сумма двух байт не переполняет u8
+      }
+      writeFile(dir + "/lram", image.data(), image.size());
+      writeFile(dir + "/pram", program.data(), program.size());
+
+      auto started = Clock::now();
+      if (write(ctrl_, start.data(), start.size()) != (ssize_t)start.size()) throwErrno("write ctrl");
+      std::string line = WaitDone(unit);
+      latencies[round] = std::chrono::duration<double>(Clock::now() - started).count();
+      bool failed = line.find("error") != std::string::npos;
+
+      std::string lram = readFile(dir + "/lram", image.size());
+      for (size_t i = 0; i < half && !failed; i++) {
+        failed = (uint8_t)lram[i] != (uint8_t)(image[i] + image[half + i]);
+      }
+      failed = failed || lram.compare(half, std::string::npos, image, half, std::string::npos) != 0;
+      errors += failed;
+      bytes += 2 * image.size() + program.size();
+    }
+  }
+
+  std::string ReadCtrl() {
+    char buf[4096];
+    for (;;) {
+      ssize_t n = read(ctrl_, buf, sizeof(buf));
+      if (n >= 0) return std::string(buf, (size_t)n);
+      if (errno != EINTR) throwErrno("read ctrl");
+    }
+  }
+
+  // Поток чтения ctrl: строки "N" и "N error: ..." раздаются потокам юнитов. Пустое чтение -
+  // запущенных юнитов нет (у эталона - очередь пуста), повтор после паузы.
+  void Collect() {
+    std::string pending;
+    try {
+      while (!stop_) {
+        std::string chunk = ReadCtrl();
+        if (chunk.empty()) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          continue;
+        }
+        pending += chunk;
+        for (size_t end; (end = pending.find('\n')) != std::string::npos; pending.erase(0, end + 1)) {
+          std::string line = pending.substr(0, end);
+          size_t unit = std::stoul(line);
+          if (unit >= options_.units) throw std::runtime_error("ctrl: unexpected line " + line);
+          std::lock_guard lock(mutex_);
+          done_[unit] = line;
+          cv_.notify_all();
+        }
+      }
+    } catch (const std::exception &e) {
+      Fail(e.what());
+    }
+  }
+
+  std::string WaitDone(size_t unit) {
+    std::unique_lock lock(mutex_);
+    if (!cv_.wait_for(lock, kCompletionTimeout, [&] { return done_[unit] || !failure_.empty(); })) {
+      throw std::runtime_error("unit " + std::to_string(unit) + " did not complete");
+    }
+    if (!failure_.empty()) throw std::runtime_error(failure_);
+    std::string line = std::move(*done_[unit]);
+    done_[unit].reset();
+    return line;
+  }
+
+  void Fail(const std::string &what) {
+    std::lock_guard lock(mutex_);
+    if (failure_.empty()) failure_ = what;
+    stop_ = true;
+    cv_.notify_all();
+  }
+
+  std::string root_;
+  const Options &options_;
+  int ctrl_ = -1;
+  std::atomic<bool> stop_{false};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::optional<std::string>> done_;  // Необработанная строка завершения юнита
+  std::string failure_;
+};
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t rank = (size_t)std::ceil(p / 100 * (double)sorted.size());
+  return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+bool parseNumber(const std::string &arg, const char* name, size_t &value) {
+  std::string prefix = std::string(name) + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+  value = std::stoull(arg.substr(prefix.size()));
+  if (value == 0) throw std::invalid_argument(std::string(name) + " must be positive");
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) try {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (parseNumber(arg, "--units", options.units) || parseNumber(arg, "--size", options.sizeKB) ||
+        parseNumber(arg, "--rounds", options.rounds)) {
+      continue;
+    }
+    if (arg.rfind("--mounted=", 0) == 0) {
+      options.mounted = arg.substr(10);
+    } else if (arg[0] == '-') {
+      bool help = arg == "-h" || arg == "--help";
+      (help ? std::cout : std::cerr) << "usage: " << argv[0]
+                                     << " [--units=N] [--size=KB] [--rounds=N] [--mounted=DIR] <driver>...\n";
+      return help ? 0 : 1;
+    } else {
+      options.drivers.push_back(arg);
+    }
+  }
+  if (options.drivers.empty() && options.mounted.empty()) throw std::invalid_argument("no driver");
+  if (!options.mounted.empty()) options.drivers = {options.mounted};
+  // Вывод в закрытый драйвером канал не должен завершать процесс
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<Result> results;
+  for (const std::string &driver : options.drivers) {
+    std::optional<Mount> mount;
+    if (options.mounted.empty()) mount.emplace(driver, options.units);
+    Result r = Load(mount ? mount->path() : options.mounted, options).Run();
+    r.driver = driver;
+    results.push_back(std::move(r));
+  }
+
+  std::cout << "units " << options.units << ", lram " << options.sizeKB << " KB, rounds " << options.rounds << "\n";
+  std::cout << "  units/s       MB/s  p50 ms  p90 ms  p99 ms  max ms  errors  driver\n";
+  for (const Result &r : results) {
+    std::cout << std::fixed << std::setprecision(1) << std::setw(9) << (double)r.cycles / r.seconds << " "
+              << std::setw(10) << (double)r.bytes / 1e6 / r.seconds << std::setprecision(2);
+    for (double p : {50.0, 90.0, 99.0, 100.0}) std::cout << " " << std::setw(7) << percentile(r.latencies, p) * 1000;
+    std::cout << " " << std::setw(7) << r.errors << "  " << r.driver << "\n";
+  }
+  for (const Result &r : results) {
+    if (r.errors) return 1;
+  }
+  return 0;
+} catch (const std::exception &e) {
+  std::cerr << "Error: " << e.what() << "\n";
+  return 1;
+}
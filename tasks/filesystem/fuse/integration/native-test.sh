@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+source $(dirname ${BASH_SOURCE[0]})/assert.sh
+
+# Extensions of the mycpu driver beyond the task (native C++ programs, statistics, broadcast);
+# device-test.sh and tree-test.sh check the task itself and pass for the reference emulator too
+
+PROG=`realpath $1`
+UNITSNUM=${UNITSNUM:-9}
+MNTDIR=`mktemp -d`
+
+cleanup() {
+    echo Remove mountpoint $MNTDIR
+    fusermount -u $MNTDIR || (echo "Trying sudo..."; sudo fusermount -u $MNTDIR && echo DONE)
+    rmdir $MNTDIR
+    exit $RESULT
+}
+
+trap cleanup EXIT INT
+
+# Test section
+
+echo Mount $MNTDIR by $PROG
+assert $PROG --units=$UNITSNUM $MNTDIR
+
+# Native program from the task description: both units sort the same data
+printf 'dcba\n' > $MNTDIR/unit0/lram
+printf 'dcba\n' > $MNTDIR/unit1/lram
+printf '#include <algorithm>\n\nint entrypoint(uint32_t size, uint8_t* ram)\n{\n    std::sort(ram, ram + size);\n    return 0;\n}\n' \
+    | tee $MNTDIR/unit0/pram $MNTDIR/unit1/pram > /dev/null
+assert echo 0 '>' $MNTDIR/ctrl
+assert echo 1 '>' $MNTDIR/ctrl
+assert printf '0\\n1\\n' '|' diff - '<(sort' $MNTDIR/ctrl')'
+assert diff $MNTDIR/unit0/lram $MNTDIR/unit1/lram
+assert printf '\\nabcd' '|' diff - $MNTDIR/unit0/lram
+
+# Statistics: the tree and the run counters of the units above
+assert [[ -f $MNTDIR/stats ]]
+for i in `seq 0 $((UNITSNUM-1))`; do
+    assert [[ -f $MNTDIR/unit$i/stats ]]
+done
+assert grep -qx "'runs 1'" $MNTDIR/unit0/stats
+assert grep -qx "'native_runs 1'" $MNTDIR/unit1/stats
+assert grep -qx "'runs 2'" $MNTDIR/stats
+
+# Broadcast: the tree, then one image for units 2, 4 and 5; a unit that runs does not change the others
+assert [[ -d $MNTDIR/broadcast ]]
+assert [[ -f $MNTDIR/broadcast/mask ]]
+assert [[ -f $MNTDIR/broadcast/pram ]]
+assert [[ -f $MNTDIR/broadcast/lram ]]
+assert echo 2 4-5 '>' $MNTDIR/broadcast/mask
+assert echo 2 4-5 '|' diff - $MNTDIR/broadcast/mask
+assert ! echo 99 '>' $MNTDIR/broadcast/mask '2>/dev/null'
+assert printf "'ABC\\n   '" '>' $MNTDIR/broadcast/lram
+echo '[u8:0:3]add(u8:0:3, u8:4:7)' > $MNTDIR/broadcast/pram
+assert diff $MNTDIR/broadcast/pram $MNTDIR/unit4/pram
+assert [[ ! -s $MNTDIR/unit3/lram ]]
+assert echo 2 '>' $MNTDIR/ctrl
+assert echo 4 '>' $MNTDIR/ctrl
+assert printf '2\\n4\\n' '|' diff - '<(sort' $MNTDIR/ctrl')'
+assert printf "'abc\\n   '" '|' diff - $MNTDIR/unit2/lram
+assert diff $MNTDIR/unit2/lram $MNTDIR/unit4/lram
+assert printf "'ABC\\n   '" '|' diff - $MNTDIR/unit5/lram
+# Truncating the image publishes an empty one
+assert printf "''" '>' $MNTDIR/broadcast/lram
+assert [[ ! -s $MNTDIR/broadcast/lram ]]
+assert [[ ! -s $MNTDIR/unit5/lram ]]
+
+# End of test section
+
+if [[ $RESULT -ne 0 ]]; then
+    printf "\n****************FAILED****************\n"
+else
+    printf "\nAll is fine!\n"
+fi
+
+exit $RESULT
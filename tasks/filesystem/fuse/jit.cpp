@@ -0,0 +1,448 @@
+#include "jit.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pram.hpp"
+
+extern char** environ;
+
+namespace mycpu {
+
+namespace {
+
+// Исходник дополняется заголовками для типов entrypoint и оберткой с C-именем;
+// #line сохраняет номера строк pram в диагностике компилятора
+constexpr const char* kPreamble = "#include <cstddef>\n#include <cstdint>\n#line 1 \"pram\"\n";
+constexpr const char* kWrapper =
+    "\n#line 1 \"mycpu-entry\"\n"
+    "extern \"C\" int mycpu_entrypoint(uint32_t size, uint8_t* ram) { return entrypoint(size, ram); }\n";
+const char* const kFlags[] = {"-std=c++20", "-O2", "-fPIC", "-shared"};
+
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// SHA-256: имя в кеше должно совпадать между запусками драйвера (std::hash этого не обещает),
+// а подобрать другой исходник с тем же именем нельзя - библиотека из кеша не проверяется
+std::string contentHash(std::string_view text) {
+  static const uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+  // Дополнение: 0x80, нули до 56 байт по модулю 64 и длина в битах (big-endian)
+  std::string data(text);
+  uint64_t bits = (uint64_t)text.size() * 8;
+  data += '\x80';
+  while (data.size() % 64 != 56) data += '\0';
+  for (int i = 7; i >= 0; i--) data += (char)(bits >> (i * 8));
+
+  for (size_t block = 0; block < data.size(); block += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      const auto* p = (const unsigned char*)data.data() + block + i * 4;
+      w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+  }
+  char out[65];
+  for (int i = 0; i < 8; i++) std::snprintf(out + i * 8, 9, "%08x", h[i]);
+  return out;
+}
+
+// Ошибка, которая не зависит от исходника (компилятор не запустился, сборка не уложилась во время):
+// для вызывающего - ProgramError, но в кеше сборок не остается, следующая сборка пробует снова
+class TransientError : public ProgramError {
+ public:
+  using ProgramError::ProgramError;
+};
+
+std::string defaultCacheDir() {
+  return (std::filesystem::temp_directory_path() / ("mycpu-jit-" + std::to_string(getuid()))).string();
+}
+
+std::string defaultRunner() {
+  std::error_code ec;
+  auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+  if (ec) return "mycpu_runner";
+  return (self.parent_path() / "mycpu_runner").string();
+}
+
+// Функция выбора первой диагностики компилятора: строка с "error", иначе первая строка
+std::string firstDiagnostic(const std::string &log) {
+  std::istringstream in(log);
+  std::string line, first;
+  while (std::getline(in, line)) {
+    if (first.empty()) first = line;
+    if (line.find("error") != std::string::npos) {
+      first = line;
+      break;
+    }
+  }
+  if (first.size() > 200) first.resize(200);
+  return first;
+}
+
+void writeAll(int fd, const uint8_t* data, size_t size) {
+  for (size_t done = 0; done < size;) {
+    ssize_t n = pwrite(fd, data + done, size - done, (off_t)done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throwErrno("write memfd");
+    }
+    done += (size_t)n;
+  }
+}
+
+// Функция ожидания процесса не дольше timeout: false - не завершился (status не заполнен).
+// У процесса нет дескриптора для poll, поэтому waitpid с WNOHANG опрашивается с паузами.
+bool waitFor(pid_t pid, int &status, std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;;) {
+    pid_t done = waitpid(pid, &status, WNOHANG);
+    if (done == pid) return true;
+    if (done < 0 && errno != EINTR) throwErrno("waitpid");
+    if (std::chrono::steady_clock::now() >= deadline) return false;
+    usleep(10000);
+  }
+}
+
+void readAll(int fd, uint8_t* data, size_t size) {
+  for (size_t done = 0; done < size;) {
+    ssize_t n = pread(fd, data + done, size - done, (off_t)done);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      throwErrno("read memfd");
+    }
+    done += (size_t)n;
+  }
+}
+
+}  // namespace
+
+bool isNativeSource(std::string_view text) { return text.find("entrypoint") != std::string_view::npos; }
+
+Jit::Jit(JitConfig config) : config_(std::move(config)) {
+  if (config_.cacheDir.empty()) config_.cacheDir = defaultCacheDir();
+  if (config_.runner.empty()) config_.runner = defaultRunner();
+}
+
+Jit::~Jit() {
+  for (Runner &r : idle_) Kill(r);
+}
+
+size_t Jit::Compilations() const {
+  std::lock_guard lock(mutex_);
+  return compilations_;
+}
+
+std::string Jit::Build(std::string_view source) {
+  std::string text = kPreamble + std::string(source) + kWrapper;
+  std::string key = config_.compiler;
+  for (const char* flag : kFlags) key += std::string(" ") + flag;
+  std::string hash = contentHash(key + '\0' + text);
+
+  std::promise<std::string> promise;
+  std::shared_future<std::string> build;
+  bool owner = false;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = builds_.find(hash);
+    if (it == builds_.end()) {
+      build = promise.get_future().share();
+      builds_.emplace(hash, build);
+      owner = true;
+    } else {
+      build = it->second;
+    }
+  }
+  if (owner) {
+    try {
+      promise.set_value(Compile(text, hash));
+    } catch (const TransientError &) {
+      promise.set_exception(std::current_exception());
+      std::lock_guard lock(mutex_);
+      builds_.erase(hash);
+    } catch (const ProgramError &) {
+      // Ошибка компиляции повторится на том же исходнике - остается в кеше
+      promise.set_exception(std::current_exception());
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+      std::lock_guard lock(mutex_);
+      builds_.erase(hash);
+    }
+  }
+  return build.get();
+}
+
+std::string Jit::Compile(const std::string &text, const std::string &hash) {
+  std::string dir = config_.cacheDir;
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) throwErrno("create jit cache " + dir);
+  struct stat st;
+  if (stat(dir.c_str(), &st) != 0) throwErrno("stat jit cache " + dir);
+  // Библиотеки из кеша загружаются в исполнитель: чужой каталог не используется
+  if (!S_ISDIR(st.st_mode) || st.st_uid != getuid()) {
+    throw std::system_error(EACCES, std::generic_category(), "jit cache " + dir + " is not owned by the driver user");
+  }
+
+  std::string library = dir + "/" + hash + ".so";
+  if (access(library.c_str(), R_OK) == 0) return library;
+
+  // Временные имена уникальны в процессе (сборка одного хеша - одна) и между процессами
+  std::string base = dir + "/" + hash + "." + std::to_string(getpid());
+  std::string sourcePath = base + ".cpp", objectPath = base + ".so", logPath = base + ".log";
+  {
+    std::ofstream out(sourcePath, std::ios::binary | std::ios::trunc);
+    out << text;
+    if (!out.flush()) throw std::system_error(EIO, std::generic_category(), "write " + sourcePath);
+  }
+
+  std::vector<std::string> args = {config_.compiler};
+  for (const char* flag : kFlags) args.push_back(flag);
+  args.insert(args.end(), {"-o", objectPath, sourcePath});
+  std::vector<char*> argv;
+  for (auto &a : args) argv.push_back(a.data());
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, 1, logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  posix_spawn_file_actions_adddup2(&actions, 1, 2);
+  // Своя группа процессов: по истечении времени убиваются и cc1plus, as, ld, запущенные компилятором
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+  pid_t pid;
+  int err = posix_spawnp(&pid, config_.compiler.c_str(), &actions, &attr, argv.data(), environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  int status = 0;
+  bool timedOut = false;
+  if (err == 0) {
+    timedOut = !waitFor(pid, status, config_.compileTimeout);
+    if (timedOut) {
+      kill(-pid, SIGKILL);
+      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+      }
+    }
+  }
+
+  std::ifstream logFile(logPath, std::ios::binary);
+  std::string log((std::istreambuf_iterator<char>(logFile)), std::istreambuf_iterator<char>());
+  unlink(sourcePath.c_str());
+  unlink(logPath.c_str());
+  if (err != 0) {
+    throw TransientError("cannot run compiler " + config_.compiler + ": " + std::strerror(err));
+  }
+  if (timedOut) {
+    unlink(objectPath.c_str());
+    throw TransientError("compilation timed out after " + std::to_string(config_.compileTimeout.count()) + " ms");
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    unlink(objectPath.c_str());
+    std::string diagnostic = firstDiagnostic(log);
+    throw ProgramError("compilation failed" + (diagnostic.empty() ? "" : ": " + diagnostic));
+  }
+  if (rename(objectPath.c_str(), library.c_str()) != 0) {
+    unlink(objectPath.c_str());
+    throwErrno("rename " + objectPath);
+  }
+  std::lock_guard lock(mutex_);
+  compilations_++;
+  return library;
+}
+
+Jit::Runner Jit::Spawn() {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) throwErrno("socketpair");
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, sv[1], kRunnerSocket);
+  std::string path = config_.runner;
+  std::string cacheDir = config_.cacheDir;
+  char* argv[] = {path.data(), cacheDir.data(), nullptr};
+  Runner r;
+  int err = posix_spawn(&r.pid, path.c_str(), &actions, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(sv[1]);
+  if (err != 0) {
+    close(sv[0]);
+    throw std::system_error(err, std::generic_category(), "spawn " + path);
+  }
+  r.socket = sv[0];
+  return r;
+}
+
+void Jit::Kill(Runner &runner) {
+  // Закрытие сокета завершает исполнитель, ожидающий запроса
+  close(runner.socket);
+  while (waitpid(runner.pid, nullptr, 0) < 0 && errno == EINTR) {
+  }
+}
+
+void Jit::Run(const std::string &library, int fd, uint8_t* data, size_t size) {
+  if (size > UINT32_MAX) throw ProgramError("lram of " + std::to_string(size) + " bytes does not fit entrypoint size");
+
+  // Памяти без memfd исполнитель получает временную копию
+  int copy = -1;
+  if (fd < 0) {
+    copy = memfd_create("mycpu-run", MFD_CLOEXEC);
+    if (copy < 0) throwErrno("memfd_create");
+    try {
+      if (ftruncate(copy, (off_t)size) != 0) throwErrno("ftruncate memfd");
+      writeAll(copy, data, size);
+    } catch (...) {
+      close(copy);
+      throw;
+    }
+    fd = copy;
+  }
+
+  Runner runner;
+  {
+    std::lock_guard lock(mutex_);
+    if (!idle_.empty()) {
+      runner = idle_.back();
+      idle_.pop_back();
+    }
+  }
+  RunReply reply;
+  bool ok = false;
+  bool timedOut = false;
+  try {
+    if (runner.pid < 0) runner = Spawn();
+
+    std::string message(sizeof(RunRequest), '\0');
+    auto timeout = config_.timeout;
+    RunRequest request{size, (uint32_t)std::max<int64_t>(1, (timeout.count() + 999) / 1000)};
+    std::memcpy(message.data(), &request, sizeof(request));
+    message += library;
+    struct iovec iov = {message.data(), message.size()};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    // MSG_NOSIGNAL: упавший исполнитель не должен завершать драйвер SIGPIPE
+    ssize_t n;
+    while ((n = sendmsg(runner.socket, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (n == (ssize_t)message.size()) {
+      // Ответ ждется не дольше предела: зациклившаяся программа не держит поток юнита
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      struct pollfd pfd = {runner.socket, POLLIN, 0};
+      int ready;
+      do {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        ready = poll(&pfd, 1, (int)std::max<int64_t>(0, left.count()));
+      } while (ready < 0 && errno == EINTR);
+      if (ready > 0) {
+        while ((n = recv(runner.socket, &reply, sizeof(reply), 0)) < 0 && errno == EINTR) {
+        }
+        ok = n == (ssize_t)sizeof(reply);
+      } else {
+        timedOut = true;
+      }
+    }
+  } catch (...) {
+    if (copy >= 0) close(copy);
+    throw;
+  }
+
+  std::string crash;
+  if (ok) {
+    std::lock_guard lock(mutex_);
+    idle_.push_back(runner);
+  } else {
+    close(runner.socket);
+    int status = 0;
+    kill(runner.pid, SIGKILL);
+    while (waitpid(runner.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (timedOut) {
+      crash = "native program timed out after " + std::to_string(config_.timeout.count()) + " ms";
+    } else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU) {
+      crash = "native program exceeded the CPU time limit";
+    } else if (WIFSIGNALED(status)) {
+      crash = "native program crashed: killed by signal " + std::to_string(WTERMSIG(status)) + " (" +
+              strsignal(WTERMSIG(status)) + ")";
+    } else {
+      crash = "native program crashed: runner exited with status " + std::to_string(WEXITSTATUS(status));
+    }
+  }
+
+  if (copy >= 0) {
+    try {
+      if (ok) readAll(copy, data, size);
+    } catch (...) {
+      close(copy);
+      throw;
+    }
+    close(copy);
+  }
+  if (!crash.empty()) throw ProgramError(crash);
+  reply.error[sizeof(reply.error) - 1] = '\0';
+  if (reply.error[0]) throw ProgramError(reply.error);
+  if (reply.result != 0) throw ProgramError("entrypoint returned " + std::to_string(reply.result));
+}
+
+}  // namespace mycpu
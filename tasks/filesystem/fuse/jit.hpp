@@ -0,0 +1,97 @@
+#pragma once
+
+// Нативные программы pram: исходник C++ с функцией
+//   int entrypoint(uint32_t size, uint8_t* ram)
+// собирается локальным компилятором в разделяемую библиотеку и исполняется в отдельном
+// процессе-исполнителе (mycpu_runner), который загружает ее через dlopen и вызывает
+// entrypoint над lram. lram передается исполнителю дескриптором memfd и отображается
+// в него без копирования.
+//
+// Библиотеки кешируются по SHA-256 исходника (вместе с компилятором и флагами) в каталоге
+// кеша: одинаковые программы разных юнитов и разных запусков драйвера собираются один раз.
+// Исполнитель изолирован от драйвера: падение или порча памяти в программе завершают
+// только его, юнит завершается с ошибкой, а следующий запуск получает новый исполнитель.
+// Доступ программы к файлам, сети и другим процессам ограничен (runner.cpp).
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+namespace mycpu {
+
+struct JitConfig {
+  std::string compiler = "c++";
+  std::string cacheDir;  // Пусто - <temp>/mycpu-jit-<uid>
+  std::string runner;    // Пусто - mycpu_runner рядом с исполняемым файлом
+  // Предел времени одного исполнения: по истечении исполнитель убивается, юнит завершается
+  // с ошибкой. Тот же предел (с округлением вверх до секунд) - RLIMIT_CPU в исполнителе.
+  std::chrono::milliseconds timeout{10000};
+  // Предел времени сборки: по истечении компилятор со всеми своими процессами убивается
+  std::chrono::milliseconds compileTimeout{60000};
+};
+
+// Протокол исполнителя по сокету SOCK_SEQPACKET на дескрипторе kRunnerSocket (argv[1] - каталог кеша):
+// запрос - RunRequest, за ним путь к библиотеке, memfd памяти - в SCM_RIGHTS;
+// ответ - RunReply. Закрытие сокета драйвером завершает исполнитель.
+constexpr int kRunnerSocket = 3;
+constexpr const char* kRunnerEntry = "mycpu_entrypoint";
+
+struct RunRequest {
+  uint64_t size;
+  uint32_t cpuSeconds;  // Предел процессорного времени на этот запуск
+};
+
+struct RunReply {
+  int32_t result;   // Код возврата entrypoint
+  char error[244];  // Не пусто - библиотека не загружена, result не определен
+};
+
+// Функция распознавания нативной программы: текст pram определяет entrypoint
+bool isNativeSource(std::string_view text);
+
+class Jit {
+ public:
+  explicit Jit(JitConfig config = {});
+  ~Jit();
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // Функция сборки исходника: путь к библиотеке в кеше. Ошибка компиляции или превышение
+  // config.compileTimeout - ProgramError с первой диагностикой компилятора.
+  // Одновременные сборки одного исходника ждут одну.
+  std::string Build(std::string_view source);
+
+  // Функция исполнения библиотеки над памятью (fd - ее memfd, -1 - памяти без memfd
+  // передается временная копия). Ненулевой код entrypoint, падение или превышение
+  // config.timeout - ProgramError.
+  void Run(const std::string &library, int fd, uint8_t* data, size_t size);
+
+  // Число сборок компилятором (без попаданий в кеш)
+  size_t Compilations() const;
+
+ private:
+  struct Runner {
+    pid_t pid = -1;
+    int socket = -1;
+  };
+
+  std::string Compile(const std::string &source, const std::string &hash);
+  Runner Spawn();
+  void Kill(Runner &runner);
+
+  JitConfig config_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_future<std::string>> builds_;  // Хеш -> путь к библиотеке
+  size_t compilations_ = 0;
+  std::vector<Runner> idle_;  // Свободные исполнители; занятый принадлежит потоку юнита
+};
+
+}  // namespace mycpu
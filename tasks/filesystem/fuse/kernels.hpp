@@ -0,0 +1,19 @@
+#pragma once
+
+// Ядра инструкций pram, у которых выход и оба входа одного типа. Ядро - цикл по элементам
+// без ветвлений (кроме div и mod для целых), который компилятор векторизует; вариант AVX2
+// выбирается в рантайме. Результат совпадает с общим путем runProgram: для add/sub/mul
+// над целыми младшие биты 64-битного результата равны результату в типе, а для f32
+// округление double до float дает то же, что вычисление во float.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pram.hpp"
+
+namespace mycpu {
+
+// Функция выбора ядра над n элементами; out может совпадать со входом
+Kernel selectKernel(Operation op, ValueType type);
+
+}  // namespace mycpu
@@ -0,0 +1,132 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace mycpu {
+
+namespace {
+
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+size_t pageSize() {
+  static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return page;
+}
+
+size_t roundUp(size_t size, size_t align) { return (size + align - 1) / align * align; }
+
+}  // namespace
+
+MemoryBuffer::~MemoryBuffer() {
+  if (data) munmap(data, capacity);
+  if (fd >= 0) close(fd);
+}
+
+void MemoryBuffer::Reserve(size_t n) {
+  if (n > capacity) {
+    size_t newCapacity = std::max(roundUp(n, pageSize()), capacity * 2);
+    if (fd < 0 && !anonymous) {
+      fd = memfd_create("mycpu", MFD_CLOEXEC);
+      anonymous = fd < 0;
+    }
+    if (!anonymous && ftruncate(fd, (off_t)newCapacity) != 0) throwErrno("ftruncate memfd");
+    void* p;
+    if (data) {
+      p = mremap(data, capacity, newCapacity, MREMAP_MAYMOVE);
+    } else if (anonymous) {
+      p = mmap(nullptr, newCapacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    } else {
+      p = mmap(nullptr, newCapacity, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (p == MAP_FAILED) throwErrno("mmap unit memory");
+    data = static_cast<uint8_t*>(p);
+    capacity = newCapacity;
+  }
+  size = std::max(size, n);
+}
+
+void MemoryBuffer::Truncate(size_t n) {
+  if (n >= size) return;
+  // Неполная страница - обнулением, целые страницы возвращаются системе и читаются нулями
+  size_t head = std::min(roundUp(n, pageSize()), size);
+  std::memset(data + n, 0, head - n);
+  size_t tail = roundUp(size, pageSize());
+  if (tail > head) {
+    int rc = anonymous ? madvise(data + head, tail - head, MADV_DONTNEED)
+                       : fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (off_t)head, (off_t)(tail - head));
+    if (rc != 0) std::memset(data + head, 0, size - head);
+  }
+  size = n;
+}
+
+MemoryBuffer &Memory::Own(size_t keep) {
+  // Счетчик ссылок растет только через эту память или снимок, сделанный под ее
+  // блокировкой, поэтому 1 под исключительной блокировкой значит, что буфер только ее
+  if (!buffer_ || buffer_.use_count() > 1) {
+    auto own = std::make_shared<MemoryBuffer>();
+    size_t n = buffer_ ? std::min(keep, buffer_->size) : 0;
+    if (n) {
+      own->Reserve(n);
+      std::memcpy(own->data, buffer_->data, n);
+    }
+    buffer_ = std::move(own);
+  }
+  return *buffer_;
+}
+
+size_t Memory::Size() const {
+  std::shared_lock lock(mutex_);
+  return buffer_ ? buffer_->size : 0;
+}
+
+size_t Memory::Read(size_t offset, void* out, size_t size) const {
+  std::shared_lock lock(mutex_);
+  if (!buffer_ || offset >= buffer_->size) return 0;
+  size = std::min(size, buffer_->size - offset);
+  std::memcpy(out, buffer_->data + offset, size);
+  return size;
+}
+
+void Memory::Write(size_t offset, const void* data, size_t size) {
+  std::unique_lock lock(mutex_);
+  MemoryBuffer &b = Own(SIZE_MAX);
+  b.Reserve(offset + size);
+  std::memcpy(b.data + offset, data, size);
+  version_.fetch_add(1, std::memory_order_release);
+}
+
+void Memory::Resize(size_t size) {
+  std::unique_lock lock(mutex_);
+  MemoryBuffer &b = Own(size);
+  if (size > b.size) {
+    b.Reserve(size);
+  } else {
+    b.Truncate(size);
+  }
+  version_.fetch_add(1, std::memory_order_release);
+}
+
+MemoryImage Memory::Snapshot() const {
+  std::shared_lock lock(mutex_);
+  MemoryImage image;
+  image.buffer_ = buffer_;
+  image.version_ = Version();
+  return image;
+}
+
+uint64_t Memory::Assign(const MemoryImage &image) {
+  std::unique_lock lock(mutex_);
+  buffer_ = image.buffer_;
+  return version_.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+}  // namespace mycpu
@@ -0,0 +1,145 @@
+#pragma once
+
+// Память юнита (pram, lram): растущий байтовый буфер в memfd, отображенный в адресное
+// пространство драйвера. Через отображение работают программы и memcpy-чтения, а через
+// дескриптор memfd драйвер передает данные в FUSE и из FUSE сплайсом, без копирования
+// в пространстве пользователя. Если memfd создать нельзя (например, исчерпан лимит
+// дескрипторов), память - анонимное отображение без дескриптора.
+//
+// Размер памяти отделен от емкости: емкость выровнена по страницам и растет удвоением
+// (ftruncate memfd + mremap), байты за размером всегда нулевые. Чтения идут параллельно,
+// изменения - под исключительной блокировкой, поэтому указатель на данные внутри
+// View/Modify не меняется.
+//
+// Содержимое может быть общим у нескольких памятей (рассылка одного образа юнитам):
+// буфер копируется при первом изменении (copy-on-write), пока изменений нет - он один.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+namespace mycpu {
+
+// Буфер памяти: memfd и его отображение
+struct MemoryBuffer {
+  int fd = -1;
+  uint8_t* data = nullptr;
+  size_t size = 0;
+  size_t capacity = 0;
+  bool anonymous = false;  // memfd не создан: анонимное отображение
+
+  MemoryBuffer() = default;
+  ~MemoryBuffer();
+  MemoryBuffer(const MemoryBuffer &) = delete;
+  MemoryBuffer &operator=(const MemoryBuffer &) = delete;
+
+  // Функция роста емкости до size байт и размера до size (если больше текущего)
+  void Reserve(size_t size);
+  // Функция уменьшения размера до size с обнулением хвоста (емкость не меняется)
+  void Truncate(size_t size);
+};
+
+// Снимок содержимого памяти: буфер, общий с памятью до ее следующего изменения.
+// Данные снимка не меняются, версия - версия памяти (Memory::Version) в момент снимка.
+class MemoryImage {
+ public:
+  MemoryImage() = default;
+  const uint8_t* Data() const { return buffer_ ? buffer_->data : nullptr; }
+  size_t Size() const { return buffer_ ? buffer_->size : 0; }
+  uint64_t Version() const { return version_; }
+
+ private:
+  friend class Memory;
+  std::shared_ptr<MemoryBuffer> buffer_;
+  uint64_t version_ = 0;
+};
+
+class Memory {
+ public:
+  Memory() = default;
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+
+  size_t Size() const;
+  // Номер версии содержимого: растет при каждом изменении
+  uint64_t Version() const { return version_.load(std::memory_order_acquire); }
+  // Функция чтения до size байт со смещения offset; возвращает число прочитанных байт
+  size_t Read(size_t offset, void* out, size_t size) const;
+  // Функция записи; буфер растет до offset + size, промежуток заполняется нулями
+  void Write(size_t offset, const void* data, size_t size);
+  // Функция изменения размера; при уменьшении страницы за новым размером освобождаются
+  void Resize(size_t size);
+
+  // Функция получения снимка содержимого без копирования
+  MemoryImage Snapshot() const;
+  // Функция замены содержимого снимком без копирования; возвращает новую версию
+  uint64_t Assign(const MemoryImage &image);
+
+  // Функции доступа ко всему содержимому под разделяемой или исключительной блокировкой
+  template <typename F>
+  auto View(F f) const {
+    std::shared_lock lock(mutex_);
+    return f(buffer_ ? (const uint8_t*)buffer_->data : nullptr, buffer_ ? buffer_->size : 0);
+  }
+  template <typename F>
+  auto Modify(F f) {
+    std::unique_lock lock(mutex_);
+    MemoryBuffer &b = Own(SIZE_MAX);
+    return f(b.data, b.size);
+  }
+
+  // Функция чтения через дескриптор: f(fd, data, size) под разделяемой блокировкой;
+  // fd == -1 - у памяти нет memfd, данные только по указателю
+  template <typename F>
+  auto ViewFd(F f) const {
+    std::shared_lock lock(mutex_);
+    if (!buffer_) return f(-1, (const uint8_t*)nullptr, (size_t)0);
+    return f(buffer_->fd, (const uint8_t*)buffer_->data, buffer_->size);
+  }
+
+  // Функция изменения через дескриптор: f(fd, data, size) под исключительной блокировкой;
+  // размер не меняется, данные меняются через отображение или через fd
+  template <typename F>
+  auto ModifyFd(F f) {
+    std::unique_lock lock(mutex_);
+    MemoryBuffer &b = Own(SIZE_MAX);
+    return f(b.fd, b.data, b.size);
+  }
+
+  // Функция записи через дескриптор: память растет до offset + size, затем
+  // copy(fd, dst) пишет данные в fd со смещения offset (или по указателю dst при fd == -1)
+  // и возвращает число записанных байт. Размер - по фактически записанному.
+  template <typename F>
+  size_t WriteFd(size_t offset, size_t size, F copy) {
+    std::unique_lock lock(mutex_);
+    MemoryBuffer &b = Own(SIZE_MAX);
+    size_t oldSize = b.size;
+    b.Reserve(offset + size);
+    size_t written = 0;
+    try {
+      written = copy(b.fd, b.data + offset);
+    } catch (...) {
+      b.Truncate(oldSize);
+      throw;
+    }
+    size_t end = std::max(oldSize, written ? offset + written : oldSize);
+    b.Truncate(end);
+    version_.fetch_add(1, std::memory_order_release);
+    return written;
+  }
+
+ private:
+  // Функция получения собственного буфера для изменения: общий буфер копируется
+  // (первые keep байт - остальные все равно будут отброшены)
+  MemoryBuffer &Own(size_t keep);
+
+  mutable std::shared_mutex mutex_;
+  std::shared_ptr<MemoryBuffer> buffer_;
+  std::atomic<uint64_t> version_{0};
+};
+
+}  // namespace mycpu
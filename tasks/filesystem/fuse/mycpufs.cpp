@@ -0,0 +1,584 @@
+// Драйвер mycpu на низкоуровневом API libfuse3 (3.2+):
+//   /ctrl              - запуск юнитов (запись номеров) и ожидание завершения (чтение)
+//   /unitN/pram        - программа юнита
+//   /unitN/lram        - данные юнита
+//   /stats, /unitN/stats - статистика исполнения устройства и юнита (только чтение)
+//   /broadcast/mask    - юниты, которым рассылаются образы (номера и диапазоны N-M, all)
+//   /broadcast/pram, /broadcast/lram - образ, рассылаемый при закрытии в pram или lram юнитов из маски
+// Число юнитов задается при запуске: mycpu --units=N [--threads=N] [-f] <mountpoint>;
+// --cxx, --jit-cache, --compile-timeout и --run-timeout настраивают сборку и исполнение нативных программ (jit.hpp)
+//
+// Дерево неизменно, поэтому inode вычисляются из номера юнита, а не хранятся:
+// 1 - корень, 2 - ctrl, 3 - stats, 4-7 - broadcast (каталог, mask, pram, lram),
+// далее по четыре на юнит (каталог, pram, lram, stats).
+// Запросы обслуживаются многопоточным циклом FUSE; синхронизация - в модели устройства.
+
+#define FUSE_USE_VERSION 32
+
+#include <fuse_lowlevel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "device.hpp"
+#include "polls.hpp"
+#include "pram.hpp"
+
+using namespace mycpu;
+
+namespace {
+
+constexpr fuse_ino_t kRootIno = FUSE_ROOT_ID;
+constexpr fuse_ino_t kCtrlIno = 2;
+constexpr fuse_ino_t kStatsIno = 3;
+constexpr fuse_ino_t kBroadcastIno = 4;  // Каталог рассылки и его файлы mask, pram, lram - следующие три
+constexpr fuse_ino_t kFirstUnitIno = 8;
+constexpr size_t kUnitInos = 4;
+constexpr double kTreeTimeout = 3600;  // Имена и атрибуты каталогов не меняются
+constexpr unsigned kMaxWrite = 1 << 20;  // Запрашиваемый размер записи за запрос
+
+enum class NodeKind {
+  Root, Ctrl, Stats, Broadcast, Mask, BroadcastPram, BroadcastLram, UnitDir, Pram, Lram, UnitStats
+};
+
+struct Node {
+  NodeKind kind;
+  size_t unit = 0;
+};
+
+class MyCpuFs {
+ public:
+  MyCpuFs(size_t units, size_t threads, JitConfig jit)
+      : device_(units, threads, std::move(jit)), uid_(getuid()), gid_(getgid()), created_(time(nullptr)) {
+    device_.SetCompletionListener([this] { polls_.Notify(); });
+  }
+
+  Device &device() { return device_; }
+  // Ожидания poll на ctrl (polls.hpp): завершения юнитов будят их через fuse_lowlevel_notify_poll
+  PollWaiters<fuse_pollhandle*> &polls() { return polls_; }
+
+  fuse_ino_t UnitIno(size_t unit, NodeKind kind) const {
+    size_t index = kind == NodeKind::UnitDir ? 0 : kind == NodeKind::Pram ? 1 : kind == NodeKind::Lram ? 2 : 3;
+    return kFirstUnitIno + unit * kUnitInos + index;
+  }
+
+  // Функция разбора inode; неизвестный - ENOENT
+  Node Resolve(fuse_ino_t ino) const {
+    if (ino == kRootIno) return {NodeKind::Root};
+    if (ino == kCtrlIno) return {NodeKind::Ctrl};
+    if (ino == kStatsIno) return {NodeKind::Stats};
+    if (ino >= kBroadcastIno && ino < kFirstUnitIno) {
+      static const NodeKind kinds[] = {NodeKind::Broadcast, NodeKind::Mask, NodeKind::BroadcastPram,
+                                       NodeKind::BroadcastLram};
+      return {kinds[ino - kBroadcastIno]};
+    }
+    if (ino < kFirstUnitIno || ino - kFirstUnitIno >= device_.Units() * kUnitInos) {
+      throw std::system_error(ENOENT, std::generic_category());
+    }
+    size_t index = ino - kFirstUnitIno;
+    static const NodeKind kinds[] = {NodeKind::UnitDir, NodeKind::Pram, NodeKind::Lram, NodeKind::UnitStats};
+    return {kinds[index % kUnitInos], index / kUnitInos};
+  }
+
+  static bool IsDir(const Node &node) {
+    return node.kind == NodeKind::Root || node.kind == NodeKind::Broadcast || node.kind == NodeKind::UnitDir;
+  }
+  static bool IsStats(const Node &node) { return node.kind == NodeKind::Stats || node.kind == NodeKind::UnitStats; }
+
+  // Функция получения текста статистики узла Stats или UnitStats
+  std::string StatsText(const Node &node) {
+    return node.kind == NodeKind::Stats ? device_.Stats() : device_.Stats(node.unit);
+  }
+
+  Memory &memory(const Node &node) {
+    if (node.kind == NodeKind::BroadcastPram) return device_.broadcastPram();
+    if (node.kind == NodeKind::BroadcastLram) return device_.broadcastLram();
+    Unit &u = device_.unit(node.unit);
+    return node.kind == NodeKind::Pram ? u.pram : u.lram;
+  }
+
+  struct stat Stat(fuse_ino_t ino) {
+    Node node = Resolve(ino);
+    struct stat st;
+    std::memset(&st, 0, sizeof(st));
+    st.st_ino = ino;
+    st.st_uid = uid_;
+    st.st_gid = gid_;
+    st.st_atime = st.st_mtime = st.st_ctime = created_;
+    if (IsDir(node)) {
+      st.st_mode = S_IFDIR | 0755;
+      st.st_nlink = 2;
+    } else if (IsStats(node)) {
+      st.st_mode = S_IFREG | 0444;
+      st.st_nlink = 1;
+      st.st_size = (off_t)StatsText(node).size();
+    } else {
+      st.st_mode = S_IFREG | 0644;
+      st.st_nlink = 1;
+      if (node.kind == NodeKind::Mask) {
+        st.st_size = (off_t)device_.BroadcastMask().size();
+      } else if (node.kind != NodeKind::Ctrl) {
+        st.st_size = (off_t)memory(node).Size();
+      }
+    }
+    return st;
+  }
+
+  // Функция поиска имени в каталоге; 0 - нет такого имени
+  fuse_ino_t Lookup(fuse_ino_t parent, const std::string &name) const {
+    Node node = Resolve(parent);
+    if (node.kind == NodeKind::UnitDir) {
+      if (name == "pram") return UnitIno(node.unit, NodeKind::Pram);
+      if (name == "lram") return UnitIno(node.unit, NodeKind::Lram);
+      if (name == "stats") return UnitIno(node.unit, NodeKind::UnitStats);
+      return 0;
+    }
+    if (node.kind == NodeKind::Broadcast) {
+      if (name == "mask") return kBroadcastIno + 1;
+      if (name == "pram") return kBroadcastIno + 2;
+      if (name == "lram") return kBroadcastIno + 3;
+      return 0;
+    }
+    if (node.kind != NodeKind::Root) throw std::system_error(ENOTDIR, std::generic_category());
+    if (name == "ctrl") return kCtrlIno;
+    if (name == "stats") return kStatsIno;
+    if (name == "broadcast") return kBroadcastIno;
+    // unitN без ведущих нулей
+    if (name.size() < 5 || name.compare(0, 4, "unit") != 0 || (name[4] == '0' && name.size() > 5)) return 0;
+    size_t unit = 0;
+    for (size_t i = 4; i < name.size(); i++) {
+      if (name[i] < '0' || name[i] > '9' || unit > device_.Units()) return 0;
+      unit = unit * 10 + (name[i] - '0');
+    }
+    return unit < device_.Units() ? UnitIno(unit, NodeKind::UnitDir) : 0;
+  }
+
+  struct Entry {
+    std::string name;
+    fuse_ino_t ino;
+    bool dir;
+  };
+
+  // Функция перечисления записей каталога с номера from: ".", "..", затем содержимое
+  // (в корне - ctrl, stats, broadcast и юниты, в юните - pram, lram, stats, в broadcast - mask, pram, lram)
+  std::vector<Entry> Entries(fuse_ino_t ino, size_t from, size_t limit) const {
+    Node node = Resolve(ino);
+    if (!IsDir(node)) throw std::system_error(ENOTDIR, std::generic_category());
+    std::vector<Entry> out;
+    size_t count = node.kind == NodeKind::Root ? 5 + device_.Units() : 5;
+    for (size_t i = from; i < count && out.size() < limit; i++) {
+      if (i < 2) {
+        out.push_back({i == 0 ? "." : "..", i == 0 ? ino : kRootIno, true});
+      } else if (node.kind == NodeKind::UnitDir) {
+        static const std::pair<const char*, NodeKind> files[] = {
+            {"pram", NodeKind::Pram}, {"lram", NodeKind::Lram}, {"stats", NodeKind::UnitStats}};
+        out.push_back({files[i - 2].first, UnitIno(node.unit, files[i - 2].second), false});
+      } else if (node.kind == NodeKind::Broadcast) {
+        static const char* const files[] = {"mask", "pram", "lram"};
+        out.push_back({files[i - 2], kBroadcastIno + i - 1, false});
+      } else if (i == 2) {
+        out.push_back({"ctrl", kCtrlIno, false});
+      } else if (i == 3) {
+        out.push_back({"stats", kStatsIno, false});
+      } else if (i == 4) {
+        out.push_back({"broadcast", kBroadcastIno, true});
+      } else {
+        out.push_back({"unit" + std::to_string(i - 5), UnitIno(i - 5, NodeKind::UnitDir), true});
+      }
+    }
+    return out;
+  }
+
+ private:
+  // Перед устройством: потоки устройства будят ожидания до своей остановки в ~Device
+  PollWaiters<fuse_pollhandle*> polls_{[](fuse_pollhandle* ph) { fuse_lowlevel_notify_poll(ph); },
+                                       fuse_pollhandle_destroy};
+  Device device_;
+  uid_t uid_;
+  gid_t gid_;
+  time_t created_;
+};
+
+MyCpuFs &fs(fuse_req_t req) { return *static_cast<MyCpuFs*>(fuse_req_userdata(req)); }
+
+// Функция вызова обработчика: исключение превращается в ответ с кодом ошибки.
+// Обработчик отвечает на запрос последним действием, после ответа он не бросает.
+template <typename F>
+void handle(fuse_req_t req, F f) {
+  int err;
+  try {
+    f();
+    return;
+  } catch (const std::system_error &e) {
+    err = e.code().value();
+  } catch (const std::invalid_argument &) {
+    err = EINVAL;
+  } catch (const ProgramError &) {
+    err = EINVAL;
+  } catch (const std::bad_alloc &) {
+    err = ENOMEM;
+  } catch (...) {
+    err = EIO;
+  }
+  fuse_reply_err(req, err);
+}
+
+// Состояние открытого файла статистики или рассылки, у ctrl - только адрес для ожиданий poll;
+// у остальных файлов его нет (nullptr)
+struct OpenFile {
+  std::string text;                  // Статистика: снимок текста на момент открытия
+  std::atomic<bool> written{false};  // Рассылка: образ изменен через этот файл и не разослан
+};
+
+OpenFile* openFile(struct fuse_file_info* fi) { return reinterpret_cast<OpenFile*>((uintptr_t)fi->fh); }
+
+double attrTimeout(const struct stat &st) { return S_ISDIR(st.st_mode) ? kTreeTimeout : 0; }
+
+void opLookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+  handle(req, [&] {
+    fuse_ino_t ino = fs(req).Lookup(parent, name);
+    if (!ino) throw std::system_error(ENOENT, std::generic_category());
+    struct fuse_entry_param e;
+    std::memset(&e, 0, sizeof(e));
+    e.ino = ino;
+    e.attr = fs(req).Stat(ino);
+    e.attr_timeout = attrTimeout(e.attr);
+    e.entry_timeout = kTreeTimeout;
+    fuse_reply_entry(req, &e);
+  });
+}
+
+void opGetattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info*) {
+  handle(req, [&] {
+    struct stat st = fs(req).Stat(ino);
+    fuse_reply_attr(req, &st, attrTimeout(st));
+  });
+}
+
+// Из атрибутов меняется только размер pram и lram (truncate; O_TRUNC без FUSE_CAP_ATOMIC_O_TRUNC - тоже здесь,
+// с ним - в opOpen); остальное принимается без изменений.
+// Образ рассылки после truncate без записи рассылается при закрытии файла, открытого с O_TRUNC.
+void opSetattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int toSet, struct fuse_file_info*) {
+  handle(req, [&] {
+    Node node = fs(req).Resolve(ino);
+    if (toSet & FUSE_SET_ATTR_SIZE) {
+      if (node.kind == NodeKind::Pram || node.kind == NodeKind::Lram || node.kind == NodeKind::BroadcastPram ||
+          node.kind == NodeKind::BroadcastLram) {
+        fs(req).memory(node).Resize((size_t)attr->st_size);
+      } else if (MyCpuFs::IsStats(node)) {
+        throw std::system_error(EACCES, std::generic_category());
+      } else if (MyCpuFs::IsDir(node)) {
+        throw std::system_error(EISDIR, std::generic_category());
+      }
+    }
+    struct stat st = fs(req).Stat(ino);
+    fuse_reply_attr(req, &st, attrTimeout(st));
+  });
+}
+
+void opReaddir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info*) {
+  handle(req, [&] {
+    std::vector<char> buf(size);
+    size_t used = 0;
+    // Записей в ответе не больше, чем минимальных записей в буфере
+    auto entries = fs(req).Entries(ino, (size_t)off, size / 32 + 1);
+    for (size_t i = 0; i < entries.size(); i++) {
+      struct stat st;
+      std::memset(&st, 0, sizeof(st));
+      st.st_ino = entries[i].ino;
+      st.st_mode = entries[i].dir ? S_IFDIR : S_IFREG;
+      size_t need = fuse_add_direntry(req, buf.data() + used, size - used, entries[i].name.c_str(), &st,
+                                      off + (off_t)i + 1);
+      if (need > size - used) break;
+      used += need;
+    }
+    fuse_reply_buf(req, buf.data(), used);
+  });
+}
+
+void opOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+  handle(req, [&] {
+    Node node = fs(req).Resolve(ino);
+    if (MyCpuFs::IsDir(node)) throw std::system_error(EISDIR, std::generic_category());
+    // Размеры меняются в обход ядра (ctrl пуст, lram пишут программы): без page cache
+    fi->direct_io = 1;
+    // С FUSE_CAP_ATOMIC_O_TRUNC (по умолчанию в libfuse3) ядро передает O_TRUNC в open вместо setattr
+    if ((fi->flags & O_TRUNC) && (node.kind == NodeKind::Pram || node.kind == NodeKind::Lram ||
+                                  node.kind == NodeKind::BroadcastPram || node.kind == NodeKind::BroadcastLram)) {
+      fs(req).memory(node).Resize(0);
+    }
+    if (node.kind == NodeKind::Ctrl) {
+      fi->nonseekable = 1;
+      fi->fh = (uint64_t)(uintptr_t) new OpenFile;
+    } else if (MyCpuFs::IsStats(node)) {
+      // Права без default_permissions проверяет драйвер. Статистика читается снимком,
+      // сделанным при открытии: части текста при чтении порциями согласованы.
+      if ((fi->flags & O_ACCMODE) != O_RDONLY) throw std::system_error(EACCES, std::generic_category());
+      auto file = std::make_unique<OpenFile>();
+      file->text = fs(req).StatsText(node);
+      fi->fh = (uint64_t)(uintptr_t)file.release();
+    } else if (node.kind == NodeKind::BroadcastPram || node.kind == NodeKind::BroadcastLram) {
+      auto file = std::make_unique<OpenFile>();
+      file->written = (fi->flags & O_TRUNC) != 0;
+      fi->fh = (uint64_t)(uintptr_t)file.release();
+    }
+    if (fuse_reply_open(req, fi) != 0) delete openFile(fi);
+  });
+}
+
+// Рассылка образа - при закрытии (flush), а не при каждой записи: образ пишется порциями,
+// юниты получают его целиком. Рассылка pram не компилирует программу: ее собирает пул при запуске,
+// и ошибка компиляции - ошибка запуска, как после записи в pram юнита.
+void opFlush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+  handle(req, [&] {
+    Node node = fs(req).Resolve(ino);
+    OpenFile* file = openFile(fi);
+    if (file && file->written.exchange(false)) {
+      if (node.kind == NodeKind::BroadcastPram) fs(req).device().PublishPram();
+      if (node.kind == NodeKind::BroadcastLram) fs(req).device().PublishLram();
+    }
+    fuse_reply_err(req, 0);
+  });
+}
+
+void opRelease(fuse_req_t req, fuse_ino_t, struct fuse_file_info* fi) {
+  fs(req).polls().Remove(fi->fh);
+  delete openFile(fi);
+  fuse_reply_err(req, 0);
+}
+
+void opRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+  handle(req, [&] {
+    Node node = fs(req).Resolve(ino);
+    if (MyCpuFs::IsStats(node) || node.kind == NodeKind::Mask) {
+      std::string mask = node.kind == NodeKind::Mask ? fs(req).device().BroadcastMask() : "";
+      const std::string &text = node.kind == NodeKind::Mask ? mask : openFile(fi)->text;
+      size_t begin = std::min((size_t)off, text.size());
+      fuse_reply_buf(req, text.data() + begin, std::min(size, text.size() - begin));
+      return;
+    }
+    if (node.kind == NodeKind::Ctrl) {
+      // Ждет завершения, пока есть запущенные юниты; нет запущенных - конец файла.
+      // С O_NONBLOCK не ждет (EAGAIN): готовность сообщает poll, поток FUSE не занят ожиданием.
+      std::string lines = fs(req).device().ReadCtrl(size, !(fi->flags & O_NONBLOCK));
+      fuse_reply_buf(req, lines.data(), lines.size());
+      return;
+    }
+    // Ответ - прямо из memfd (splice в /dev/fuse) под разделяемой блокировкой: запись
+    // и запуск программы не меняют данные, пока ядро их забирает
+    fs(req).memory(node).ViewFd([&](int fd, const uint8_t* data, size_t total) {
+      size_t begin = std::min((size_t)off, total);
+      struct fuse_bufvec buf = FUSE_BUFVEC_INIT(std::min(size, total - begin));
+      if (fd >= 0) {
+        buf.buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        buf.buf[0].fd = fd;
+        buf.buf[0].pos = (off_t)begin;
+      } else {
+        buf.buf[0].mem = const_cast<uint8_t*>(data + begin);
+      }
+      fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+    });
+  });
+}
+
+// Запись через буферы FUSE: при splice данные приходят в канале и переносятся в memfd
+// без копирования в драйвер
+void opWriteBuf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv, off_t off, struct fuse_file_info* fi) {
+  handle(req, [&] {
+    Node node = fs(req).Resolve(ino);
+    size_t size = fuse_buf_size(bufv);
+    size_t written;
+    if (node.kind == NodeKind::Ctrl || node.kind == NodeKind::Mask) {
+      // Команда ctrl и маска рассылки - текст целиком в одной записи
+      std::string command(size, '\0');
+      struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+      dst.buf[0].mem = command.data();
+      ssize_t r = fuse_buf_copy(&dst, bufv, (enum fuse_buf_copy_flags)0);
+      if (r < 0) throw std::system_error((int)-r, std::generic_category());
+      command.resize((size_t)r);
+      if (node.kind == NodeKind::Ctrl) {
+        fs(req).device().Start(command);
+      } else {
+        fs(req).device().SetBroadcastMask(command);
+      }
+      written = (size_t)r;
+    } else {
+      written = fs(req).memory(node).WriteFd((size_t)off, size, [&](int fd, uint8_t* data) {
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+        if (fd >= 0) {
+          dst.buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+          dst.buf[0].fd = fd;
+          dst.buf[0].pos = off;
+        } else {
+          dst.buf[0].mem = data;
+        }
+        ssize_t r = fuse_buf_copy(&dst, bufv, FUSE_BUF_SPLICE_MOVE);
+        if (r < 0) throw std::system_error((int)-r, std::generic_category());
+        return (size_t)r;
+      });
+      if (OpenFile* file = openFile(fi)) file->written = true;
+    }
+    fuse_reply_write(req, written);
+  });
+}
+
+// poll: ctrl готов к чтению, когда есть непрочитанные завершения, к записи - всегда; остальные
+// файлы готовы всегда. Ожидание регистрируется до проверки, поэтому завершение между ними не теряется.
+void opPoll(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi, struct fuse_pollhandle* ph) {
+  handle(req, [&] {
+    unsigned events = POLLOUT | POLLWRNORM;
+    if (fs(req).Resolve(ino).kind != NodeKind::Ctrl) {
+      if (ph) fuse_pollhandle_destroy(ph);
+      events |= POLLIN | POLLRDNORM;
+    } else {
+      if (ph) fs(req).polls().Add(fi->fh, ph);
+      if (fs(req).device().HasCompletions()) events |= POLLIN | POLLRDNORM;
+    }
+    fuse_reply_poll(req, events);
+  });
+}
+
+// Согласование с ядром: передача данных сплайсом в обе стороны и крупные записи.
+// libfuse урезает max_write до размера своего буфера запроса.
+void opInit(void*, struct fuse_conn_info* conn) {
+  conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+  conn->max_write = kMaxWrite;
+}
+
+// Опции командной строки, кроме стандартных опций FUSE
+struct Options {
+  unsigned units = 4;
+  unsigned threads = 0;
+  char* compiler = nullptr;
+  char* jitCache = nullptr;
+  unsigned compileTimeout = 60;
+  unsigned runTimeout = 10;
+  int help = 0;
+};
+
+const struct fuse_opt kOptionSpec[] = {
+    {"--units=%u", offsetof(Options, units), 0},
+    {"--threads=%u", offsetof(Options, threads), 0},
+    {"--cxx=%s", offsetof(Options, compiler), 0},
+    {"--jit-cache=%s", offsetof(Options, jitCache), 0},
+    {"--compile-timeout=%u", offsetof(Options, compileTimeout), 0},
+    {"--run-timeout=%u", offsetof(Options, runTimeout), 0},
+    {"-h", offsetof(Options, help), 1},
+    {"--help", offsetof(Options, help), 1},
+    FUSE_OPT_END,
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  Options options;
+  if (fuse_opt_parse(&args, &options, kOptionSpec, nullptr) != 0) return 1;
+  if (options.help) {
+    std::cout << "usage: " << argv[0] << " [--units=N] [--threads=N] [--cxx=PATH] [--jit-cache=DIR]"
+              << " [--compile-timeout=SEC] [--run-timeout=SEC]"
+              << " [-f] [-s] [-d] [-o opt,...] <mountpoint>\n"
+              << "    --units=N    number of units (default 4)\n"
+              << "    --threads=N  threads running units (default - number of cores)\n"
+              << "    --cxx=PATH   compiler for C++ pram programs (default c++)\n"
+              << "    --jit-cache=DIR  cache of compiled pram programs (default <tmp>/mycpu-jit-<uid>)\n"
+              << "    --compile-timeout=SEC  time limit of one C++ pram build (default 60)\n"
+              << "    --run-timeout=SEC  time limit of one native program run (default 10)\n\n";
+    fuse_cmdline_help();
+    fuse_lowlevel_help();
+    fuse_opt_free_args(&args);
+    return 0;
+  }
+  // Как в эталонном cpuemu: точка монтирования освобождается и при аварийном завершении
+  fuse_opt_add_arg(&args, "-oauto_unmount");
+
+  struct fuse_cmdline_opts opts;
+  if (fuse_parse_cmdline(&args, &opts) != 0) return 1;
+  if (!opts.mountpoint) {
+    std::cerr << "Error: no mountpoint\n";
+    fuse_opt_free_args(&args);
+    return 1;
+  }
+
+  // Память каждого юнита - два memfd: мягкий лимит дескрипторов поднимается до жесткого.
+  // Не хватит дескрипторов - память без memfd, с копированием вместо splice.
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  int ret = 1;
+  try {
+    JitConfig jit;
+    if (options.compiler) jit.compiler = options.compiler;
+    if (options.jitCache) jit.cacheDir = options.jitCache;
+    jit.compileTimeout = std::chrono::seconds(std::max(options.compileTimeout, 1u));
+    jit.timeout = std::chrono::seconds(std::max(options.runTimeout, 1u));
+    MyCpuFs myCpu(options.units, options.threads, std::move(jit));
+
+    struct fuse_lowlevel_ops ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.lookup = opLookup;
+    ops.getattr = opGetattr;
+    ops.setattr = opSetattr;
+    ops.readdir = opReaddir;
+    ops.open = opOpen;
+    ops.flush = opFlush;
+    ops.release = opRelease;
+    ops.init = opInit;
+    ops.read = opRead;
+    ops.write_buf = opWriteBuf;
+    ops.poll = opPoll;
+
+    struct fuse_session* se = fuse_session_new(&args, &ops, sizeof(ops), &myCpu);
+    if (se) {
+      if (fuse_set_signal_handlers(se) == 0) {
+        if (fuse_session_mount(se, opts.mountpoint) == 0) {
+          fuse_daemonize(opts.foreground);
+          if (opts.singlethread) {
+            ret = fuse_session_loop(se);
+          } else {
+            struct fuse_loop_config config;
+            config.clone_fd = opts.clone_fd;
+            config.max_idle_threads = opts.max_idle_threads;
+            ret = fuse_session_loop_mt(se, &config);
+          }
+          fuse_session_unmount(se);
+        }
+        fuse_remove_signal_handlers(se);
+      }
+      // Юниты могут еще исполняться: их завершения не должны уведомлять уничтоженную сессию
+      myCpu.polls().Stop();
+      fuse_session_destroy(se);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    ret = 1;
+  }
+  free(opts.mountpoint);
+  free(options.compiler);
+  free(options.jitCache);
+  fuse_opt_free_args(&args);
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// Ожидания poll на ctrl без зависимости от FUSE: драйвер (mycpufs.cpp) хранит здесь
+// fuse_pollhandle, а уведомление и освобождение передает функциями.
+//
+// Ожидание одно на открытый файл (fh): ядро повторяет poll после пробуждения, и новый запрос
+// заменяет прежний. Новое завершение будит все ожидания разом, после пробуждения они снимаются.
+// Уведомления идут вне блокировки; Stop дожидается уже начатых, и после него обращений
+// к уведомлению нет - драйвер может уничтожить сессию FUSE.
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace mycpu {
+
+template <typename Handle>
+class PollWaiters {
+ public:
+  // notify - пробуждение ожидания, destroy - освобождение его адреса (после notify или без него)
+  PollWaiters(std::function<void(Handle)> notify, std::function<void(Handle)> destroy)
+      : notify_(std::move(notify)), destroy_(std::move(destroy)) {}
+  PollWaiters(const PollWaiters &) = delete;
+  PollWaiters &operator=(const PollWaiters &) = delete;
+
+  ~PollWaiters() {
+    for (auto &[fh, h] : waiters_) destroy_(h);
+  }
+
+  // Функция добавления ожидания файла fh; прежнее ожидание файла освобождается без пробуждения.
+  // После Stop ожидание сразу освобождается.
+  void Add(uint64_t fh, Handle h) {
+    std::lock_guard lock(mutex_);
+    if (stopped_) {
+      destroy_(h);
+      return;
+    }
+    auto [it, inserted] = waiters_.try_emplace(fh, h);
+    if (!inserted) {
+      destroy_(it->second);
+      it->second = h;
+    }
+  }
+
+  // Функция снятия ожидания при закрытии файла
+  void Remove(uint64_t fh) {
+    std::lock_guard lock(mutex_);
+    auto it = waiters_.find(fh);
+    if (it == waiters_.end()) return;
+    destroy_(it->second);
+    waiters_.erase(it);
+  }
+
+  // Функция пробуждения всех ожиданий
+  void Notify() {
+    std::unordered_map<uint64_t, Handle> waiters;
+    {
+      std::lock_guard lock(mutex_);
+      if (stopped_ || waiters_.empty()) return;
+      waiters.swap(waiters_);
+      notifying_++;
+    }
+    for (auto &[fh, h] : waiters) {
+      notify_(h);
+      destroy_(h);
+    }
+    std::lock_guard lock(mutex_);
+    if (--notifying_ == 0) notifiedCv_.notify_all();
+  }
+
+  // Функция остановки: ожидания освобождаются, новые не принимаются, а возврат - после
+  // завершения уже начатых уведомлений
+  void Stop() {
+    std::unique_lock lock(mutex_);
+    stopped_ = true;
+    for (auto &[fh, h] : waiters_) destroy_(h);
+    waiters_.clear();
+    notifiedCv_.wait(lock, [&] { return notifying_ == 0; });
+  }
+
+  size_t Size() const {
+    std::lock_guard lock(mutex_);
+    return waiters_.size();
+  }
+
+ private:
+  std::function<void(Handle)> notify_;
+  std::function<void(Handle)> destroy_;
+  mutable std::mutex mutex_;
+  std::condition_variable notifiedCv_;  // Для Stop: завершение уведомлений
+  std::unordered_map<uint64_t, Handle> waiters_;
+  size_t notifying_ = 0;  // Уведомления, идущие вне mutex_
+  bool stopped_ = false;
+};
+
+}  // namespace mycpu
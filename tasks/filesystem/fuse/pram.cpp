@@ -0,0 +1,422 @@
+#include "pram.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <type_traits>
+
+#include "kernels.hpp"
+
+namespace mycpu {
+
+namespace {
+
+// Элементов в порции: операнды загружаются в буферы вычислительного типа порциями,
+// чтобы выбор типа и операции шел раз на порцию, а не на элемент
+constexpr size_t kChunk = 256;
+// Элементов в порции слитых инструкций: операнды порции цепочки помещаются в L1/L2
+constexpr size_t kFuseChunk = 2048;
+
+// Имена в порядке перечислений
+const char* const kTypeNames[kValueTypes] = {"i8", "u8", "i16", "u16", "i32", "u32", "f32"};
+const char* const kOperationNames[kOperations] = {"add", "sub", "mul", "div", "mod"};
+
+bool parseType(std::string_view name, ValueType &type) {
+  for (size_t i = 0; i < kValueTypes; i++) {
+    if (name == kTypeNames[i]) {
+      type = (ValueType)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parseOperation(std::string_view name, Operation &op) {
+  for (size_t i = 0; i < kOperations; i++) {
+    if (name == kOperationNames[i]) {
+      op = (Operation)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t parseOffset(std::string_view s, std::string_view operand) {
+  size_t value = 0;
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (s.empty() || ec != std::errc() || end != s.data() + s.size()) {
+    throw ProgramError("bad offset in operand " + std::string(operand));
+  }
+  return value;
+}
+
+// Функция разбора операнда <type>:<begin>[:<end>]
+Operand parseOperand(std::string_view s) {
+  Operand o;
+  size_t first = s.find(':');
+  if (first == std::string_view::npos) throw ProgramError("bad operand " + std::string(s));
+  if (!parseType(s.substr(0, first), o.type)) throw ProgramError("unknown type in operand " + std::string(s));
+  std::string_view rest = s.substr(first + 1);
+  size_t second = rest.find(':');
+  o.begin = parseOffset(rest.substr(0, second), s);
+  if (second != std::string_view::npos) {
+    o.end = parseOffset(rest.substr(second + 1), s);
+    o.toEnd = false;
+  }
+  return o;
+}
+
+std::vector<Operand> parseOperands(std::string_view s) {
+  std::vector<Operand> out;
+  for (size_t pos = 0;;) {
+    size_t comma = s.find(',', pos);
+    out.push_back(parseOperand(s.substr(pos, comma - pos)));
+    if (comma == std::string_view::npos) break;
+    pos = comma + 1;
+  }
+  return out;
+}
+
+// Диапазон операнда в lram: обрезается по концу lram, как срез memoryview
+struct Span {
+  uint8_t* data;
+  size_t count;
+};
+
+Span resolve(const Operand &o, uint8_t* lram, size_t size) {
+  size_t end = o.toEnd ? size : std::min(o.end, size);
+  size_t begin = std::min(o.begin, end);
+  size_t bytes = end - begin;
+  if (bytes % valueSize(o.type) != 0) {
+    throw ProgramError("operand range of " + std::to_string(bytes) + " bytes is not a multiple of its type size");
+  }
+  return {lram + begin, bytes / valueSize(o.type)};
+}
+
+// Загрузка и сохранение порции: смещения в lram произвольные, поэтому через memcpy
+template <typename T, typename C>
+void loadAs(const uint8_t* src, size_t n, C* dst) {
+  for (size_t i = 0; i < n; i++) {
+    T v;
+    std::memcpy(&v, src + i * sizeof(T), sizeof(T));
+    dst[i] = (C)v;
+  }
+}
+
+template <typename C>
+void load(ValueType type, const uint8_t* src, size_t n, C* dst) {
+  switch (type) {
+    case ValueType::I8: return loadAs<int8_t>(src, n, dst);
+    case ValueType::U8: return loadAs<uint8_t>(src, n, dst);
+    case ValueType::I16: return loadAs<int16_t>(src, n, dst);
+    case ValueType::U16: return loadAs<uint16_t>(src, n, dst);
+    case ValueType::I32: return loadAs<int32_t>(src, n, dst);
+    case ValueType::U32: return loadAs<uint32_t>(src, n, dst);
+    case ValueType::F32: return loadAs<float>(src, n, dst);
+  }
+}
+
+// Приведение результата к типу выхода: целые обрезаются, вещественные вне диапазона int64 дают 0
+template <typename T, typename C>
+T convert(C v) {
+  if constexpr (std::is_floating_point_v<T> || std::is_integral_v<C>) {
+    return (T)v;
+  } else {
+    if (!(v > -9.2e18 && v < 9.2e18)) return 0;
+    return (T)(int64_t)v;
+  }
+}
+
+template <typename T, typename C>
+void storeAs(const C* src, size_t n, uint8_t* dst) {
+  for (size_t i = 0; i < n; i++) {
+    T v = convert<T>(src[i]);
+    std::memcpy(dst + i * sizeof(T), &v, sizeof(T));
+  }
+}
+
+template <typename C>
+void store(ValueType type, const C* src, size_t n, uint8_t* dst) {
+  switch (type) {
+    case ValueType::I8: return storeAs<int8_t>(src, n, dst);
+    case ValueType::U8: return storeAs<uint8_t>(src, n, dst);
+    case ValueType::I16: return storeAs<int16_t>(src, n, dst);
+    case ValueType::U16: return storeAs<uint16_t>(src, n, dst);
+    case ValueType::I32: return storeAs<int32_t>(src, n, dst);
+    case ValueType::U32: return storeAs<uint32_t>(src, n, dst);
+    case ValueType::F32: return storeAs<float>(src, n, dst);
+  }
+}
+
+// Операция над порцией. Целые - в uint64 (переполнение определено), деление и остаток - знаковые
+template <typename C>
+void apply(Operation op, C* a, const C* b, size_t n) {
+  if constexpr (std::is_floating_point_v<C>) {
+    switch (op) {
+      case Operation::Add: for (size_t i = 0; i < n; i++) a[i] += b[i]; break;
+      case Operation::Sub: for (size_t i = 0; i < n; i++) a[i] -= b[i]; break;
+      case Operation::Mul: for (size_t i = 0; i < n; i++) a[i] *= b[i]; break;
+      case Operation::Div: for (size_t i = 0; i < n; i++) a[i] /= b[i]; break;
+      case Operation::Mod: for (size_t i = 0; i < n; i++) a[i] = std::fmod(a[i], b[i]); break;
+    }
+  } else {
+    switch (op) {
+      case Operation::Add: for (size_t i = 0; i < n; i++) a[i] = (C)((uint64_t)a[i] + (uint64_t)b[i]); break;
+      case Operation::Sub: for (size_t i = 0; i < n; i++) a[i] = (C)((uint64_t)a[i] - (uint64_t)b[i]); break;
+      case Operation::Mul: for (size_t i = 0; i < n; i++) a[i] = (C)((uint64_t)a[i] * (uint64_t)b[i]); break;
+      case Operation::Div: for (size_t i = 0; i < n; i++) a[i] = b[i] ? a[i] / b[i] : 0; break;
+      case Operation::Mod: for (size_t i = 0; i < n; i++) a[i] = b[i] ? a[i] % b[i] : 0; break;
+    }
+  }
+}
+
+template <typename C>
+void execute(const Instruction &ins, Span out, Span a, Span b, size_t n) {
+  C x[kChunk], y[kChunk];
+  size_t outSize = valueSize(ins.out.type), aSize = valueSize(ins.in[0].type), bSize = valueSize(ins.in[1].type);
+  for (size_t i = 0; i < n; i += kChunk) {
+    size_t m = std::min(kChunk, n - i);
+    load(ins.in[0].type, a.data + i * aSize, m, x);
+    load(ins.in[1].type, b.data + i * bSize, m, y);
+    apply(ins.op, x, y, m);
+    store(ins.out.type, x, m, out.data + i * outSize);
+  }
+}
+
+// Инструкция с разрешенными диапазонами: n элементов каждого операнда
+struct Resolved {
+  const Program::Step* step;
+  Span out, a, b;
+  size_t n;
+
+  size_t Bytes() const {
+    return n * (valueSize(step->ins.out.type) + valueSize(step->ins.in[0].type) + valueSize(step->ins.in[1].type));
+  }
+};
+
+// Байты, которых касается операнд: n элементов с начала диапазона
+struct Range {
+  const uint8_t* begin;
+  const uint8_t* end;
+  size_t elem;
+
+  bool Disjoint(const Range &o) const { return end <= o.begin || o.end <= begin || begin == end || o.begin == o.end; }
+  bool Same(const Range &o) const { return begin == o.begin && end == o.end && elem == o.elem; }
+  bool Covers(const Range &o) const { return begin <= o.begin && o.end <= end; }
+};
+
+Range range(const Span &span, ValueType type, size_t n) {
+  return {span.data, span.data + n * valueSize(type), valueSize(type)};
+}
+
+Range outRange(const Resolved &r) { return range(r.out, r.step->ins.out.type, r.n); }
+Range inRange(const Resolved &r, int i) { return range(i ? r.b : r.a, r.step->ins.in[i].type, r.n); }
+
+Resolved resolveStep(const Program::Step &step, uint8_t* lram, size_t size) {
+  const Instruction &ins = step.ins;
+  Resolved r{&step, resolve(ins.out, lram, size), resolve(ins.in[0], lram, size), resolve(ins.in[1], lram, size), 0};
+  r.n = std::min({r.out.count, r.a.count, r.b.count});
+  return r;
+}
+
+// Функция исполнения элементов [k, k + m) инструкции
+void runStep(const Resolved &r, size_t k, size_t m) {
+  const Instruction &ins = r.step->ins;
+  Span out{r.out.data + k * valueSize(ins.out.type), m};
+  Span a{r.a.data + k * valueSize(ins.in[0].type), m};
+  Span b{r.b.data + k * valueSize(ins.in[1].type), m};
+  if (r.step->kernel) {
+    r.step->kernel(out.data, a.data, b.data, m);
+    return;
+  }
+  bool real = ins.out.type == ValueType::F32 || ins.in[0].type == ValueType::F32 || ins.in[1].type == ValueType::F32;
+  // Выход, частично перекрывающий вход, читается эталоном поэлементно: элемент может прочитать
+  // записанное этой же инструкцией. Тогда порции по одному элементу, как в device.py.
+  Range o = range(out, ins.out.type, m);
+  auto partial = [&](const Span &in, ValueType type) {
+    Range x = range(in, type, m);
+    return !o.Disjoint(x) && !o.Same(x);
+  };
+  size_t step = partial(a, ins.in[0].type) || partial(b, ins.in[1].type) ? 1 : m;
+  for (size_t j = 0; j < m; j += step) {
+    size_t len = std::min(step, m - j);
+    Span o1{out.data + j * valueSize(ins.out.type), len};
+    Span a1{a.data + j * valueSize(ins.in[0].type), len};
+    Span b1{b.data + j * valueSize(ins.in[1].type), len};
+    if (real) {
+      execute<double>(ins, o1, a1, b1, len);
+    } else {
+      execute<int64_t>(ins, o1, a1, b1, len);
+    }
+  }
+}
+
+// Слияние: инструкции исполняются вместе порциями по kFuseChunk элементов (сначала порция
+// первой, затем второй и т.д.), и промежуточные результаты цепочки остаются в кеше.
+// Это равносильно исполнению по одной, если у всех одно число элементов, а любые два
+// операнда группы (и одной инструкции) либо не пересекаются, либо совпадают: тогда
+// элемент k каждой инструкции зависит только от элементов k предыдущих.
+bool fusible(const std::vector<const Resolved*> &group, const Resolved &next) {
+  if (next.n != group[0]->n) return false;
+  Range ranges[3] = {outRange(next), inRange(next, 0), inRange(next, 1)};
+  auto compatible = [](const Range &x, const Range &y) { return x.Disjoint(y) || x.Same(y); };
+  for (int i = 0; i < 3; i++) {
+    for (int j = i + 1; j < 3; j++) {
+      if (!compatible(ranges[i], ranges[j])) return false;
+    }
+  }
+  for (const Resolved* r : group) {
+    Range other[3] = {outRange(*r), inRange(*r, 0), inRange(*r, 1)};
+    for (const Range &x : ranges) {
+      for (const Range &y : other) {
+        if (!compatible(x, y)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Удаление мертвых записей: выход инструкции мертв, если следующая исполняемая
+// инструкция, которая касается этих байтов, целиком перезаписывает их, не читая.
+// Просмотр с конца: удаленные инструкции ничего не читают и не пишут.
+std::vector<bool> deadStores(const std::vector<Resolved> &steps) {
+  std::vector<bool> dead(steps.size());
+  for (size_t i = steps.size(); i-- > 0;) {
+    Range written = outRange(steps[i]);
+    if (written.begin == written.end) {
+      dead[i] = true;
+      continue;
+    }
+    for (size_t j = i + 1; j < steps.size(); j++) {
+      if (dead[j]) continue;
+      if (!inRange(steps[j], 0).Disjoint(written) || !inRange(steps[j], 1).Disjoint(written)) break;
+      if (outRange(steps[j]).Covers(written)) {
+        dead[i] = true;
+        break;
+      }
+    }
+  }
+  return dead;
+}
+
+}  // namespace
+
+size_t valueSize(ValueType type) {
+  switch (type) {
+    case ValueType::I8:
+    case ValueType::U8: return 1;
+    case ValueType::I16:
+    case ValueType::U16: return 2;
+    case ValueType::I32:
+    case ValueType::U32:
+    case ValueType::F32: return 4;
+  }
+  return 1;
+}
+
+const char* typeName(ValueType type) { return kTypeNames[(size_t)type]; }
+
+const char* operationName(Operation op) { return kOperationNames[(size_t)op]; }
+
+std::vector<Instruction> parseProgram(std::string_view text) {
+  std::string s;
+  s.reserve(text.size());
+  for (char c : text) {
+    if (c != ' ') s.push_back(c);
+  }
+
+  // Поиск инструкций как re.findall(r'\[([^\]]+)\](\w+)\(([^\)]+)\)'): при несовпадении
+  // сканирование продолжается со следующего символа
+  std::vector<Instruction> program;
+  for (size_t pos = s.find('['); pos != std::string::npos; pos = s.find('[', pos + 1)) {
+    size_t close = s.find(']', pos + 1);
+    if (close == std::string::npos) break;
+    if (close == pos + 1) continue;
+    size_t name = close + 1, paren = name;
+    while (paren < s.size() && (std::isalnum((unsigned char)s[paren]) || s[paren] == '_')) paren++;
+    if (paren == name || paren >= s.size() || s[paren] != '(') continue;
+    size_t end = s.find(')', paren + 1);
+    if (end == std::string::npos || end == paren + 1) continue;
+
+    std::string_view sv(s);
+    Instruction ins;
+    std::string_view opName = sv.substr(name, paren - name);
+    if (!parseOperation(opName, ins.op)) throw ProgramError("unknown operation " + std::string(opName));
+    auto outputs = parseOperands(sv.substr(pos + 1, close - pos - 1));
+    auto inputs = parseOperands(sv.substr(paren + 1, end - paren - 1));
+    if (outputs.size() != 1) throw ProgramError("operation " + std::string(opName) + " needs one output");
+    if (inputs.size() != 2) throw ProgramError("operation " + std::string(opName) + " needs two inputs");
+    ins.out = outputs[0];
+    ins.in[0] = inputs[0];
+    ins.in[1] = inputs[1];
+    program.push_back(ins);
+    pos = end;
+  }
+  return program;
+}
+
+Program compileProgram(std::string_view text) {
+  Program program;
+  for (const Instruction &ins : parseProgram(text)) {
+    Program::Step step{ins};
+    if (ins.out.type == ins.in[0].type && ins.out.type == ins.in[1].type) {
+      step.kernel = selectKernel(ins.op, ins.out.type);
+    }
+    program.steps.push_back(step);
+  }
+  return program;
+}
+
+size_t runProgram(const Program &program, uint8_t* lram, size_t size, bool optimize, std::vector<bool>* executed) {
+  // Диапазоны зависят только от размера lram и разрешаются заранее. Ошибка в инструкции
+  // выдается после исполнения предыдущих - как при исполнении по одной.
+  std::vector<Resolved> steps;
+  steps.reserve(program.steps.size());
+  std::exception_ptr error;
+  for (const Program::Step &step : program.steps) {
+    try {
+      steps.push_back(resolveStep(step, lram, size));
+    } catch (const ProgramError &) {
+      error = std::current_exception();
+      break;
+    }
+  }
+
+  std::vector<bool> dead(steps.size());
+  if (optimize) dead = deadStores(steps);
+  if (executed) executed->assign(program.steps.size(), false);
+
+  size_t bytes = 0;
+  for (size_t i = 0; i < steps.size();) {
+    if (dead[i]) {
+      i++;
+      continue;
+    }
+    // Группа: следующие живые инструкции, которые можно исполнять поэлементно вместе с ней
+    std::vector<const Resolved*> group = {&steps[i]};
+    size_t next = i + 1;
+    for (; optimize && next < steps.size(); next++) {
+      if (dead[next]) continue;
+      if (!fusible(group, steps[next])) break;
+      group.push_back(&steps[next]);
+    }
+    size_t n = steps[i].n;
+    size_t chunk = group.size() == 1 ? n : kFuseChunk;
+    for (size_t k = 0; k < n; k += chunk) {
+      size_t m = std::min(chunk, n - k);
+      for (const Resolved* r : group) runStep(*r, k, m);
+    }
+    for (const Resolved* r : group) bytes += r->Bytes();
+    if (executed) {
+      for (const Resolved* r : group) (*executed)[r - steps.data()] = true;
+    }
+    i = next;
+  }
+  if (error) std::rethrow_exception(error);
+  return bytes;
+}
+
+}  // namespace mycpu
@@ -0,0 +1,90 @@
+#pragma once
+
+// Программы pram. Программа - последовательность инструкций
+//   [<output>]<operation>(<input0>, <input1>)
+// <output>, <inputN> - <type>:<begin>[:<end>], begin и end - смещения в байтах lram
+// (без end - до конца lram), <type> - i8, u8, i16, u16, i32, u32, f32,
+// <operation> - add, sub, mul, div, mod. Пример: [u16:200:400]add(u8:0, u8:100)
+//
+// Разбор повторяет эталонный device.py: пробелы игнорируются, текст вне инструкций
+// пропускается, диапазоны за концом lram обрезаются, инструкция обрабатывает
+// min(длины операндов) элементов. Отличия от эталона (там вычисления в целых Python):
+// - если хоть один операнд f32, вычисления идут в double, иначе в 64-битных целых;
+// - целые результаты обрезаются до типа выхода (как в C), а не вызывают ошибку;
+// - div и mod для целых - деление и остаток C, на ноль дают 0.
+// Как в эталоне, элементы исполняются по порядку: если выход частично перекрывает вход,
+// элемент читает уже записанные этой инструкцией значения.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mycpu {
+
+enum class ValueType { I8, U8, I16, U16, I32, U32, F32 };
+enum class Operation { Add, Sub, Mul, Div, Mod };
+constexpr size_t kValueTypes = 7;
+constexpr size_t kOperations = 5;
+
+// Имена типов и операций в тексте программы
+const char* typeName(ValueType type);
+const char* operationName(Operation op);
+
+// Ошибка программы: синтаксис операнда, неизвестная операция или тип, длина диапазона
+class ProgramError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+size_t valueSize(ValueType type);
+
+// Операнд: типизированный диапазон байтов lram
+struct Operand {
+  ValueType type = ValueType::U8;
+  size_t begin = 0;
+  size_t end = 0;
+  bool toEnd = true;  // end не задан - до конца lram
+};
+
+struct Instruction {
+  Operation op = Operation::Add;
+  Operand out;
+  Operand in[2];
+};
+
+// Ядро инструкции с операндами одного типа (kernels.hpp)
+using Kernel = void (*)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t n);
+
+// Скомпилированная программа: инструкции с выбранными ядрами. Инструкции со смешанными
+// типами (kernel == nullptr) исполняются общим путем - порциями через буферы int64/double.
+struct Program {
+  struct Step {
+    Instruction ins;
+    Kernel kernel = nullptr;
+  };
+  std::vector<Step> steps;
+  // Нативная программа (jit.hpp): путь к собранной библиотеке; пусто - программа из инструкций
+  std::string library;
+};
+
+// Функция разбора текста pram в список инструкций
+std::vector<Instruction> parseProgram(std::string_view text);
+
+// Функция компиляции: разбор и выбор ядер - один раз на текст программы
+Program compileProgram(std::string_view text);
+
+// Функция исполнения программы над lram[0..size); возвращает объем обработанных
+// данных - байты выходов и входов исполненных инструкций.
+// optimize - оптимизация по диапазонам, разрешенным для данного размера lram: записи,
+// перезаписанные до чтения, не исполняются, а соседние поэлементно независимые инструкции
+// (например, цепочка [t]add(a, b) [o]mul(t, c)) сливаются в один проход по памяти порциями.
+// Результат тот же, что при исполнении по одной.
+// executed (если задан) - отметки исполненных шагов program.steps: без перезаписанных записей
+// и шагов от ошибки до конца; заполняется и при исключении.
+size_t runProgram(const Program &program, uint8_t* lram, size_t size, bool optimize = true,
+                  std::vector<bool>* executed = nullptr);
+
+}  // namespace mycpu
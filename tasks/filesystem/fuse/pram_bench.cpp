@@ -0,0 +1,95 @@
+// Бенчмарк исполнения pram: инструкция [T:0:n]op(T:n:2n, T:2n:3n) над lram из трех
+// массивов по sizeMB. Для каждой пары (операция, тип) печатает скорость ядра и общего
+// пути (порции через int64/double) в GB/s по объему выхода и входов, для сравнения - memcpy.
+// Затем - цепочки из нескольких инструкций с оптимизацией (слияние) и без нее.
+//
+// Использование: pram_bench [sizeMB] [repeat]
+//   sizeMB - размер одного массива (по умолчанию 64)
+//   repeat - повторов, берется лучший (по умолчанию 5)
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pram.hpp"
+
+using namespace mycpu;
+
+template <typename F>
+static double bestSec(size_t repeat, F f) {
+  double best = 1e100;
+  for (size_t r = 0; r < repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) try {
+  size_t sizeMB = argc > 1 ? std::stoull(argv[1]) : 64;
+  size_t repeat = argc > 2 ? std::stoull(argv[2]) : 5;
+  size_t bytes = sizeMB << 20;
+  std::vector<uint8_t> lram(3 * bytes);
+  // Целые - случайные биты без нулевых делителей, f32 - обычные числа (без денормалей и inf)
+  auto fill = [&](bool real) {
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<float> value(1, 1000);
+    for (size_t i = 0; i < lram.size(); i += 8) {
+      uint64_t v = gen() | 0x0101010101010101ull;
+      if (real) {
+        float f[2] = {value(gen), value(gen)};
+        std::memcpy(&v, f, 8);
+      }
+      std::memcpy(lram.data() + i, &v, 8);
+    }
+  };
+  double traffic = 3.0 * bytes / (1 << 30);
+
+  double copySec = bestSec(repeat, [&] { std::memcpy(lram.data(), lram.data() + bytes, bytes); });
+  std::cout << std::fixed << std::setprecision(2) << "memcpy (" << 2.0 * bytes / (1 << 30) << " GB moved): "
+            << 2.0 * bytes / (1 << 30) / copySec << " GB/s\n";
+  std::cout << "op  type   kernel GB/s  generic GB/s\n";
+
+  std::string n0 = std::to_string(bytes), n1 = std::to_string(2 * bytes), n2 = std::to_string(3 * bytes);
+  for (const char* op : {"add", "sub", "mul", "div", "mod"}) {
+    for (const char* type : {"i8", "u8", "i16", "u16", "i32", "u32", "f32"}) {
+      std::string t = type;
+      fill(t == "f32");
+      Program program = compileProgram("[" + t + ":0:" + n0 + "]" + op + "(" + t + ":" + n0 + ":" + n1 + "," + t +
+                                       ":" + n1 + ":" + n2 + ")");
+      Program generic = program;
+      generic.steps[0].kernel = nullptr;
+      double kernelSec = bestSec(repeat, [&] { runProgram(program, lram.data(), lram.size()); });
+      double genericSec = bestSec(repeat, [&] { runProgram(generic, lram.data(), lram.size()); });
+      std::cout << op << " " << std::setw(4) << type << " " << std::setw(12) << traffic / kernelSec << " "
+                << std::setw(13) << traffic / genericSec << "\n";
+    }
+  }
+
+  // Цепочки: без оптимизации каждая инструкция - отдельный проход по памяти
+  std::cout << "chain                                   optimized ms  unoptimized ms\n";
+  fill(true);
+  auto r = [&](size_t i) { return "f32:" + std::to_string(i * bytes) + ":" + std::to_string((i + 1) * bytes); };
+  std::string add = "[" + r(0) + "]add(" + r(1) + "," + r(2) + ")";
+  std::string mul = "[" + r(0) + "]mul(" + r(0) + "," + r(2) + ")";
+  std::string sub = "[" + r(0) + "]sub(" + r(0) + "," + r(1) + ")";
+  std::pair<const char*, std::string> chains[] = {{"t = a + b; t = t * b", add + mul},
+                                                  {"t = a + b; t = t * b; t = t - a", add + mul + sub}};
+  for (auto &[name, text] : chains) {
+    Program program = compileProgram(text);
+    double optimized = bestSec(repeat, [&] { runProgram(program, lram.data(), lram.size()); });
+    double unoptimized = bestSec(repeat, [&] { runProgram(program, lram.data(), lram.size(), false); });
+    std::cout << std::left << std::setw(40) << name << std::right << std::setw(12) << optimized * 1000 << " "
+              << std::setw(15) << unoptimized * 1000 << "\n";
+  }
+  return 0;
+} catch (const std::exception &e) {
+  std::cerr << "Error: " << e.what() << "\n";
+  return 1;
+}
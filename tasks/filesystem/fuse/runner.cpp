@@ -0,0 +1,237 @@
+// Исполнитель нативных программ pram (см. jit.hpp). Запускается драйвером с сокетом на
+// дескрипторе kRunnerSocket и исполняет запросы по одному: загружает библиотеку (загруженные
+// остаются в процессе, повторные запуски программы их не перезагружают), отображает memfd
+// lram и вызывает entrypoint.
+//
+// Изоляция - отдельный процесс: у него нет дескрипторов драйвера, кроме сокета, он не может
+// повысить привилегии (no_new_privs) и завершается вместе с драйвером. Падение программы
+// завершает только исполнитель. Процессорное время запуска ограничено RLIMIT_CPU, а время
+// ожидания ответа - драйвером, который убивает исполнитель по истечении предела.
+//
+// До первого запроса исполнитель ограничивает себя:
+// - Landlock (если ядро поддерживает): файловая система только на чтение и только системные
+//   библиотеки, ld.so.cache, каталоги LD_LIBRARY_PATH и кеш сборок (argv[1]); с ABI 4 - без TCP,
+//   с ABI 6 - без сигналов процессам вне исполнителя и абстрактных сокетов UNIX;
+// - seccomp: socket, exec, ptrace, process_vm_readv/writev и io_uring_setup дают EPERM.
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/landlock.h>
+#include <linux/seccomp.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "jit.hpp"
+
+using namespace mycpu;
+
+namespace {
+
+using Entry = int (*)(uint32_t, uint8_t*);
+
+// Атрибуты набора правил Landlock по ABI ядра: заголовки могут быть старше ядра, поэтому поля
+// и права новых версий заданы здесь, а ядру передается размер, известный его версии
+struct LandlockRuleset {
+  uint64_t handledAccessFs;
+  uint64_t handledAccessNet;  // ABI 4
+  uint64_t scoped;            // ABI 6
+};
+
+constexpr uint64_t kFsRead = LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR;
+constexpr uint64_t kFsFileRead = LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE;
+constexpr uint64_t kFsAbi1 = (1ull << 13) - 1;  // От EXECUTE до MAKE_SYM
+constexpr uint64_t kFsRefer = 1ull << 13;       // ABI 2
+constexpr uint64_t kFsTruncate = 1ull << 14;    // ABI 3
+constexpr uint64_t kFsIoctlDev = 1ull << 15;    // ABI 5
+constexpr uint64_t kNetTcp = 3;                 // BIND_TCP | CONNECT_TCP, ABI 4
+constexpr uint64_t kScopeAll = 3;               // ABSTRACT_UNIX_SOCKET | SIGNAL, ABI 6
+
+void allowRead(int ruleset, const std::string &path) {
+  int fd = open(path.c_str(), O_PATH | O_CLOEXEC);
+  if (fd < 0) return;  // Нет такого пути - нечего и разрешать
+  struct stat st;
+  struct landlock_path_beneath_attr rule = {};
+  rule.allowed_access = fstat(fd, &st) == 0 && S_ISDIR(st.st_mode) ? kFsRead : kFsFileRead;
+  rule.parent_fd = fd;
+  syscall(SYS_landlock_add_rule, ruleset, LANDLOCK_RULE_PATH_BENEATH, &rule, 0);
+  close(fd);
+}
+
+void restrictFilesystem(const char* cacheDir) {
+  long abi = syscall(SYS_landlock_create_ruleset, nullptr, 0, LANDLOCK_CREATE_RULESET_VERSION);
+  if (abi < 1) return;  // Ядро без Landlock: остаются seccomp и права пользователя драйвера
+  LandlockRuleset attr = {kFsAbi1, 0, 0};
+  size_t size = sizeof(attr.handledAccessFs);
+  if (abi >= 2) attr.handledAccessFs |= kFsRefer;
+  if (abi >= 3) attr.handledAccessFs |= kFsTruncate;
+  if (abi >= 4) {
+    attr.handledAccessNet = kNetTcp;
+    size = offsetof(LandlockRuleset, scoped);
+  }
+  if (abi >= 5) attr.handledAccessFs |= kFsIoctlDev;
+  if (abi >= 6) {
+    attr.scoped = kScopeAll;
+    size = sizeof(attr);
+  }
+  int ruleset = (int)syscall(SYS_landlock_create_ruleset, &attr, size, 0);
+  if (ruleset < 0) _exit(1);
+  for (const char* dir : {"/usr", "/lib", "/lib64", "/lib32", "/libx32", "/etc/ld.so.cache"}) allowRead(ruleset, dir);
+  if (const char* paths = getenv("LD_LIBRARY_PATH")) {
+    std::string list = paths;
+    for (size_t begin = 0, end; begin <= list.size(); begin = end + 1) {
+      end = std::min(list.find(':', begin), list.size());
+      if (end > begin) allowRead(ruleset, list.substr(begin, end - begin));
+    }
+  }
+  if (cacheDir) allowRead(ruleset, cacheDir);
+  if (syscall(SYS_landlock_restrict_self, ruleset, 0) != 0) _exit(1);
+  close(ruleset);
+}
+
+#if defined(__x86_64__)
+constexpr uint32_t kAuditArch = AUDIT_ARCH_X86_64;
+#elif defined(__aarch64__)
+constexpr uint32_t kAuditArch = AUDIT_ARCH_AARCH64;
+#else
+constexpr uint32_t kAuditArch = 0;  // Номера системных вызовов неизвестны - без фильтра
+#endif
+
+void restrictSyscalls() {
+  if (!kAuditArch) return;
+  const long denied[] = {SYS_socket, SYS_execve, SYS_execveat, SYS_ptrace, SYS_process_vm_readv,
+                         SYS_process_vm_writev, SYS_io_uring_setup};
+  std::vector<struct sock_filter> filter = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, kAuditArch, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+  };
+#if defined(__x86_64__)
+  // Вызовы x32 - те же номера с битом 0x40000000: запрещены все
+  filter.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x40000000, 0, 1));
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM));
+#endif
+  for (long nr : denied) {
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)nr, 0, 1));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM));
+  }
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+  struct sock_fprog program = {(unsigned short)filter.size(), filter.data()};
+  if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) != 0) _exit(1);
+}
+
+void sandbox(const char* cacheDir) {
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() == 1) _exit(0);  // Драйвер завершился до PR_SET_PDEATHSIG
+  prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+  close_range(kRunnerSocket + 1, UINT_MAX, 0);
+  struct rlimit core = {0, 0};
+  setrlimit(RLIMIT_CORE, &core);
+  if (chdir("/") != 0) _exit(1);
+  restrictFilesystem(cacheDir);
+  restrictSyscalls();
+}
+
+void reply(const RunReply &r) {
+  while (send(kRunnerSocket, &r, sizeof(r), MSG_NOSIGNAL) < 0 && errno == EINTR) {
+  }
+}
+
+void replyError(const std::string &error) {
+  RunReply r{};
+  std::strncpy(r.error, error.c_str(), sizeof(r.error) - 1);
+  reply(r);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  sandbox(argc > 1 ? argv[1] : nullptr);
+  std::unordered_map<std::string, Entry> loaded;
+  char buf[sizeof(RunRequest) + PATH_MAX];
+  for (;;) {
+    struct iovec iov = {buf, sizeof(buf)};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(kRunnerSocket, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 0;  // Драйвер закрыл сокет
+
+    int fd = -1;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    }
+    if (fd < 0 || (size_t)n < sizeof(RunRequest)) {
+      if (fd >= 0) close(fd);
+      replyError("bad runner request");
+      continue;
+    }
+    RunRequest request;
+    std::memcpy(&request, buf, sizeof(request));
+    std::string library(buf + sizeof(request), (size_t)n - sizeof(request));
+
+    Entry &entry = loaded[library];
+    if (!entry) {
+      void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+      void* symbol = handle ? dlsym(handle, kRunnerEntry) : nullptr;
+      if (!symbol) {
+        const char* error = dlerror();
+        if (handle) dlclose(handle);
+        loaded.erase(library);
+        close(fd);
+        replyError(error ? error : "no entrypoint");
+        continue;
+      }
+      entry = reinterpret_cast<Entry>(symbol);
+    }
+
+    // Пустая lram - без отображения, entrypoint получает ненулевой указатель
+    static uint8_t empty;
+    uint8_t* ram = &empty;
+    if (request.size) {
+      void* p = mmap(nullptr, request.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        replyError(std::string("mmap lram: ") + std::strerror(errno));
+        continue;
+      }
+      ram = static_cast<uint8_t*>(p);
+    }
+    // Предел процессорного времени - от уже израсходованного исполнителем: SIGXCPU завершает
+    // зациклившуюся программу, даже если драйвер не дождался ответа и не убил исполнитель
+    struct rusage usage;
+    struct rlimit cpu;
+    if (getrusage(RUSAGE_SELF, &usage) == 0 && getrlimit(RLIMIT_CPU, &cpu) == 0) {
+      rlim_t used = (rlim_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + 1;
+      cpu.rlim_cur = cpu.rlim_max == RLIM_INFINITY ? used + request.cpuSeconds
+                                                   : std::min(cpu.rlim_max, used + request.cpuSeconds);
+      setrlimit(RLIMIT_CPU, &cpu);
+    }
+    RunReply r{};
+    r.result = entry((uint32_t)request.size, ram);
+    if (request.size) munmap(ram, request.size);
+    close(fd);
+    reply(r);
+  }
+}
@@ -0,0 +1,72 @@
+#include "stats.hpp"
+
+#include <algorithm>
+
+namespace mycpu {
+
+StatsSnapshot &StatsSnapshot::operator+=(const StatsSnapshot &other) {
+  runs += other.runs;
+  errors += other.errors;
+  nativeRuns += other.nativeRuns;
+  totalNs += other.totalNs;
+  lastNs = std::max(lastNs, other.lastNs);
+  waitNs += other.waitNs;
+  bytes += other.bytes;
+  for (size_t op = 0; op < kOperations; op++) {
+    for (size_t type = 0; type < kValueTypes; type++) instructions[op][type] += other.instructions[op][type];
+  }
+  return *this;
+}
+
+void UnitStats::AddRun(const Program &program, const std::vector<bool> &executed, uint64_t waitNs, uint64_t runNs,
+                       uint64_t bytes, bool error) {
+  Add(runs_, 1);
+  if (error) Add(errors_, 1);
+  if (!program.library.empty()) Add(nativeRuns_, 1);
+  Add(totalNs_, runNs);
+  lastNs_.store(runNs, std::memory_order_relaxed);
+  Add(waitNs_, waitNs);
+  Add(bytes_, bytes);
+  for (size_t i = 0; i < program.steps.size() && i < executed.size(); i++) {
+    const Program::Step &step = program.steps[i];
+    if (executed[i]) Add(instructions_[(size_t)step.ins.op][(size_t)step.ins.out.type], 1);
+  }
+}
+
+StatsSnapshot UnitStats::Load() const {
+  auto load = [](const std::atomic<uint64_t> &counter) { return counter.load(std::memory_order_relaxed); };
+  StatsSnapshot s;
+  s.runs = load(runs_);
+  s.errors = load(errors_);
+  s.nativeRuns = load(nativeRuns_);
+  s.totalNs = load(totalNs_);
+  s.lastNs = load(lastNs_);
+  s.waitNs = load(waitNs_);
+  s.bytes = load(bytes_);
+  for (size_t op = 0; op < kOperations; op++) {
+    for (size_t type = 0; type < kValueTypes; type++) s.instructions[op][type] = load(instructions_[op][type]);
+  }
+  return s;
+}
+
+std::string formatStats(const StatsSnapshot &stats) {
+  std::string out;
+  auto line = [&](const std::string &name, uint64_t value) { out += name + " " + std::to_string(value) + "\n"; };
+  line("runs", stats.runs);
+  line("errors", stats.errors);
+  line("native_runs", stats.nativeRuns);
+  line("time_total_ns", stats.totalNs);
+  line("time_last_ns", stats.lastNs);
+  line("wait_total_ns", stats.waitNs);
+  line("bytes", stats.bytes);
+  for (size_t op = 0; op < kOperations; op++) {
+    for (size_t type = 0; type < kValueTypes; type++) {
+      if (stats.instructions[op][type] == 0) continue;
+      line(std::string("instructions.") + operationName((Operation)op) + "." + typeName((ValueType)type),
+           stats.instructions[op][type]);
+    }
+  }
+  return out;
+}
+
+}  // namespace mycpu
@@ -0,0 +1,60 @@
+#pragma once
+
+// Статистика исполнения юнитов для файлов /stats и /unitN/stats. Счетчики обновляет поток,
+// исполняющий юнит, атомарным сложением с relaxed-порядком: на исполнение - несколько
+// сложений без блокировок. Читатель видит каждый счетчик целиком, но снимок разных
+// счетчиков согласован только приблизительно.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pram.hpp"
+
+namespace mycpu {
+
+// Значения счетчиков в момент чтения; складываются для сводки по устройству
+struct StatsSnapshot {
+  uint64_t runs = 0;
+  uint64_t errors = 0;
+  uint64_t nativeRuns = 0;
+  uint64_t totalNs = 0;  // Время исполнения
+  uint64_t lastNs = 0;   // Время последнего исполнения (в сводке - наибольшее по юнитам)
+  uint64_t waitNs = 0;   // Время в очереди от записи в ctrl до начала исполнения
+  uint64_t bytes = 0;    // Обработано: выходы и входы инструкций, для нативных программ - lram
+  uint64_t instructions[kOperations][kValueTypes] = {};  // По операции и типу выхода
+
+  StatsSnapshot &operator+=(const StatsSnapshot &other);
+};
+
+class UnitStats {
+ public:
+  // Функция учета исполнения программы юнита; executed - исполненные шаги (runProgram),
+  // в инструкциях учитываются только они
+  void AddRun(const Program &program, const std::vector<bool> &executed, uint64_t waitNs, uint64_t runNs,
+              uint64_t bytes, bool error);
+
+  StatsSnapshot Load() const;
+
+ private:
+  static void Add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> runs_{0};
+  std::atomic<uint64_t> errors_{0};
+  std::atomic<uint64_t> nativeRuns_{0};
+  std::atomic<uint64_t> totalNs_{0};
+  std::atomic<uint64_t> lastNs_{0};
+  std::atomic<uint64_t> waitNs_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<uint64_t> instructions_[kOperations][kValueTypes] = {};
+};
+
+// Функция форматирования статистики: строки "<имя> <значение>", нулевые счетчики
+// инструкций пропускаются
+std::string formatStats(const StatsSnapshot &stats);
+
+}  // namespace mycpu
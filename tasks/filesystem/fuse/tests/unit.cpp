@@ -0,0 +1,802 @@
+#include "device.hpp"
+#include "polls.hpp"
+#include "pram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <linux/landlock.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <catch2/catch_all.hpp>
+
+using namespace mycpu;
+
+namespace {
+
+template <typename T>
+T loadAt(const std::vector<uint8_t> &ram, size_t offset) {
+  T v;
+  std::memcpy(&v, ram.data() + offset, sizeof(T));
+  return v;
+}
+
+template <typename T>
+void storeAt(std::vector<uint8_t> &ram, size_t offset, T v) {
+  std::memcpy(ram.data() + offset, &v, sizeof(T));
+}
+
+void run(const std::string &text, std::vector<uint8_t> &ram) {
+  runProgram(compileProgram(text), ram.data(), ram.size());
+}
+
+void write(Memory &m, const std::string &s) { m.Write(0, s.data(), s.size()); }
+
+std::string read(const Memory &m) {
+  std::string s(m.Size(), '\0');
+  s.resize(m.Read(0, s.data(), s.size()));
+  return s;
+}
+
+}  // namespace
+
+TEST_CASE("pram parse", "[pram]") {
+  SECTION("instruction fields") {
+    auto program = parseProgram("[u16:200:400]add(u8:0, u8:100)\n");
+    REQUIRE(program.size() == 1);
+    CHECK(program[0].op == Operation::Add);
+    CHECK(program[0].out.type == ValueType::U16);
+    CHECK(program[0].out.begin == 200);
+    CHECK(program[0].out.end == 200 + 200);
+    CHECK_FALSE(program[0].out.toEnd);
+    CHECK(program[0].in[0].type == ValueType::U8);
+    CHECK(program[0].in[1].begin == 100);
+    CHECK(program[0].in[1].toEnd);
+  }
+
+  SECTION("text between instructions is skipped") {
+    auto program = parseProgram("// a\n[i32:0:8] mul (i32:8:16, i32:16:24) x [] [f32:0]div(f32:4,f32:8)");
+    REQUIRE(program.size() == 2);
+    CHECK(program[0].op == Operation::Mul);
+    CHECK(program[1].op == Operation::Div);
+    CHECK(parseProgram("321\n").empty());
+  }
+
+  SECTION("errors") {
+    CHECK_THROWS_AS(parseProgram("[u8:0]pow(u8:0, u8:1)"), ProgramError);
+    CHECK_THROWS_AS(parseProgram("[u64:0]add(u8:0, u8:1)"), ProgramError);
+    CHECK_THROWS_AS(parseProgram("[u8:x]add(u8:0, u8:1)"), ProgramError);
+    CHECK_THROWS_AS(parseProgram("[u8:0]add(u8:0)"), ProgramError);
+    CHECK_THROWS_AS(parseProgram("[u8:0]add(u8:0, u8:1, u8:2)"), ProgramError);
+  }
+}
+
+TEST_CASE("pram run", "[pram]") {
+  SECTION("reference test.py: u8 + u8 -> u16") {
+    std::vector<uint8_t> ram(200);
+    std::iota(ram.begin(), ram.end(), 0);
+    std::shuffle(ram.begin(), ram.end(), std::mt19937(1));
+    std::vector<uint8_t> input = ram;
+    run("[u16:200:400]add(u8:0, u8:100)", ram);
+    REQUIRE(ram.size() == 200);  // Выход за концом lram обрезается, как срез memoryview
+
+    ram.resize(400);
+    run("[u16:200:400]add(u8:0, u8:100)", ram);
+    for (size_t i = 0; i < 100; i++) {
+      REQUIRE(loadAt<uint16_t>(ram, 200 + i * 2) == input[i] + input[i + 100]);
+    }
+  }
+
+  SECTION("integer ops wrap and division by zero gives 0") {
+    std::vector<uint8_t> ram(16);
+    storeAt<int32_t>(ram, 0, -7);
+    storeAt<int32_t>(ram, 4, 2);
+    run("[i8:8:9]mul(i32:0:4, u8:4:5) [i32:12:16]div(i32:0:4, i32:4:8)", ram);
+    CHECK(loadAt<int8_t>(ram, 8) == -14);
+    CHECK(loadAt<int32_t>(ram, 12) == -3);
+    run("[i32:12:16]mod(i32:0:4, i32:4:8)", ram);
+    CHECK(loadAt<int32_t>(ram, 12) == -1);
+    storeAt<int32_t>(ram, 4, 0);
+    run("[i32:12:16]div(i32:0:4, i32:4:8)", ram);
+    CHECK(loadAt<int32_t>(ram, 12) == 0);
+    storeAt<uint16_t>(ram, 0, 65535);
+    storeAt<uint16_t>(ram, 2, 2);
+    run("[u16:4:6]add(u16:0:2, u16:2:4)", ram);
+    CHECK(loadAt<uint16_t>(ram, 4) == 1);
+  }
+
+  SECTION("f32 operands compute in floating point") {
+    std::vector<uint8_t> ram(16);
+    storeAt<float>(ram, 0, 7.0f);
+    storeAt<uint32_t>(ram, 4, 2);
+    run("[f32:8:12]div(f32:0:4, u32:4:8) [i16:12:14]mul(f32:0:4, f32:0:4)", ram);
+    CHECK(loadAt<float>(ram, 8) == 3.5f);
+    CHECK(loadAt<int16_t>(ram, 12) == 49);
+  }
+
+  SECTION("output overlapping an input runs element by element, as in device.py") {
+    // Ядро (все u8) и общий путь (вход i8) дают одно и то же: каждый элемент читает предыдущий
+    for (const char* text : {"[u8:1:9]add(u8:0:8, u8:0:8)", "[u8:1:9]add(u8:0:8, i8:0:8)"}) {
+      std::vector<uint8_t> ram(10);
+      ram[0] = 1;
+      run(text, ram);
+      CHECK(ram == std::vector<uint8_t>{1, 2, 4, 8, 16, 32, 64, 128, 0, 0});
+    }
+    // Длиннее порции общего пути
+    std::vector<uint8_t> ram(5000);
+    std::mt19937 gen(3);
+    for (auto &c : ram) c = (uint8_t)gen();
+    std::vector<uint8_t> expected = ram;
+    for (size_t i = 0; i < 2000; i++) expected[1 + i] = (uint8_t)(expected[i] + (int8_t)expected[2000 + i]);
+    run("[u8:1:4001]add(u8:0:4000, i8:2000:4000)", ram);
+    CHECK(ram == expected);
+  }
+
+  SECTION("element count is the shortest operand") {
+    std::vector<uint8_t> ram(12, 1);
+    run("[u8:8]add(u8:0:2, u8:4:8)", ram);
+    CHECK(ram[8] == 2);
+    CHECK(ram[9] == 2);
+    CHECK(ram[10] == 1);
+  }
+
+  SECTION("range not a multiple of the type size") {
+    std::vector<uint8_t> ram(8);
+    CHECK_THROWS_AS(run("[u16:0:3]add(u8:0, u8:1)", ram), ProgramError);
+  }
+}
+
+TEST_CASE("pram kernels", "[pram]") {
+  // Ядра для операндов одного типа дают тот же результат, что и общий путь
+  const char* types[] = {"i8", "u8", "i16", "u16", "i32", "u32", "f32"};
+  const char* ops[] = {"add", "sub", "mul", "div", "mod"};
+  std::mt19937_64 gen(7);
+  for (const char* type : types) {
+    for (const char* op : ops) {
+      const size_t bytes = 4 * 1000 + 12;  // Не кратно ширине вектора
+      std::vector<uint8_t> ram(3 * bytes);
+      for (auto &b : ram) b = (uint8_t)gen();
+      if (std::string(type) == "f32") {
+        std::uniform_real_distribution<float> value(-1000, 1000);
+        for (size_t i = 0; i < ram.size(); i += 4) storeAt(ram, i, value(gen));
+      }
+      // Нули в делителе
+      for (size_t i = 0; i < 32; i++) ram[2 * bytes + i] = 0;
+
+      std::string b0 = std::to_string(bytes), b1 = std::to_string(2 * bytes), b2 = std::to_string(3 * bytes);
+      // Выход поверх первого входа: ядро должно допускать out == a
+      std::string text = std::string("[") + type + ":0:" + b0 + "]" + op + "(" + type + ":0:" + b0 + "," + type +
+                         ":" + b1 + ":" + b2 + ")";
+      Program program = compileProgram(text);
+      REQUIRE(program.steps.size() == 1);
+      REQUIRE(program.steps[0].kernel != nullptr);
+      Program generic = program;
+      generic.steps[0].kernel = nullptr;
+
+      std::vector<uint8_t> expected = ram;
+      runProgram(generic, expected.data(), expected.size());
+      runProgram(program, ram.data(), ram.size());
+      INFO(text);
+      CHECK(ram == expected);
+    }
+  }
+
+  SECTION("mixed types use the generic path") {
+    CHECK(compileProgram("[u16:0]add(u8:0, u8:1)").steps[0].kernel == nullptr);
+    CHECK(compileProgram("[f32:0]add(f32:0, i32:4)").steps[0].kernel == nullptr);
+  }
+}
+
+TEST_CASE("pram optimizer", "[pram]") {
+  SECTION("dead stores are skipped, chains are fused") {
+    std::vector<uint8_t> ram(16);
+    std::iota(ram.begin(), ram.end(), 1);
+    // Первая запись перезаписывается второй до чтения
+    Program program = compileProgram("[u8:0:4]add(u8:4:8, u8:8:12) [u8:0:4]sub(u8:8:12, u8:4:8)");
+    std::vector<uint8_t> expected = ram;
+    CHECK(runProgram(program, expected.data(), expected.size(), false) == 24);
+    CHECK(runProgram(program, ram.data(), ram.size()) == 12);
+    CHECK(ram == expected);
+
+    // Цепочка через промежуточный диапазон: t = a + b, o = t * c
+    ram.assign(5 * 5000, 0);
+    for (size_t i = 0; i < ram.size(); i++) ram[i] = (uint8_t)(i * 7 + 3);
+    program = compileProgram("[u8:0:5000]add(u8:5000:10000, u8:10000:15000) [u8:15000:20000]mul(u8:0:5000, u8:20000)");
+    expected = ram;
+    runProgram(program, expected.data(), expected.size(), false);
+    CHECK(runProgram(program, ram.data(), ram.size()) == 6 * 5000);
+    CHECK(ram == expected);
+  }
+
+  SECTION("optimized runs match instruction-by-instruction runs") {
+    // Случайные программы над lram из четырех слотов: операнды - целые слоты (сливаются)
+    // или произвольные диапазоны (пересечения со сдвигом, обрезка, ошибки длины)
+    const char* types[] = {"i8", "u8", "i16", "u16", "i32", "u32", "f32"};
+    const char* ops[] = {"add", "sub", "mul", "div", "mod"};
+    std::mt19937_64 gen(47);
+    for (int iteration = 0; iteration < 3000; iteration++) {
+      size_t slot = gen() % 8 == 0 ? 4 * 2100 : 16;
+      std::vector<uint8_t> ram(4 * slot + gen() % 3);
+      for (auto &b : ram) b = (uint8_t)gen();
+      const char* type = types[gen() % 7];
+      auto operand = [&] {
+        const char* t = gen() % 4 ? type : types[gen() % 7];
+        if (gen() % 5) {
+          size_t s = gen() % 4;
+          return std::string(t) + ":" + std::to_string(s * slot) + ":" + std::to_string((s + 1) * slot);
+        }
+        size_t begin = gen() % ram.size();
+        std::string o = std::string(t) + ":" + std::to_string(begin);
+        if (gen() % 2) o += ":" + std::to_string(begin + gen() % 64);
+        return o;
+      };
+      std::string text;
+      for (size_t i = 0, n = 1 + gen() % 6; i < n; i++) {
+        text += "[";
+        text += operand();
+        text += std::string("]") + ops[gen() % 5] + "(";
+        text += operand();
+        text += ", ";
+        text += operand();
+        text += ") ";
+      }
+      Program program = compileProgram(text);
+      std::vector<uint8_t> expected = ram;
+      bool expectedError = false, error = false;
+      try {
+        runProgram(program, expected.data(), expected.size(), false);
+      } catch (const ProgramError &) {
+        expectedError = true;
+      }
+      try {
+        runProgram(program, ram.data(), ram.size());
+      } catch (const ProgramError &) {
+        error = true;
+      }
+      INFO(text);
+      CHECK(error == expectedError);
+      REQUIRE(ram == expected);
+    }
+  }
+}
+
+TEST_CASE("memory", "[device]") {
+  Memory m;
+  write(m, "hello");
+  CHECK(read(m) == "hello");
+  m.Write(7, "!", 1);
+  CHECK(read(m) == std::string("hello\0\0!", 8));
+  m.Resize(4);
+  CHECK(read(m) == "hell");
+  char buf[8];
+  CHECK(m.Read(10, buf, sizeof(buf)) == 0);
+}
+
+TEST_CASE("memory fd", "[device]") {
+  Memory m;
+  // Рост через несколько страниц: данные сохраняются при переотображении
+  std::string big(3 * 4096 + 5, 'x');
+  for (size_t i = 0; i < big.size(); i++) big[i] = (char)('a' + i % 26);
+  write(m, big.substr(0, 10));
+  m.Write(10, big.data() + 10, big.size() - 10);
+  CHECK(read(m) == big);
+
+  // Уменьшение и рост обратно: хвост читается нулями, в том числе из освобожденных страниц
+  m.Resize(100);
+  m.Resize(big.size());
+  CHECK(read(m) == big.substr(0, 100) + std::string(big.size() - 100, '\0'));
+
+  // Запись через дескриптор видна по указателю, размер - по фактически записанному
+  uint64_t version = m.Version();
+  size_t written = m.WriteFd(8000, 6, [](int fd, uint8_t* data) -> size_t {
+    if (fd < 0) {
+      std::memcpy(data, "memfd", 5);
+      return 5;
+    }
+    return (size_t)pwrite(fd, "memfd", 5, 8000);
+  });
+  CHECK(written == 5);
+  CHECK(m.Version() > version);
+  CHECK(m.Size() == big.size());
+  m.View([](const uint8_t* data, size_t) { CHECK(std::string((const char*)data + 8000, 5) == "memfd"); });
+  m.WriteFd(big.size(), 6, [&](int fd, uint8_t* data) -> size_t {
+    if (fd < 0) {
+      std::memcpy(data, "end", 3);
+      return 3;
+    }
+    return (size_t)pwrite(fd, "end", 3, (off_t)big.size());
+  });
+  CHECK(m.Size() == big.size() + 3);
+
+  // Ошибка копирования: размер прежний
+  CHECK_THROWS(m.WriteFd(20000, 10, [](int, uint8_t*) -> size_t { throw std::runtime_error("copy"); }));
+  CHECK(m.Size() == big.size() + 3);
+
+  // Чтение через дескриптор: то же содержимое
+  m.ViewFd([&](int fd, const uint8_t* data, size_t size) {
+    REQUIRE(size == big.size() + 3);
+    if (fd < 0) return;
+    std::string out(size, '\0');
+    CHECK(pread(fd, out.data(), size, 0) == (ssize_t)size);
+    CHECK(std::memcmp(out.data(), data, size) == 0);
+  });
+}
+
+TEST_CASE("memory images", "[device]") {
+  Memory a, b;
+  write(a, "shared image");
+  MemoryImage image = a.Snapshot();
+  uint64_t version = b.Version();
+  CHECK(b.Assign(image) > version);
+  CHECK(read(b) == "shared image");
+  // Без изменений у памятей один буфер
+  const uint8_t* shared = a.View([](const uint8_t* data, size_t) { return data; });
+  CHECK(b.View([](const uint8_t* data, size_t) { return data; }) == shared);
+  CHECK(image.Data() == shared);
+
+  // Изменение копирует буфер только у изменяемой памяти
+  b.Write(0, "S", 1);
+  CHECK(read(b) == "Shared image");
+  CHECK(read(a) == "shared image");
+  CHECK(b.View([](const uint8_t* data, size_t) { return data; }) != shared);
+  a.Modify([](uint8_t* data, size_t) { data[1] = 'H'; });
+  CHECK(read(a) == "sHared image");
+  CHECK(std::string((const char*)image.Data(), image.Size()) == "shared image");
+
+  // Снимок пустой памяти и замена пустым снимком
+  Memory empty;
+  CHECK(empty.Snapshot().Size() == 0);
+  a.Assign(empty.Snapshot());
+  CHECK(a.Size() == 0);
+  a.Write(2, "x", 1);
+  CHECK(read(a) == std::string("\0\0x", 3));
+}
+
+TEST_CASE("ctrl", "[device]") {
+  Device device(9, 4);
+
+  SECTION("empty programs complete at start, in start order") {
+    device.Start("5\n");
+    device.Start("3 6");
+    CHECK(device.ReadCtrl(4096) == "5\n3\n6\n");
+    CHECK(device.ReadCtrl(4096).empty());
+    device.Start("1 2");
+    CHECK(device.ReadCtrl(2) == "1\n");
+    CHECK(device.Wait()->unit == 2);
+    CHECK_FALSE(device.Wait().has_value());
+  }
+
+  SECTION("bad unit numbers are rejected as a whole") {
+    CHECK_THROWS_AS(device.Start("1 9"), std::invalid_argument);
+    CHECK_THROWS_AS(device.Start("x"), std::invalid_argument);
+    CHECK_THROWS_AS(device.Start("-1"), std::invalid_argument);
+    CHECK_FALSE(device.Wait().has_value());
+  }
+
+  SECTION("units run their program over their lram") {
+    Unit &u = device.unit(7);
+    u.lram.Write(0, "\x01\x02\x03\x04", 4);
+    write(u.pram, "[u8:4:6]add(u8:0:2, u8:2:4)\n");
+    u.lram.Resize(6);
+    device.Start("7");
+    auto c = device.Wait();
+    REQUIRE(c.has_value());
+    CHECK(c->unit == 7);
+    CHECK(c->error.empty());
+    CHECK(read(u.lram) == std::string("\x01\x02\x03\x04\x04\x06", 6));
+  }
+
+  SECTION("program is compiled once per pram version") {
+    write(device.unit(2).pram, "[u8:0]add(u8:0, u8:0)");
+    auto first = device.Compiled(2);
+    CHECK(device.Compiled(2) == first);
+    write(device.unit(2).pram, "[u8:1]add(u8:0, u8:0)");
+    auto second = device.Compiled(2);
+    CHECK(second != first);
+    CHECK(second->steps[0].ins.out.begin == 1);
+  }
+
+  SECTION("program errors are reported as completions") {
+    write(device.unit(0).pram, "[u8:0]pow(u8:0, u8:0)");
+    write(device.unit(1).pram, "[u16:0:3]add(u8:0, u8:0)");
+    device.unit(1).lram.Resize(8);
+    device.Start("0 1");
+    std::string lines = device.ReadCtrl(4096);
+    if (lines.find('\n') == lines.size() - 1) lines += device.ReadCtrl(4096);
+    CHECK(lines.find("0 error: unknown operation pow\n") != std::string::npos);
+    CHECK(lines.find("1 error: ") != std::string::npos);
+  }
+
+  SECTION("units run the pram snapshot taken at start, compiled by the pool") {
+    Unit &u = device.unit(3);
+    u.lram.Write(0, "\x01\x02", 2);
+    write(u.pram, "[u8:1]add(u8:0, u8:1)");
+    device.Start("3");
+    write(u.pram, "[u8:0]pow(u8:0, u8:1)");
+    CHECK(device.ReadCtrl(4096) == "3\n");
+    CHECK(read(u.lram) == "\x01\x03");
+    device.Start("3");
+    CHECK(device.ReadCtrl(4096) == "3 error: unknown operation pow\n");
+  }
+}
+
+TEST_CASE("stats", "[device]") {
+  Device device(3, 2);
+  write(device.unit(1).pram, "[u8:0:4]add(u8:4:8, u8:8:12) [i16:0:4]mul(i16:0:4, i16:8:12)");
+  device.unit(1).lram.Resize(12);
+  write(device.unit(2).pram, "[u16:0:3]add(u8:0, u8:0)");
+  device.unit(2).lram.Resize(8);
+  device.Start("0 1 2");
+  while (device.Wait()) {
+  }
+  device.Run(1);
+
+  StatsSnapshot s = device.unit(1).stats.Load();
+  CHECK(s.runs == 2);
+  CHECK(s.errors == 0);
+  CHECK(s.bytes == 2 * (12 + 12));
+  CHECK(s.instructions[(size_t)Operation::Add][(size_t)ValueType::U8] == 2);
+  CHECK(s.instructions[(size_t)Operation::Mul][(size_t)ValueType::I16] == 2);
+  CHECK(s.totalNs >= s.lastNs);
+  CHECK(device.unit(0).stats.Load().runs == 0);  // Пустая программа не исполняется
+  CHECK(device.unit(2).stats.Load().errors == 1);
+
+  std::string unit = device.Stats(1);
+  CHECK(unit.rfind("runs 2\nerrors 0\nnative_runs 0\n", 0) == 0);
+  CHECK(unit.find("bytes 48\ninstructions.add.u8 2\ninstructions.mul.i16 2\n") != std::string::npos);
+  std::string total = device.Stats();
+  CHECK(total.rfind("units 3\nqueued 0\nrunning 0\nslowest_unit ", 0) == 0);
+  CHECK(total.find("\nruns 3\nerrors 1\n") != std::string::npos);
+
+  // Учитываются только исполненные инструкции: без перезаписанных записей и шагов после ошибки
+  CHECK(device.unit(2).stats.Load().instructions[(size_t)Operation::Add][(size_t)ValueType::U16] == 0);
+  write(device.unit(0).pram, "[u8:0:4]add(u8:4:8, u8:4:8) [u8:0:4]mul(u8:4:8, u8:4:8) [u16:0:3]sub(u8:0, u8:0)");
+  device.unit(0).lram.Resize(8);
+  CHECK_THROWS_AS(device.Run(0), ProgramError);
+  s = device.unit(0).stats.Load();
+  CHECK(s.errors == 1);
+  CHECK(s.instructions[(size_t)Operation::Add][(size_t)ValueType::U8] == 0);
+  CHECK(s.instructions[(size_t)Operation::Mul][(size_t)ValueType::U8] == 1);
+  CHECK(s.instructions[(size_t)Operation::Sub][(size_t)ValueType::U16] == 0);
+}
+
+TEST_CASE("ctrl scheduler", "[device]") {
+  // Юниты исполняются параллельно, чтения ctrl отдают все завершения ровно по разу
+  const size_t units = 32, bytes = 1 << 16;
+  Device device(units, 4);
+
+  SECTION("units run in parallel, ctrl reads return every completion exactly once") {
+    for (size_t i = 0; i < units; i++) {
+      std::vector<uint8_t> ram(2 * bytes, (uint8_t)i);
+      device.unit(i).lram.Write(0, ram.data(), ram.size());
+      write(device.unit(i).pram, "[u8:0:" + std::to_string(bytes) + "]add(u8:0:" + std::to_string(bytes) + ", u8:" +
+                                     std::to_string(bytes) + ")");
+    }
+
+    std::vector<int> seen(units);
+    for (int round = 0; round < 3; round++) {
+      std::string command;
+      for (size_t i = 0; i < units; i++) command += std::to_string(i) + " ";
+      device.Start(command);
+      // Читатели ждут параллельно с исполнением
+      std::vector<std::thread> readers;
+      std::mutex seenMutex;
+      for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&] {
+          for (std::string lines; !(lines = device.ReadCtrl(64)).empty();) {
+            std::lock_guard lock(seenMutex);
+            for (size_t pos = 0; pos < lines.size();) {
+              size_t nl = lines.find('\n', pos);
+              seen[std::stoul(lines.substr(pos, nl - pos))]++;
+              pos = nl + 1;
+            }
+          }
+        });
+      }
+      for (auto &t : readers) t.join();
+    }
+    for (size_t i = 0; i < units; i++) {
+      CHECK(seen[i] == 3);
+      uint8_t expected = (uint8_t)(i * 4);  // Три запуска, каждый прибавляет i
+      uint8_t got;
+      device.unit(i).lram.Read(bytes - 1, &got, 1);
+      CHECK(got == expected);
+    }
+  }
+
+  SECTION("non-blocking ctrl reads and completion notifications") {
+    std::atomic<int> notified{0};
+    device.SetCompletionListener([&] { notified++; });
+    write(device.unit(0).pram, "[u8:0]add(u8:0, u8:0)");
+    device.unit(0).lram.Resize(1);
+    // Юнит 0 не исполнится, пока его lram держит разделяемая блокировка: исполнение ждет исключительную
+    std::promise<void> release;
+    std::atomic<bool> holding{false};
+    std::thread blocker([&] {
+      device.unit(0).lram.View([&](const uint8_t*, size_t) {
+        holding = true;
+        release.get_future().wait();
+        return 0;
+      });
+    });
+    while (!holding) std::this_thread::yield();
+    auto readError = [&] {
+      try {
+        device.ReadCtrl(4096, false);
+      } catch (const std::system_error &e) {
+        return e.code().value();
+      }
+      return 0;
+    };
+    // Юнит 2 с пустой программой завершается при запуске, юнит 0 еще исполняется
+    device.Start("0 2");
+    CHECK(notified == 1);
+    CHECK(device.HasCompletions());
+    CHECK(device.ReadCtrl(4096, false) == "2\n");
+    CHECK_FALSE(device.HasCompletions());
+    CHECK(readError() == EAGAIN);
+    release.set_value();
+    blocker.join();
+    CHECK(device.ReadCtrl(4096) == "0\n");
+    for (int i = 0; i < 1000 && notified < 2; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(notified == 2);
+    CHECK(device.ReadCtrl(4096, false).empty());
+  }
+}
+
+TEST_CASE("poll waiters", "[device]") {
+  // Ожидания - номера, уведомления и освобождения записываются по порядку
+  std::mutex logMutex;
+  std::vector<std::string> log;
+  auto record = [&](const char* what) {
+    return [&, what](int h) {
+      std::lock_guard lock(logMutex);
+      log.push_back(what + std::to_string(h));
+    };
+  };
+  std::function<void(int)> notify = record("notify "), destroy = record("destroy ");
+  std::function<void(int)> notifyHook;
+  PollWaiters<int> polls([&](int h) { notifyHook ? notifyHook(h) : notify(h); }, destroy);
+
+  SECTION("a repeated poll replaces the waiter of the file") {
+    polls.Add(1, 10);
+    polls.Add(1, 11);
+    polls.Add(2, 20);
+    CHECK(log == std::vector<std::string>{"destroy 10"});
+    CHECK(polls.Size() == 2);
+    polls.Remove(2);
+    polls.Remove(3);
+    polls.Notify();
+    CHECK(log == std::vector<std::string>{"destroy 10", "destroy 20", "notify 11", "destroy 11"});
+    CHECK(polls.Size() == 0);
+    polls.Notify();
+    CHECK(log.size() == 4);
+  }
+
+  SECTION("stop releases waiters and rejects new ones") {
+    polls.Add(1, 10);
+    polls.Stop();
+    polls.Add(2, 20);
+    polls.Notify();
+    CHECK(log == std::vector<std::string>{"destroy 10", "destroy 20"});
+    CHECK(polls.Size() == 0);
+  }
+
+  SECTION("stop waits for a notification in progress") {
+    std::promise<void> entered, release;
+    notifyHook = [&](int h) {
+      entered.set_value();
+      release.get_future().wait();
+      notify(h);
+    };
+    polls.Add(1, 10);
+    std::thread notifier([&] { polls.Notify(); });
+    entered.get_future().wait();
+    std::atomic<bool> stopped{false};
+    std::thread stopper([&] {
+      polls.Stop();
+      stopped = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_FALSE(stopped);
+    release.set_value();
+    stopper.join();
+    notifier.join();
+    CHECK(stopped);
+    CHECK(log == std::vector<std::string>{"notify 10", "destroy 10"});
+  }
+}
+
+TEST_CASE("broadcast", "[device]") {
+  Device device(8, 2);
+
+  SECTION("mask") {
+    CHECK(device.BroadcastMask() == "0-7\n");
+    device.SetBroadcastMask("5 1-3\n0");
+    CHECK(device.BroadcastMask() == "0-3 5\n");
+    device.SetBroadcastMask("7 all");
+    CHECK(device.BroadcastMask() == "0-7\n");
+    device.SetBroadcastMask("\n");
+    CHECK(device.BroadcastMask().empty());
+    CHECK_THROWS_AS(device.SetBroadcastMask("8"), std::invalid_argument);
+    CHECK_THROWS_AS(device.SetBroadcastMask("3-1"), std::invalid_argument);
+    CHECK_THROWS_AS(device.SetBroadcastMask("1-"), std::invalid_argument);
+    CHECK_THROWS_AS(device.SetBroadcastMask("allx"), std::invalid_argument);
+    CHECK_THROWS_AS(device.SetBroadcastMask("2,3"), std::invalid_argument);
+    CHECK(device.BroadcastMask().empty());
+  }
+
+  SECTION("units share the published images until they change them") {
+    device.SetBroadcastMask("1 4-6");
+    write(device.broadcastLram(), std::string("\x01\x02\x03\x04", 4));
+    device.PublishLram();
+    write(device.broadcastPram(), "[u8:0:2]add(u8:0:2, u8:2:4)");
+    device.PublishPram();
+    CHECK(read(device.unit(0).pram).empty());
+    CHECK(read(device.unit(4).pram) == "[u8:0:2]add(u8:0:2, u8:2:4)");
+
+    // Программа разобрана один раз на все юниты рассылки
+    auto program = device.Compiled(1);
+    REQUIRE(program);
+    for (size_t unit : {4, 5, 6}) CHECK(device.Compiled(unit) == program);
+
+    device.Start("1 5");
+    CHECK(device.ReadCtrl(4096).size() + device.ReadCtrl(4096).size() == 4);
+    CHECK(read(device.unit(1).lram) == std::string("\x04\x06\x03\x04", 4));
+    CHECK(read(device.unit(5).lram) == read(device.unit(1).lram));
+    CHECK(read(device.unit(4).lram) == std::string("\x01\x02\x03\x04", 4));
+    CHECK(read(device.broadcastLram()) == read(device.unit(4).lram));
+
+    // Новая программа в pram юнита заменяет разосланную только у него
+    write(device.unit(4).pram, "[u8:0]sub(u8:0, u8:0)");
+    CHECK(device.Compiled(4) != program);
+    CHECK(device.Compiled(6) == program);
+  }
+
+  SECTION("pram with errors is published and fails at run") {
+    write(device.broadcastPram(), "[u8:0]pow(u8:0, u8:0)");
+    device.PublishPram();
+    device.Start("3");
+    CHECK(device.ReadCtrl(4096).rfind("3 error: unknown operation pow\n", 0) == 0);
+  }
+
+  SECTION("publishing does not build the program, runs do") {
+    char dir[] = "/tmp/mycpu-jit-test-XXXXXX";
+    REQUIRE(mkdtemp(dir));
+    JitConfig config;
+    config.cacheDir = dir;
+    config.compiler = "/nonexistent/c++";
+    Device native(2, 2, config);
+    write(native.broadcastPram(), "int entrypoint(uint32_t, uint8_t*) { return 0; }");
+    native.PublishPram();
+    CHECK(native.jit().Compilations() == 0);
+    native.Start("1");
+    CHECK(native.ReadCtrl(4096).rfind("1 error: ", 0) == 0);
+    std::filesystem::remove_all(dir);
+  }
+}
+
+TEST_CASE("jit", "[device]") {
+  // Свой каталог кеша: сборки не берутся из прошлых запусков
+  char dir[] = "/tmp/mycpu-jit-test-XXXXXX";
+  REQUIRE(mkdtemp(dir));
+  JitConfig config;
+  config.cacheDir = dir;
+  config.timeout = std::chrono::milliseconds(1500);
+  Device device(4, 2, config);
+  const std::string sort =
+      "#include <algorithm>\n"
+      "int entrypoint(uint32_t size, uint8_t* ram) {\n"
+      "  std::sort(ram, ram + size);\n"
+      "  return 0;\n"
+      "}\n";
+
+  SECTION("identical sources are built once and run over lram") {
+    write(device.unit(0).pram, sort);
+    write(device.unit(1).pram, sort);
+    write(device.unit(0).lram, "mycpu");
+    write(device.unit(1).lram, "native");
+    device.Start("0 1");
+    std::string lines = device.ReadCtrl(4096);
+    if (lines.size() < 4) lines += device.ReadCtrl(4096);
+    CHECK((lines == "0\n1\n" || lines == "1\n0\n"));
+    CHECK(read(device.unit(0).lram) == "cmpuy");
+    CHECK(read(device.unit(1).lram) == "aeintv");
+    CHECK(device.Compiled(0)->library == device.Compiled(1)->library);
+    CHECK(std::filesystem::path(device.Compiled(0)->library).filename().string().size() == 64 + 3);  // SHA-256.so
+    CHECK(device.jit().Compilations() == 1);
+    CHECK(device.Compiled(0)->steps.empty());
+  }
+
+  SECTION("compiler errors, return codes and crashes are reported as completions") {
+    write(device.unit(0).pram, "int entrypoint(uint32_t, uint8_t*) { return undefined; }");
+    write(device.unit(1).pram, "int entrypoint(uint32_t size, uint8_t*) { return size + 1; }");
+    write(device.unit(2).pram, "int entrypoint(uint32_t, uint8_t*) { return *(volatile int*)0; }");
+    device.unit(1).lram.Resize(1);
+    device.Start("0");
+    CHECK(device.ReadCtrl(4096).rfind("0 error: compilation failed: pram:1:", 0) == 0);
+    device.Start("1");
+    CHECK(device.ReadCtrl(4096) == "1 error: entrypoint returned 2\n");
+    device.Start("2");
+    CHECK(device.ReadCtrl(4096).rfind("2 error: native program crashed: ", 0) == 0);
+
+    // Исполнитель после падения заменяется новым
+    write(device.unit(3).pram, sort);
+    write(device.unit(3).lram, "321");
+    device.Run(3);
+    CHECK(read(device.unit(3).lram) == "123");
+  }
+
+  SECTION("compiler that cannot be run is retried on the next build") {
+    std::string compiler = std::string(dir) + "/cxx";
+    JitConfig later = config;
+    later.compiler = compiler;
+    Jit jit(later);
+    const std::string source = "int entrypoint(uint32_t, uint8_t*) { return 0; }";
+    CHECK_THROWS_WITH(jit.Build(source), Catch::Matchers::StartsWith("cannot run compiler " + compiler));
+    // Компилятор появился: сборка не берет прежнюю ошибку из кеша
+    {
+      std::ofstream script(compiler);
+      script << "#!/bin/sh\nexec c++ \"$@\"\n";
+    }
+    std::filesystem::permissions(compiler, std::filesystem::perms::owner_all);
+    CHECK_NOTHROW(jit.Build(source));
+    CHECK(jit.Compilations() == 1);
+  }
+
+  SECTION("native programs have no network, exec or files outside the libraries") {
+    bool landlock = syscall(SYS_landlock_create_ruleset, nullptr, 0, LANDLOCK_CREATE_RULESET_VERSION) > 0;
+    write(device.unit(0).pram,
+          "#include <fcntl.h>\n#include <sys/socket.h>\n#include <unistd.h>\n"
+          "int entrypoint(uint32_t, uint8_t* ram) {\n"
+          "  ram[0] = socket(AF_INET, SOCK_STREAM, 0) >= 0 ? 'n' : '-';\n"
+          "  ram[1] = open(\"/tmp\", O_RDONLY | O_DIRECTORY) >= 0 ? 'r' : '-';\n"
+          "  ram[2] = open(\"" + std::string(dir) + "/escape\", O_WRONLY | O_CREAT, 0600) >= 0 ? 'w' : '-';\n"
+          "  execl(\"/bin/true\", \"true\", (char*)nullptr);\n"
+          "  return 0;\n"
+          "}\n");
+    write(device.unit(0).lram, "...");
+    device.Start("0");
+    CHECK(device.ReadCtrl(4096) == "0\n");
+    CHECK(read(device.unit(0).lram) == (landlock ? "---" : "-rw"));
+  }
+
+  SECTION("endless builds are killed after the compile timeout") {
+    JitConfig slow = config;
+    slow.compileTimeout = std::chrono::milliseconds(500);
+    Jit jit(slow);
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS_WITH(jit.Build("#include \"/dev/zero\"\nint entrypoint(uint32_t, uint8_t*) { return 0; }"),
+                      "compilation timed out after 500 ms");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+  }
+
+  SECTION("endless programs are killed after the timeout") {
+    write(device.unit(0).pram, "int entrypoint(uint32_t, uint8_t* ram) { for (;;) *(volatile uint8_t*)ram = 1; }");
+    write(device.unit(1).pram, sort);
+    write(device.unit(1).lram, "ba");
+    auto start = std::chrono::steady_clock::now();
+    device.Start("0");
+    CHECK(device.ReadCtrl(4096) == "0 error: native program timed out after 1500 ms\n");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+    device.Start("1");
+    CHECK(device.ReadCtrl(4096) == "1\n");
+    CHECK(read(device.unit(1).lram) == "ab");
+  }
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+// Генерация тестовых файлов и проверка сортировки для supaBigSort и бенчмарков.
+// Оба режима работают с файлами больше памяти: генератор пишет блоки по мере готовности,
+// проверка читает файл окнами mmap; и то и другое - в нескольких потоках.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "external_sorter.hpp"
+
+namespace extsort {
+
+// Распределение значений генератора
+enum class Distribution {
+  Uniform,         // Равномерно: целые - весь диапазон типа, вещественные - [-1e9, 1e9)
+  Sorted,          // Равномерно и по возрастанию
+  NearlySorted,    // По возрастанию, 1% записей переставлен с соседями на расстоянии до 64
+  Zipf,            // Ранги 1..2^20, ранг r встречается с вероятностью ~1/r
+  ManyDuplicates,  // 1000 различных значений
+};
+
+inline bool parseDistribution(const std::string &name, Distribution &dist) {
+  static const std::pair<const char*, Distribution> names[] = {
+      {"uniform", Distribution::Uniform},           {"sorted", Distribution::Sorted},
+      {"nearly-sorted", Distribution::NearlySorted}, {"zipf", Distribution::Zipf},
+      {"many-duplicates", Distribution::ManyDuplicates}};
+  for (auto &n : names) {
+    if (name == n.first) {
+      dist = n.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline const char* distributionName(Distribution dist) {
+  switch (dist) {
+    case Distribution::Uniform: return "uniform";
+    case Distribution::Sorted: return "sorted";
+    case Distribution::NearlySorted: return "nearly-sorted";
+    case Distribution::Zipf: return "zipf";
+    case Distribution::ManyDuplicates: return "many-duplicates";
+  }
+  return "?";
+}
+
+// Параметры генератора. Содержимое файла зависит только от seed, распределения
+// и числа записей - не от числа потоков.
+struct GenOptions {
+  Distribution dist = Distribution::Uniform;
+  size_t threads = 1;
+  uint64_t seed = 0;
+};
+
+namespace detail {
+
+constexpr size_t kGenBlock = 1 << 20;    // Записей в блоке генератора (блок - единица работы потока)
+constexpr size_t kZipfRanks = 1 << 20;   // Различных значений Zipf
+constexpr size_t kDuplicateValues = 1000;
+
+// Выборка Zipf (s = 1) методом rejection-inversion (Hörmann, Derflinger): O(1) на значение
+// без таблицы; h(x) = 1/x, H(x) = ln x - интеграл h
+class ZipfSampler {
+ public:
+  explicit ZipfSampler(size_t n)
+      : n_((double)n), hx1_(std::log(1.5) - 1.0), hn_(std::log(n + 0.5)), s_(2.0 - std::exp(std::log(2.5) - 0.5)) {}
+
+  template <typename Gen>
+  size_t operator()(Gen &gen) {
+    std::uniform_real_distribution<double> u01(0.0, 1.0);
+    for (;;) {
+      double u = hn_ + u01(gen) * (hx1_ - hn_);
+      double x = std::exp(u);
+      double k = std::clamp(std::floor(x + 0.5), 1.0, n_);
+      if (k - x <= s_ || u >= std::log(k + 0.5) - 1.0 / k) return (size_t)k;
+    }
+  }
+
+ private:
+  double n_, hx1_, hn_, s_;
+};
+
+// Функция заполнения блока block из blocks значениями распределения dist.
+// Для Sorted/NearlySorted блок b берет значения из b-й доли диапазона, поэтому
+// блоки упорядочены между собой без сортировки всего файла.
+template <typename T>
+void fillBlock(T* out, size_t n, size_t block, size_t blocks, Distribution dist, std::mt19937_64 &gen,
+               ZipfSampler &zipf) {
+  switch (dist) {
+    case Distribution::Uniform:
+    case Distribution::Sorted:
+    case Distribution::NearlySorted: {
+      bool ordered = dist != Distribution::Uniform;
+      if constexpr (std::is_integral_v<T>) {
+        using U = std::make_unsigned_t<T>;
+        const U min = (U)std::numeric_limits<T>::min();
+        uint64_t range = (U)((U)std::numeric_limits<T>::max() - min);
+        if (!ordered) {
+          std::uniform_int_distribution<uint64_t> value(0, range);
+          for (size_t i = 0; i < n; i++) out[i] = (T)(U)(min + (U)value(gen));
+          break;
+        }
+        // Возрастающие значения без сортировки: накапливаем случайные шаги со средним span / n
+        uint64_t span = std::max(range / blocks, (uint64_t)1);
+        uint64_t lo = std::min((uint64_t)block * span, range);
+        uint64_t last = std::min(span - 1, range - lo);
+        std::uniform_int_distribution<uint64_t> gap(0, std::max(last / n * 2, (uint64_t)1));
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; i++) {
+          v = std::min(v + gap(gen), last);
+          out[i] = (T)(U)(min + (U)(lo + v));
+        }
+      } else {
+        double width = ordered ? 2e9 / blocks : 2e9;
+        double lo = -1e9 + (ordered ? width * block : 0);
+        if (!ordered) {
+          std::uniform_real_distribution<double> value(lo, lo + width);
+          for (size_t i = 0; i < n; i++) out[i] = (T)value(gen);
+          break;
+        }
+        std::uniform_real_distribution<double> gap(0, width / n * 2);
+        double v = lo;
+        for (size_t i = 0; i < n; i++) {
+          v = std::min(v + gap(gen), lo + width);
+          out[i] = (T)v;
+        }
+      }
+      if (dist == Distribution::NearlySorted && n > 1) {
+        std::uniform_int_distribution<size_t> pos(0, n - 1), step(1, 64);
+        for (size_t s = 0; s < n / 200; s++) {  // n / 200 перестановок - 1% записей
+          size_t i = pos(gen);
+          std::swap(out[i], out[std::min(i + step(gen), n - 1)]);
+        }
+      }
+      break;
+    }
+    case Distribution::Zipf: {
+      for (size_t i = 0; i < n; i++) out[i] = (T)zipf(gen);
+      break;
+    }
+    case Distribution::ManyDuplicates: {
+      std::uniform_int_distribution<size_t> value(0, kDuplicateValues - 1);
+      for (size_t i = 0; i < n; i++) out[i] = (T)value(gen);
+      break;
+    }
+  }
+}
+
+// Функция поиска спуска (cmp(p[i + 1], p[i])) в блоке из kCheckBlock + 1 записей.
+// Без ветвлений и с постоянным числом итераций цикл векторизуется компилятором.
+constexpr size_t kCheckBlock = 256;
+
+template <typename T, typename Compare>
+inline bool blockHasDescent(const T* p, Compare cmp) {
+  unsigned char bad = 0;
+  for (size_t i = 0; i < kCheckBlock; i++) bad |= (unsigned char)cmp(p[i + 1], p[i]);
+  return bad != 0;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// Тот же цикл в варианте AVX2 (сравнение 64-битных целых в SSE2 нет); выбирается в рантайме
+template <typename T, typename Compare>
+__attribute__((target("avx2"))) bool blockHasDescentAvx2(const T* p, Compare cmp) {
+  return blockHasDescent(p, cmp);
+}
+#endif
+
+// Функция поиска первого нарушения порядка в p[0..n): индекс i, где cmp(p[i], p[i - 1]), или n
+template <typename T, typename Compare>
+size_t findDescent(const T* p, size_t n, Compare cmp) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+  size_t i = 0;
+  for (; i + kCheckBlock < n; i += kCheckBlock) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    bool bad = avx2 ? blockHasDescentAvx2(p + i, cmp) : blockHasDescent(p + i, cmp);
+#else
+    bool bad = blockHasDescent(p + i, cmp);
+#endif
+    if (bad) break;
+  }
+  for (i = std::max(i, (size_t)1); i < n; i++) {
+    if (cmp(p[i], p[i - 1])) return i;
+  }
+  return n;
+}
+
+}  // namespace detail
+
+// Функция генерации файла из count записей типа T. Потоки берут блоки по 1M записей
+// по очереди и пишут их на свои места; в памяти - по блоку на поток.
+template <typename T>
+void generateData(const std::string &filename, size_t count, const GenOptions &opts) {
+  FileHandle fd(open(filename.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+  if (!fd) throwErrno("Cannot open file for writing: " + filename);
+  if (ftruncate(fd.Get(), count * sizeof(T)) != 0) throwErrno("ftruncate " + filename);
+
+  FileIO io(fd.Get());
+  size_t blocks = std::max((count + detail::kGenBlock - 1) / detail::kGenBlock, (size_t)1);
+  std::atomic<size_t> nextBlock{0};
+  std::vector<std::function<void()>> tasks;
+  for (size_t t = 0; t < std::min(std::max(opts.threads, (size_t)1), blocks); t++) {
+    tasks.emplace_back([&] {
+      std::vector<T> buf(std::min(detail::kGenBlock, count));
+      detail::ZipfSampler zipf(detail::kZipfRanks);
+      for (size_t b = nextBlock++; b < blocks; b = nextBlock++) {
+        size_t off = b * detail::kGenBlock;
+        size_t n = std::min(detail::kGenBlock, count - off);
+        std::seed_seq seq{(uint32_t)opts.seed, (uint32_t)(opts.seed >> 32), (uint32_t)b, (uint32_t)(b >> 32)};
+        std::mt19937_64 gen(seq);
+        detail::fillBlock(buf.data(), n, b, blocks, opts.dist, gen, zipf);
+        io.Write(off * sizeof(T), buf.data(), n * sizeof(T));
+      }
+    });
+  }
+  runInThreads(tasks);
+}
+
+// Функция проверки сортировки файла из total записей типа T: индекс первой записи,
+// нарушающей порядок (cmp(p[i], p[i - 1])), или total. Потоки берут окна mmap по
+// порядку; окна за уже найденным нарушением не читаются.
+template <typename T, typename Compare>
+size_t findUnsorted(int fd, size_t total, Compare cmp, size_t threads, size_t windowBytes = 32 << 20) {
+  size_t windowElems = std::max(windowBytes / sizeof(T), detail::kCheckBlock);
+  size_t windows = (total + windowElems - 1) / windowElems;
+  std::atomic<size_t> nextWindow{0};
+  std::atomic<size_t> first{total};
+
+  std::vector<std::function<void()>> tasks;
+  for (size_t t = 0; t < std::min(std::max(threads, (size_t)1), windows); t++) {
+    tasks.emplace_back([&] {
+      for (size_t w = nextWindow++; w < windows; w = nextWindow++) {
+        size_t begin = w * windowElems;
+        if (begin >= first.load(std::memory_order_relaxed)) break;
+        // Окно захватывает последнюю запись предыдущего, чтобы проверить стык
+        size_t from = begin ? begin - 1 : 0;
+        size_t end = std::min(total, begin + windowElems);
+        Mapping m(from * sizeof(T), (end - from) * sizeof(T), PROT_READ, fd, "findUnsorted: mmap failed");
+        size_t pos = detail::findDescent(m.As<const T>(), end - from, cmp);
+        if (pos == end - from) continue;
+        size_t found = from + pos;
+        size_t cur = first.load();
+        while (found < cur && !first.compare_exchange_weak(cur, found)) {
+        }
+      }
+    });
+  }
+  runInThreads(tasks);
+  return first.load();
+}
+
+}  // namespace extsort
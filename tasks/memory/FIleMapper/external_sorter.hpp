@@ -0,0 +1,2672 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <span>
+#include <iterator>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/xattr.h>
+#endif
+
+#include "io_counters.hpp"
+#include "run_codec.hpp"
+
+namespace extsort {
+
+// Функция выброса исключения с текущим errno
+[[noreturn]] inline void throwErrno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Функция для получения размера файла
+inline size_t getFileSize(const std::string &filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {  // Получаем информацию о файле
+    throwErrno("stat " + filename);
+  }
+  return (size_t)st.st_size;  // Возвращаем размер файла в байтах
+}
+
+// Снимок времени, page fault (getrusage) и счетчиков ввода-вывода (IoCounters) процесса
+struct ResourceUsage {
+  std::chrono::steady_clock::time_point time;
+  double cpuSec = 0;     // user + system всех потоков процесса
+  long minorFaults = 0;  // Без обращения к диску (страница уже в памяти)
+  long majorFaults = 0;  // С чтением с диска
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t mmapCalls = 0;
+  uint64_t munmapCalls = 0;
+
+  static ResourceUsage Now() {
+    ResourceUsage u;
+    u.time = std::chrono::steady_clock::now();
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+      u.cpuSec = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+      u.minorFaults = ru.ru_minflt;
+      u.majorFaults = ru.ru_majflt;
+    }
+    const IoCounters &io = ioCounters();
+    u.bytesRead = io.bytesRead.load(std::memory_order_relaxed);
+    u.bytesWritten = io.bytesWritten.load(std::memory_order_relaxed);
+    u.mmapCalls = io.mmapCalls.load(std::memory_order_relaxed);
+    u.munmapCalls = io.munmapCalls.load(std::memory_order_relaxed);
+    return u;
+  }
+
+  double SecondsSince(const ResourceUsage &start) const {
+    return std::chrono::duration<double>(time - start.time).count();
+  }
+};
+
+// Владеющий файловый дескриптор: закрывается в деструкторе
+class FileHandle {
+ public:
+  FileHandle() = default;
+  explicit FileHandle(int fd) : fd_(fd) {}
+  ~FileHandle() { Reset(); }
+
+  FileHandle(FileHandle &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+  FileHandle& operator=(FileHandle &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+  }
+  FileHandle(const FileHandle&) = delete;
+  FileHandle& operator=(const FileHandle&) = delete;
+
+  int Get() const { return fd_; }
+  explicit operator bool() const { return fd_ >= 0; }
+
+  void Reset() {
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Структура для хранения информации о mmap-области
+struct MappedRegion {
+  void* ptr;          // Указатель на начало данных
+  size_t mappingSize; // Полный размер отображения (включая выравнивание)
+  void* mmappedAddr;  // Адрес, возвращенный mmap (до выравнивания)
+};
+
+// Размер огромной страницы (THP на x86-64 и arm64 с 4K страницами)
+constexpr size_t kHugePageSize = 2UL << 20;
+
+// Функция для создания выровненного mmap отображения (align - 0 или степень двойки,
+// кратная странице; 0 - выравнивание на страницу)
+inline MappedRegion mmapWithPageAlign(size_t offsetInFile, size_t mapSizeBytes,
+                                      int protFlags, int mapFlags, int fd, size_t align = 0) {
+  MappedRegion result;
+  result.ptr = nullptr;
+  result.mappingSize = 0;
+  result.mmappedAddr = nullptr;
+
+  if (mapSizeBytes == 0) return result;  // Нулевой размер - ничего не делаем
+
+  // Получаем размер страницы памяти
+  long ps = sysconf(_SC_PAGE_SIZE);
+  if (ps < 1) ps = 4096;  // Если не удалось получить, используем 4K по умолчанию
+  if (align > (size_t)ps) ps = (long)align;
+
+  // Вычисляем выровненное смещение
+  off_t alignOffset = (offsetInFile / ps) * ps;
+  size_t diff = offsetInFile - alignOffset;  // Разница между реальным и выровненным смещением
+  size_t fullSize = mapSizeBytes + diff;    // Полный размер с учетом выравнивания
+
+  // Создаем mmap отображение
+  void* addr = mmap(nullptr, fullSize, protFlags, mapFlags, fd, alignOffset);
+  if (addr == MAP_FAILED) return result;  // В случае ошибки
+  countMmap();
+
+  // Заполняем структуру результата
+  result.mmappedAddr = addr;
+  result.mappingSize = fullSize;
+  result.ptr = static_cast<char*>(addr) + diff;  // Корректируем указатель на реальные данные
+
+  return result;
+}
+
+// Подсказки ядру для окна Mapping
+enum MapHints : unsigned {
+  kMapDefault = 0,
+  kMapHuge = 1,      // Смещение выровнено на 2MB, окно помечено MADV_HUGEPAGE
+  kMapPopulate = 2,  // MAP_POPULATE: все страницы окна подгружаются в mmap, без fault на каждую
+};
+
+// Окно файла, отображенное через mmap (MAP_SHARED): освобождается в деструкторе.
+// При ошибке отображения выбрасывает std::system_error с текстом what.
+class Mapping {
+ public:
+  Mapping() = default;
+  Mapping(size_t offsetInFile, size_t mapSizeBytes, int protFlags, int fd, const char* what,
+          unsigned hints = kMapDefault)
+      : region_(mmapWithPageAlign(offsetInFile, mapSizeBytes, protFlags, MAP_SHARED | populateFlag(hints), fd,
+                                  (hints & kMapHuge) ? kHugePageSize : 0)) {
+    if (mapSizeBytes > 0 && !region_.ptr) throwErrno(what);
+    if (protFlags & PROT_WRITE) {
+      countWritten(mapSizeBytes);
+    } else {
+      countRead(mapSizeBytes);
+    }
+#ifdef MADV_HUGEPAGE
+    // Огромные страницы в page cache поддерживают не все файловые системы (tmpfs - да);
+    // там, где нет, подсказка просто не действует
+    if ((hints & kMapHuge) && region_.mmappedAddr) madvise(region_.mmappedAddr, region_.mappingSize, MADV_HUGEPAGE);
+#endif
+  }
+  ~Mapping() { Reset(); }
+
+  Mapping(Mapping &&other) noexcept : region_(std::exchange(other.region_, MappedRegion{nullptr, 0, nullptr})) {}
+  Mapping& operator=(Mapping &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      region_ = std::exchange(other.region_, MappedRegion{nullptr, 0, nullptr});
+    }
+    return *this;
+  }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  void* Data() const { return region_.ptr; }
+
+  template <typename T>
+  T* As() const {
+    return static_cast<T*>(region_.ptr);
+  }
+
+  void Reset() {
+    if (region_.mmappedAddr && region_.mappingSize > 0) {
+      munmap(region_.mmappedAddr, region_.mappingSize);
+      countMunmap();
+    }
+    region_ = MappedRegion{nullptr, 0, nullptr};
+  }
+
+ private:
+  static int populateFlag(unsigned hints) {
+#ifdef MAP_POPULATE
+    return (hints & kMapPopulate) ? MAP_POPULATE : 0;
+#else
+    (void)hints;
+    return 0;
+#endif
+  }
+
+  MappedRegion region_{nullptr, 0, nullptr};
+};
+
+// Анонимный буфер для временных данных (MAP_PRIVATE|MAP_ANONYMOUS): освобождается
+// в деструкторе. Память не инициализируется - только для тривиально копируемых T.
+// С huge буфер выравнивается на 2MB и помечается MADV_HUGEPAGE, чтобы ядро отдало его
+// прозрачными огромными страницами (в 512 раз меньше записей TLB и page fault), затем
+// страницы заполняются заранее (MADV_POPULATE_WRITE, если ядро это умеет).
+template <typename T>
+class ScratchBuffer {
+  static_assert(std::is_trivially_copyable_v<T>, "ScratchBuffer holds raw records");
+
+ public:
+  ScratchBuffer() = default;
+  ScratchBuffer(size_t count, bool huge) : size_(count) {
+    if (count == 0) return;
+    size_t bytes = count * sizeof(T);
+    size_t full = huge ? (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize + kHugePageSize : bytes;
+    void* addr = mmap(nullptr, full, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) throwErrno("mmap scratch buffer");
+    countMmap();
+    addr_ = static_cast<char*>(addr);
+    bytes_ = full;
+    if (!huge) return;
+
+    // Отрезаем невыровненные голову и хвост
+    char* aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(addr_) + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+    size_t keep = full - kHugePageSize;
+    if (aligned > addr_) {
+      munmap(addr_, aligned - addr_);
+      countMunmap();
+    }
+    if (addr_ + full > aligned + keep) {
+      munmap(aligned + keep, addr_ + full - (aligned + keep));
+      countMunmap();
+    }
+    addr_ = aligned;
+    bytes_ = keep;
+#ifdef MADV_HUGEPAGE
+    madvise(addr_, bytes_, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+    madvise(addr_, bytes_, MADV_POPULATE_WRITE);
+#endif
+  }
+  ~ScratchBuffer() { Reset(); }
+
+  ScratchBuffer(ScratchBuffer &&other) noexcept
+      : addr_(std::exchange(other.addr_, nullptr)), bytes_(std::exchange(other.bytes_, 0)),
+        size_(std::exchange(other.size_, 0)) {}
+  ScratchBuffer& operator=(ScratchBuffer &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      addr_ = std::exchange(other.addr_, nullptr);
+      bytes_ = std::exchange(other.bytes_, 0);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+  ScratchBuffer(const ScratchBuffer&) = delete;
+  ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+
+  T* data() const { return reinterpret_cast<T*>(addr_); }
+  size_t size() const { return size_; }
+  T* begin() const { return data(); }
+  T* end() const { return data() + size_; }
+  T& operator[](size_t i) const { return data()[i]; }
+
+  void Reset() {
+    if (addr_) {
+      munmap(addr_, bytes_);
+      countMunmap();
+    }
+    addr_ = nullptr;
+    bytes_ = 0;
+    size_ = 0;
+  }
+
+ private:
+  char* addr_ = nullptr;
+  size_t bytes_ = 0;  // Размер отображения
+  size_t size_ = 0;   // Число элементов
+};
+
+// Способ переноса данных сортировки между файлом и памятью
+enum class IoMode {
+  Mmap,    // Окна mmap через page cache (по умолчанию)
+  Direct,  // O_DIRECT (F_NOCACHE на macOS) с выровненными буферами, мимо page cache
+};
+
+// Ввод-вывод данных одного файла по байтовому смещению (дескрипторами не владеет).
+// Mmap: окно отображается и копируется memcpy. Direct: выровненная по kAlign середина
+// диапазона идет через второй дескриптор с O_DIRECT (openDirect) (через буфер потока, если адрес
+// в памяти не выровнен), неполные блоки на краях - обычным pread/pwrite: у разных
+// писателей общими могут быть только такие блоки, а ядро само сбрасывает page cache
+// диапазона перед прямым чтением или записью.
+class FileIO {
+ public:
+  static constexpr size_t kAlign = 4096;             // Выравнивание O_DIRECT (смещение, длина, адрес)
+  static constexpr size_t kBounceBytes = 1UL << 20;  // Буфер потока для невыровненной памяти
+
+  FileIO() = default;
+  explicit FileIO(int fd, int directFd = -1) : fd_(fd), direct_(directFd) {}
+
+  int Fd() const { return fd_; }
+  bool Direct() const { return direct_ >= 0; }
+
+  // Функция чтения bytes байт со смещения offset в dst
+  void Read(size_t offset, void* dst, size_t bytes) const {
+    if (bytes == 0) return;
+    if (!Direct()) {
+      Mapping m(offset, bytes, PROT_READ, fd_, "FileIO: read mmap failed");
+      std::memcpy(dst, m.Data(), bytes);
+      return;
+    }
+
+    char* out = static_cast<char*>(dst);
+    size_t head = std::min(bytes, alignUp(offset) - offset);
+    size_t tail = (bytes - head) % kAlign;
+    preadAll(fd_, out, head, offset);
+    directRead(offset + head, out + head, bytes - head - tail);
+    preadAll(fd_, out + bytes - tail, tail, offset + bytes - tail);
+  }
+
+  // Функция записи bytes байт из src по смещению offset
+  void Write(size_t offset, const void* src, size_t bytes) const {
+    if (bytes == 0) return;
+    if (!Direct()) {
+      Mapping m(offset, bytes, PROT_READ|PROT_WRITE, fd_, "FileIO: write mmap failed");
+      std::memcpy(m.Data(), src, bytes);
+      return;
+    }
+
+    const char* in = static_cast<const char*>(src);
+    size_t head = std::min(bytes, alignUp(offset) - offset);
+    size_t tail = (bytes - head) % kAlign;
+    pwriteAll(fd_, in, head, offset);
+    directWrite(offset + head, in + head, bytes - head - tail);
+    pwriteAll(fd_, in + bytes - tail, tail, offset + bytes - tail);
+  }
+
+  // Функция копирования bytes байт из in в out кусками не больше stepBytes
+  static void Copy(const FileIO &in, size_t inOffset, const FileIO &out, size_t outOffset, size_t bytes,
+                   size_t stepBytes) {
+    if (!in.Direct() && !out.Direct()) {
+      // Оба файла через mmap - копируем из окна в окно без промежуточного буфера
+      for (size_t done = 0; done < bytes;) {
+        size_t s = std::min(bytes - done, stepBytes);
+        Mapping inMap(inOffset + done, s, PROT_READ, in.fd_, "FileIO: copy mmap in failed");
+        Mapping outMap(outOffset + done, s, PROT_READ|PROT_WRITE, out.fd_, "FileIO: copy mmap out failed");
+        std::memcpy(outMap.Data(), inMap.Data(), s);
+        done += s;
+      }
+      return;
+    }
+
+    ScratchBuffer<char> buf(std::max(std::min(bytes, stepBytes), kAlign), false);
+    for (size_t done = 0; done < bytes;) {
+      size_t s = std::min(bytes - done, buf.size());
+      in.Read(inOffset + done, buf.data(), s);
+      out.Write(outOffset + done, buf.data(), s);
+      done += s;
+    }
+  }
+
+ private:
+  static size_t alignUp(size_t x) { return (x + kAlign - 1) / kAlign * kAlign; }
+  static bool aligned(const void* p) { return reinterpret_cast<uintptr_t>(p) % kAlign == 0; }
+
+  // Буфер потока для O_DIRECT, когда память вызывающего не выровнена
+  static char* bounce() {
+    thread_local ScratchBuffer<char> buf;
+    if (buf.size() == 0) buf = ScratchBuffer<char>(kBounceBytes, false);
+    return buf.data();
+  }
+
+  static void preadAll(int fd, char* dst, size_t bytes, size_t offset) {
+    while (bytes > 0) {
+      ssize_t rd = pread(fd, dst, bytes, offset);
+      if (rd < 0) throwErrno("FileIO: pread failed");
+      if (rd == 0) throw std::runtime_error("FileIO: unexpected end of file");
+      countRead(rd);
+      dst += rd;
+      offset += rd;
+      bytes -= rd;
+    }
+  }
+
+  static void pwriteAll(int fd, const char* src, size_t bytes, size_t offset) {
+    while (bytes > 0) {
+      ssize_t wr = pwrite(fd, src, bytes, offset);
+      if (wr < 0) throwErrno("FileIO: pwrite failed");
+      countWritten(wr);
+      src += wr;
+      offset += wr;
+      bytes -= wr;
+    }
+  }
+
+  // Выровненные offset и bytes; dst может быть не выровнен
+  void directRead(size_t offset, char* dst, size_t bytes) const {
+    if (aligned(dst)) {
+      preadAll(direct_, dst, bytes, offset);
+      return;
+    }
+    char* buf = bounce();
+    for (size_t done = 0; done < bytes;) {
+      size_t s = std::min(bytes - done, kBounceBytes);
+      preadAll(direct_, buf, s, offset + done);
+      std::memcpy(dst + done, buf, s);
+      done += s;
+    }
+  }
+
+  void directWrite(size_t offset, const char* src, size_t bytes) const {
+    if (aligned(src)) {
+      pwriteAll(direct_, src, bytes, offset);
+      return;
+    }
+    char* buf = bounce();
+    for (size_t done = 0; done < bytes;) {
+      size_t s = std::min(bytes - done, kBounceBytes);
+      std::memcpy(buf, src + done, s);
+      pwriteAll(direct_, buf, s, offset + done);
+      done += s;
+    }
+  }
+
+  int fd_ = -1;
+  int direct_ = -1;  // Дескриптор того же файла с O_DIRECT (-1 - ввод-вывод через mmap)
+};
+
+// Функция открытия второго дескриптора файла для FileIO в режиме IoMode::Direct
+inline FileHandle openDirect(const std::string &path) {
+#ifdef O_DIRECT
+  FileHandle fd(open(path.c_str(), O_RDWR|O_DIRECT));
+  if (!fd) throwErrno("open with O_DIRECT " + path);
+#else
+  FileHandle fd(open(path.c_str(), O_RDWR));
+  if (!fd) throwErrno("open " + path);
+#ifdef F_NOCACHE
+  if (fcntl(fd.Get(), F_NOCACHE, 1) != 0) throwErrno("fcntl F_NOCACHE " + path);
+#endif
+#endif
+  return fd;
+}
+
+// Структура для хранения информации о "ранне" (отсортированной последовательности)
+struct RunInfo {
+  size_t offset;  // Смещение в файле (в записях)
+  size_t length;  // Длина (в записях)
+};
+
+// Стратегия построения начальных раннов
+enum class RunStrategy {
+  Natural,      // Естественные ранны + сортировка чанков на месте (по умолчанию)
+  Chunk,        // Чанки размером с бюджет памяти, сортировка в памяти
+  Replacement,  // Выбор с замещением (ранны в среднем вдвое длиннее)
+};
+
+// Алгоритм сортировки файла
+enum class SortMethod {
+  Merge,         // Начальные ранны + проходы многопутевого слияния (по умолчанию)
+  Distribution,  // Sample sort: разделители по выборке, раскладка по корзинам, сортировка корзин
+  Indirect,      // Слияние пар (ключ, номер записи) и сборка записей по ним (для широких записей)
+};
+
+// Метрики одной фазы сортировки файла
+struct PhaseMetrics {
+  std::string name;     // sorted_check, run_generation, merge_pass, copy_back, partition, bucket_sort
+  size_t pass = 0;      // merge_pass: номер прохода (с 1)
+  size_t k = 0;         // merge_pass: наибольшее число раннов в группе
+  size_t runsIn = 0;    // Раннов на входе фазы
+  size_t runsOut = 0;   // Раннов на выходе фазы
+  std::string detail{};  // copy_back: способ переноса результата
+  double wallSec = 0;
+  double cpuSec = 0;
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t mmapCalls = 0;
+  uint64_t munmapCalls = 0;
+  long minorFaults = 0;
+  long majorFaults = 0;
+
+  // Функция заполнения счетчиков разностью снимков начала и конца фазы
+  void Measure(const ResourceUsage &start, const ResourceUsage &end) {
+    wallSec = end.SecondsSince(start);
+    cpuSec = end.cpuSec - start.cpuSec;
+    bytesRead = end.bytesRead - start.bytesRead;
+    bytesWritten = end.bytesWritten - start.bytesWritten;
+    mmapCalls = end.mmapCalls - start.mmapCalls;
+    munmapCalls = end.munmapCalls - start.munmapCalls;
+    minorFaults = end.minorFaults - start.minorFaults;
+    majorFaults = end.majorFaults - start.majorFaults;
+  }
+};
+
+// Метрики сортировки файла (SortOptions::metrics): параметры, итог и фазы по порядку.
+// Счетчики ввода-вывода общие для процесса - параллельные сортировки попадут друг к другу.
+struct SortMetrics {
+  std::string file;
+  size_t fileBytes = 0;
+  size_t records = 0;
+  size_t recordSize = 0;
+  size_t memoryBytes = 0;
+  size_t threads = 0;
+  std::string method;    // merge, distribute, merge_compressed, merge_resumable
+  std::string strategy;  // natural, chunk, replace
+  std::string io;        // mmap, direct
+  size_t maxK = 0;
+  size_t initialRuns = 0;
+  size_t mergePasses = 0;
+  bool alreadySorted = false;
+  PhaseMetrics total;
+  std::vector<PhaseMetrics> phases;
+
+  std::string ToJson() const;
+};
+
+namespace detail {
+
+inline std::string jsonString(const std::string &str) {
+  std::string out = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+inline void writePhaseJson(std::ostream &os, const PhaseMetrics &p, const char* indent) {
+  os << "{\"name\": " << jsonString(p.name);
+  if (p.pass) os << ", \"pass\": " << p.pass;
+  if (p.k) os << ", \"k\": " << p.k;
+  if (p.runsIn) os << ", \"runs_in\": " << p.runsIn;
+  if (p.runsOut) os << ", \"runs_out\": " << p.runsOut;
+  if (!p.detail.empty()) os << ", \"detail\": " << jsonString(p.detail);
+  os << ",\n" << indent << " \"wall_sec\": " << p.wallSec << ", \"cpu_sec\": " << p.cpuSec
+     << ", \"bytes_read\": " << p.bytesRead << ", \"bytes_written\": " << p.bytesWritten
+     << ",\n" << indent << " \"mmap_calls\": " << p.mmapCalls << ", \"munmap_calls\": " << p.munmapCalls
+     << ", \"minor_faults\": " << p.minorFaults << ", \"major_faults\": " << p.majorFaults << "}";
+}
+
+}  // namespace detail
+
+inline std::string SortMetrics::ToJson() const {
+  std::ostringstream os;
+  os << "{\n"
+     << "  \"file\": " << detail::jsonString(file) << ",\n"
+     << "  \"file_bytes\": " << fileBytes << ",\n"
+     << "  \"records\": " << records << ",\n"
+     << "  \"record_size\": " << recordSize << ",\n"
+     << "  \"memory_bytes\": " << memoryBytes << ",\n"
+     << "  \"threads\": " << threads << ",\n"
+     << "  \"method\": " << detail::jsonString(method) << ",\n"
+     << "  \"strategy\": " << detail::jsonString(strategy) << ",\n"
+     << "  \"io\": " << detail::jsonString(io) << ",\n"
+     << "  \"max_k\": " << maxK << ",\n"
+     << "  \"initial_runs\": " << initialRuns << ",\n"
+     << "  \"merge_passes\": " << mergePasses << ",\n"
+     << "  \"already_sorted\": " << (alreadySorted ? "true" : "false") << ",\n"
+     << "  \"total\": ";
+  detail::writePhaseJson(os, total, "  ");
+  os << ",\n  \"phases\": [";
+  for (size_t i = 0; i < phases.size(); i++) {
+    os << (i ? ",\n    " : "\n    ");
+    detail::writePhaseJson(os, phases[i], "    ");
+  }
+  os << (phases.empty() ? "]\n" : "\n  ]\n") << "}\n";
+  return os.str();
+}
+
+// Параметры сортировки
+struct SortOptions {
+  size_t memoryLimitMB = 0;                      // 0 - 1/10 размера файла (потоковый режим - 64MB)
+  RunStrategy strategy = RunStrategy::Natural;   // Построение начальных раннов
+  size_t threads = 1;                            // Потоки слияния
+  size_t parallelMergeMinElems = 1 << 20;        // Группа сливается параллельно от стольких записей на поток
+  std::ostream* log = nullptr;                   // Куда писать ход сортировки (nullptr - молча)
+  std::string tempDir;                           // Каталог раннов потокового режима ("" - $TMPDIR или /tmp)
+  bool compressRuns = false;                     // Сжатые ранны (run_codec.hpp): меньше места, медленнее
+  SortMethod method = SortMethod::Merge;         // Слияние или распределение по корзинам
+  bool resume = false;                           // Контрольные точки в манифесте; продолжить с сохраненной
+  std::function<void()> onCheckpoint;            // Вызывается после каждой записанной контрольной точки
+  bool hugePages = false;                        // Чанки сортируются в буфере на огромных страницах (THP)
+  IoMode io = IoMode::Mmap;                      // Ввод-вывод раннов и слияния: mmap или O_DIRECT
+  SortMetrics* metrics = nullptr;                // Куда записать метрики SortFile (nullptr - не собирать)
+};
+
+// Результат сканирования естественного ранна
+struct NaturalRun {
+  size_t length;    // Длина (в записях)
+  bool descending;  // Строго убывающий ранн (нужно развернуть)
+};
+
+// Функция подсчета числа проходов слияния для runs раннов при k-путевом слиянии
+inline size_t countMergePasses(size_t runs, size_t maxK) {
+  size_t passes = 0;
+  while (runs > 1) {
+    runs = (runs + maxK - 1) / maxK;
+    passes++;
+  }
+  return passes;
+}
+
+// Функция выбора k для первого прохода: минимальное k, при котором число проходов
+// не растет. Остальные проходы идут с maxK, а первый получает буферы побольше.
+inline size_t firstPassFanIn(size_t runs, size_t maxK) {
+  size_t passes = countMergePasses(runs, maxK);
+  if (passes <= 1) return maxK;
+
+  size_t rest = 1;  // Сколько раннов могут слить оставшиеся passes - 1 проходов
+  for (size_t i = 0; i + 1 < passes; i++) rest *= maxK;
+  size_t k = (runs + rest - 1) / rest;
+  return std::max(k, (size_t)2);
+}
+
+// Функция для вычисления максимального количества путей слияния (k)
+inline size_t computeMaxK(size_t memB) {
+  const size_t minBuf = 16UL * 1024UL;  // Минимальный буфер на ранн - 16KB
+  if (memB < minBuf * 2) return 2;      // Если памяти мало - минимум 2
+
+  size_t g = (memB / (minBuf)) - 1;  // Вычисляем возможное k
+  if (g < 2) g = 2;
+  if (g > 1024) g = 1024;  // Ограничиваем максимальное k
+  return g;
+}
+
+// Способ, которым результат из временного файла попадает в исходный
+enum class FinishMethod {
+  Clone,          // FICLONE: общие экстенты, данные не копируются
+  Rename,         // rename() временного файла поверх исходного
+  CopyFileRange,  // copy_file_range: копирование внутри ядра
+  Copy,           // read/write через буфер в userspace
+};
+
+inline const char* finishMethodName(FinishMethod m) {
+  static const char* names[] = {"FICLONE", "rename", "copy_file_range", "read/write copy"};
+  return names[(int)m];
+}
+
+// Функция передачи временному файлу владельца, группы и прав исходного (st).
+// false - что-то передать не удалось (chown чужого файла без прав), rename тогда нельзя.
+inline bool copyOwnerAndMode(int fdTemp, const struct stat &st) {
+  struct stat tst;
+  if (fstat(fdTemp, &tst) != 0) return false;
+  if ((tst.st_uid != st.st_uid || tst.st_gid != st.st_gid) && fchown(fdTemp, st.st_uid, st.st_gid) != 0) {
+    return false;
+  }
+  // Права - после fchown: смена владельца сбрасывает биты setuid/setgid
+  return fchmod(fdTemp, st.st_mode & 07777) == 0;
+}
+
+// Функция проверки расширенных атрибутов файла (ACL, метки безопасности), которые rename потерял бы
+inline bool hasXattrs(int fd) {
+#ifdef __linux__
+  return flistxattr(fd, nullptr, 0) > 0;
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+// Функция переноса результата из временного файла в исходный без лишнего прохода по данным.
+// Пробует по очереди: FICLONE, rename(), copy_file_range, обычное копирование.
+inline FinishMethod finishFromTemp(int fd, int fdTemp, const std::string &filename,
+                                   const std::string &tempName, size_t fs) {
+#ifdef FICLONE
+  if (ioctl(fd, FICLONE, fdTemp) == 0) return FinishMethod::Clone;
+#endif
+
+  // rename заменяет inode, поэтому идет только для обычного файла с одной ссылкой без расширенных
+  // атрибутов и только если временный файл получил его владельца, группу и права; иначе - копия
+  struct stat st;
+  if (lstat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1 && !hasXattrs(fd) &&
+      copyOwnerAndMode(fdTemp, st)) {
+    if (rename(tempName.c_str(), filename.c_str()) == 0) return FinishMethod::Rename;
+  }
+
+  size_t left = fs;
+#ifdef __linux__
+  {
+    off_t inOff = 0, outOff = 0;
+    while (left > 0) {
+      ssize_t n = copy_file_range(fdTemp, &inOff, fd, &outOff, left, 0);
+      if (n <= 0) break;
+      countRead(n);
+      countWritten(n);
+      left -= n;
+    }
+    if (left == 0) return FinishMethod::CopyFileRange;
+  }
+#endif
+
+  // Запасной вариант - копируем оставшиеся данные блоками
+  const size_t BUFSZ = 1 << 20;  // 1MB буфер
+  std::vector<char> buf(BUFSZ);
+  size_t pos = fs - left;
+  while (left > 0) {
+    size_t s = (left < BUFSZ ? left : BUFSZ);
+    ssize_t rd = pread(fdTemp, buf.data(), s, pos);
+    if (rd < 0) throwErrno("read temp file for final copy");
+    if (rd == 0) break;
+    countRead(rd);
+
+    ssize_t wr = pwrite(fd, buf.data(), rd, pos);
+    if (wr < 0) throwErrno("write final result to " + filename);
+    countWritten(wr);
+
+    pos += wr;
+    left -= wr;
+  }
+  return FinishMethod::Copy;
+}
+
+// Контрольная точка сортировки файла (SortOptions::resume).
+// Хранится в текстовом манифесте рядом с временным файлом и обновляется атомарно:
+// запись во временный файл манифеста, fsync, rename поверх старого, fsync каталога.
+// Данные, на которые ссылается манифест, синхронизируются до его записи.
+struct SortCheckpoint {
+  size_t fileSize = 0;     // Размер сортируемого файла (в байтах)
+  size_t recordSize = 0;   // Размер записи
+  size_t memBytes = 0;     // Бюджет памяти, с которым строились ранны и группы
+  size_t maxK = 0;         // Наибольшее k слияния
+  bool mergePhase = false; // false - построение раннов, true - проходы слияния
+  size_t pass = 0;         // Число завершенных проходов слияния
+  size_t passK = 0;        // k текущего прохода
+  bool runsInTemp = true;  // Текущие ранны лежат во временном файле (иначе - в исходном)
+  std::vector<RunInfo> runs;  // Построенные ранны / вход текущего прохода
+  std::vector<RunInfo> done;  // Выход текущего прохода: уже слитые группы
+};
+
+namespace detail {
+
+inline void writeRuns(std::ostream &os, const char* name, const std::vector<RunInfo> &runs) {
+  os << name << " " << runs.size() << "\n";
+  for (auto &r : runs) os << r.offset << " " << r.length << "\n";
+}
+
+inline void readRuns(std::istream &is, const char* name, std::vector<RunInfo> &runs) {
+  std::string key;
+  size_t count = 0;
+  if (!(is >> key >> count) || key != name) throw std::runtime_error("corrupt sort manifest: expected " + std::string(name));
+  runs.resize(count);
+  for (auto &r : runs) {
+    if (!(is >> r.offset >> r.length)) throw std::runtime_error("corrupt sort manifest: truncated run list");
+  }
+}
+
+// Функция fsync каталога, в котором лежит path (чтобы rename пережил сбой)
+inline void syncParentDir(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+  int dfd = open(dir.c_str(), O_RDONLY);
+  if (dfd < 0) return;
+  fsync(dfd);
+  close(dfd);
+}
+
+}  // namespace detail
+
+// Функция атомарной записи манифеста
+inline void saveCheckpoint(const std::string &path, const SortCheckpoint &cp) {
+  std::ostringstream os;
+  os << "extsort-manifest 1\n"
+     << "size " << cp.fileSize << "\n"
+     << "record " << cp.recordSize << "\n"
+     << "memory " << cp.memBytes << "\n"
+     << "maxk " << cp.maxK << "\n"
+     << "phase " << (cp.mergePhase ? "merge" : "runs") << "\n"
+     << "pass " << cp.pass << "\n"
+     << "passk " << cp.passK << "\n"
+     << "in " << (cp.runsInTemp ? "temp" : "original") << "\n";
+  detail::writeRuns(os, "runs", cp.runs);
+  detail::writeRuns(os, "done", cp.done);
+  os << "end\n";
+  const std::string text = os.str();
+
+  std::string tmp = path + ".new";
+  int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  if (fd < 0) throwErrno("open " + tmp);
+  size_t off = 0;
+  while (off < text.size()) {
+    ssize_t wr = write(fd, text.data() + off, text.size() - off);
+    if (wr < 0) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), "write " + tmp);
+    }
+    off += wr;
+  }
+  if (fsync(fd) != 0) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), "fsync " + tmp);
+  }
+  close(fd);
+
+  if (rename(tmp.c_str(), path.c_str()) != 0) throwErrno("rename " + tmp);
+  detail::syncParentDir(path);
+}
+
+// Функция чтения манифеста: false - манифеста нет, при повреждении - исключение
+inline bool loadCheckpoint(const std::string &path, SortCheckpoint &cp) {
+  std::ifstream is(path);
+  if (!is) return false;
+
+  auto expect = [&](const char* name, auto &value) {
+    std::string key;
+    if (!(is >> key >> value) || key != name) throw std::runtime_error("corrupt sort manifest: expected " + std::string(name));
+  };
+
+  std::string magic, phase, in, end;
+  int version = 0;
+  if (!(is >> magic >> version) || magic != "extsort-manifest" || version != 1) {
+    throw std::runtime_error("unsupported sort manifest " + path);
+  }
+  expect("size", cp.fileSize);
+  expect("record", cp.recordSize);
+  expect("memory", cp.memBytes);
+  expect("maxk", cp.maxK);
+  expect("phase", phase);
+  expect("pass", cp.pass);
+  expect("passk", cp.passK);
+  expect("in", in);
+  detail::readRuns(is, "runs", cp.runs);
+  detail::readRuns(is, "done", cp.done);
+  if (!(is >> end) || end != "end" || (phase != "runs" && phase != "merge") || (in != "temp" && in != "original")) {
+    throw std::runtime_error("corrupt sort manifest " + path);
+  }
+  cp.mergePhase = phase == "merge";
+  cp.runsInTemp = in == "temp";
+  return true;
+}
+
+// Функция создания безымянного файла для раннов потоковой сортировки.
+// Файл удаляется из каталога сразу после создания и исчезает вместе с дескриптором.
+inline FileHandle openSpillFile(const std::string &dir) {
+  std::string base = dir;
+  if (base.empty()) {
+    const char* tmp = getenv("TMPDIR");
+    base = tmp && *tmp ? tmp : "/tmp";
+  }
+  std::string path = base + "/extsort.XXXXXX";
+  int fd = mkstemp(path.data());
+  if (fd < 0) throwErrno("create spill file in " + base);
+  unlink(path.c_str());
+  return FileHandle(fd);
+}
+
+// Функция запуска задач в отдельных потоках. Исключение любой из задач
+// пробрасывается вызывающему после завершения всех потоков.
+inline void runInThreads(std::vector<std::function<void()>> &tasks) {
+  std::vector<std::exception_ptr> errors(tasks.size());
+  std::vector<std::thread> workers;
+  workers.reserve(tasks.size());
+  for (size_t i = 0; i < tasks.size(); i++) {
+    workers.emplace_back([&, i] {
+      try {
+        tasks[i]();
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+  for (auto &e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+// Ключ по умолчанию - сама запись
+struct IdentityKey {
+  template <typename T>
+  const T& operator()(const T &record) const {
+    return record;
+  }
+};
+
+namespace detail {
+
+// Поразрядный ключ: беззнаковое число, порядок которого совпадает с порядком Compare.
+// Определен для арифметических ключей со стандартными компараторами.
+template <typename Key, typename Compare, typename = void>
+struct RadixTraits {
+  static constexpr bool enabled = false;
+};
+
+template <typename Compare, typename Key>
+constexpr bool isLess = std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>;
+
+template <typename Compare, typename Key>
+constexpr bool isGreater =
+    std::is_same_v<Compare, std::greater<Key>> || std::is_same_v<Compare, std::greater<>>;
+
+template <typename Key, typename Compare>
+struct RadixTraits<Key, Compare,
+                   std::enable_if_t<std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool> &&
+                                    (isLess<Compare, Key> || isGreater<Compare, Key>)>> {
+  static constexpr bool enabled = true;
+  using Bits = std::conditional_t<sizeof(Key) <= 1, uint8_t,
+               std::conditional_t<sizeof(Key) <= 2, uint16_t,
+               std::conditional_t<sizeof(Key) <= 4, uint32_t, uint64_t>>>;
+  static constexpr size_t kBytes = sizeof(Key);
+
+  static Bits toBits(Key key) {
+    Bits b = 0;
+    std::memcpy(&b, &key, sizeof(Key));
+    constexpr Bits sign = Bits(1) << (sizeof(Key) * 8 - 1);
+    if constexpr (std::is_floating_point_v<Key>) {
+      b = (b & sign) ? Bits(~b) : Bits(b | sign);  // IEEE 754: отрицательные в обратном порядке
+    } else if constexpr (std::is_signed_v<Key>) {
+      b ^= sign;
+    }
+    if constexpr (isGreater<Compare, Key>) b = Bits(~b);
+    return b;
+  }
+
+  // Обратное преобразование toBits
+  static Key fromBits(Bits b) {
+    if constexpr (isGreater<Compare, Key>) b = Bits(~b);
+    constexpr Bits sign = Bits(1) << (sizeof(Key) * 8 - 1);
+    if constexpr (std::is_floating_point_v<Key>) {
+      b = (b & sign) ? Bits(b ^ sign) : Bits(~b);
+    } else if constexpr (std::is_signed_v<Key>) {
+      b ^= sign;
+    }
+    Key key;
+    std::memcpy(&key, &b, sizeof(Key));
+    return key;
+  }
+};
+
+// Пара косвенной сортировки (SortMethod::Indirect): ключ записи и ее номер в файле
+template <typename Key>
+struct IndexEntry {
+  Key key;
+  uint64_t index;
+};
+
+struct IndexKey {
+  template <typename Key>
+  const Key& operator()(const IndexEntry<Key> &e) const {
+    return e.key;
+  }
+};
+
+}  // namespace detail
+
+// Внешняя сортировка записей фиксированного размера.
+// Record - тривиально копируемая запись, KeyExtractor выделяет из нее ключ,
+// Compare сравнивает ключи. Сортировка в памяти выбирается на этапе компиляции:
+// для арифметических ключей со стандартными компараторами - поразрядная (MSD radix,
+// на месте), для остальных - std::sort с компаратором.
+//
+// Два режима работы:
+//  - SortFile(filename) - сортировка файла на месте;
+//  - Push(records)... Finish() - потоковая сортировка: записи копятся в памяти,
+//    при переполнении бюджета уходят раннами во временный файл, Finish() отдает
+//    отсортированный поток (SortedStream) или передает его пачками в sink.
+// Ошибки ввода-вывода выбрасываются как std::system_error, ошибки формата -
+// как std::runtime_error.
+template <typename Record, typename KeyExtractor = IdentityKey, typename Compare = std::less<>>
+class ExternalSorter {
+  static_assert(std::is_trivially_copyable_v<Record>, "Record must be trivially copyable");
+
+  // Сравнение записей по ключу (копируется в курсоры слияния)
+  struct RecordLess {
+    KeyExtractor key;
+    Compare cmp;
+
+    bool operator()(const Record &a, const Record &b) const {
+      return cmp(key(a), key(b));
+    }
+  };
+
+  // Источник записей ранна в несжатом файле: чтение через FileIO (окна mmap или O_DIRECT)
+  struct PlainRunSource {
+    FileIO io;
+    size_t offset;  // Следующая запись ранна (в записях)
+    size_t left;    // Сколько записей осталось
+
+    size_t Remaining() const { return left; }
+
+    size_t Fill(Record* out, size_t maxCount) {
+      size_t n = std::min(maxCount, left);
+      if (n == 0) return 0;
+      io.Read(offset * kRecordSize, out, n * kRecordSize);
+      offset += n;
+      left -= n;
+      return n;
+    }
+  };
+
+  template <typename Source>
+  class MergeCursor;
+
+ public:
+  using Key = std::decay_t<std::invoke_result_t<KeyExtractor, const Record&>>;
+  static constexpr size_t kRecordSize = sizeof(Record);
+  static constexpr bool kRadix = detail::RadixTraits<Key, Compare>::enabled;
+  // Ранны можно сжимать: запись - само арифметическое значение со стандартным порядком
+  static constexpr bool kCompressible =
+      kRadix && std::is_same_v<Key, Record> && std::is_same_v<KeyExtractor, IdentityKey>;
+
+  // Бюджет памяти потокового режима, если memoryLimitMB не задан
+  static constexpr size_t kDefaultStreamMemMB = 64;
+
+  // Отсортированный поток записей, возвращаемый Finish().
+  // Владеет временными файлами раннов; от сортировщика не зависит.
+  class SortedStream {
+   public:
+    // Входной итератор по оставшимся записям (for (const Record &r : stream))
+    class Iterator {
+     public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = Record;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const Record*;
+      using reference = const Record&;
+
+      Iterator() = default;
+      explicit Iterator(SortedStream* stream) : stream_(stream) { ++*this; }
+
+      const Record& operator*() const { return value_; }
+      const Record* operator->() const { return &value_; }
+
+      Iterator& operator++() {
+        if (!stream_->Next(value_)) stream_ = nullptr;
+        return *this;
+      }
+      void operator++(int) { ++*this; }
+
+      bool operator==(const Iterator &other) const { return stream_ == other.stream_; }
+      bool operator!=(const Iterator &other) const { return stream_ != other.stream_; }
+
+     private:
+      SortedStream* stream_ = nullptr;
+      Record value_{};
+    };
+
+    SortedStream() = default;
+    SortedStream(SortedStream&&) = default;
+    SortedStream& operator=(SortedStream&&) = default;
+
+    // Чтение следующей записи; false - записи закончились
+    bool Next(Record &out) {
+      if (pos_ == view_.size() && !fill()) return false;
+      out = view_[pos_++];
+      return true;
+    }
+
+    // Чтение до out.size() записей; возвращает число прочитанных (0 - конец)
+    size_t Read(std::span<Record> out) {
+      size_t n = 0;
+      while (n < out.size()) {
+        std::span<const Record> part = NextBatch(out.size() - n);
+        if (part.empty()) break;
+        std::copy(part.begin(), part.end(), out.begin() + n);
+        n += part.size();
+      }
+      return n;
+    }
+
+    // Следующая пачка не длиннее maxCount записей без копирования;
+    // действительна до следующего обращения к потоку. Пустая - конец.
+    std::span<const Record> NextBatch(size_t maxCount = SIZE_MAX) {
+      if (pos_ == view_.size() && !fill()) return {};
+      size_t take = std::min(maxCount, view_.size() - pos_);
+      std::span<const Record> part = view_.subspan(pos_, take);
+      pos_ += take;
+      return part;
+    }
+
+    Iterator begin() { return Iterator(this); }
+    Iterator end() { return Iterator(); }
+
+   private:
+    friend class ExternalSorter;
+
+    // Пачка следующих записей от курсора слияния
+    bool fill() {
+      if (!cursor_) return false;
+      if (batch_.empty()) batch_.resize(std::max((1UL << 20) / kRecordSize, (size_t)1));
+      size_t n = cursor_->Read(batch_.data(), batch_.size());
+      view_ = std::span<const Record>(batch_.data(), n);
+      pos_ = 0;
+      return n > 0;
+    }
+
+    std::vector<Record> memory_;           // Все записи поместились в память
+    FileHandle files_[2];                  // Файлы раннов (второй - для промежуточных проходов)
+    std::unique_ptr<MergeCursor<PlainRunSource>> cursor_;  // Финальное слияние раннов
+    std::vector<Record> batch_;            // Буфер выхода курсора
+    std::span<const Record> view_;         // Текущая пачка (memory_ или batch_)
+    size_t pos_ = 0;                       // Позиция в текущей пачке
+  };
+
+  explicit ExternalSorter(SortOptions opts = SortOptions(), KeyExtractor key = KeyExtractor(),
+                          Compare cmp = Compare())
+      : opts_(std::move(opts)), less_{std::move(key), std::move(cmp)} {}
+
+  // Сравнение записей по ключу
+  bool Less(const Record &a, const Record &b) const {
+    return less_(a, b);
+  }
+
+  // Сортировка записей в памяти
+  void SortInMemory(Record* first, Record* last) const {
+    if constexpr (kRadix) {
+      radixSort(first, last, detail::RadixTraits<Key, Compare>::kBytes);
+    } else {
+      std::sort(first, last, less_);
+    }
+  }
+
+  // Основная функция внешней сортировки файла на месте
+  void SortFile(const std::string &filename) const {
+    ResourceUsage start = ResourceUsage::Now();
+    if (opts_.metrics) {
+      *opts_.metrics = SortMetrics();
+      opts_.metrics->file = filename;
+    }
+    sortFile(filename);
+    if (SortMetrics* m = opts_.metrics) {
+      m->total.name = "total";
+      m->total.Measure(start, ResourceUsage::Now());
+      for (auto &p : m->phases) {
+        if (p.name == "run_generation") m->initialRuns += p.runsOut;
+        if (p.name == "merge_pass") m->mergePasses++;
+      }
+    }
+  }
+
+  // Функция добавления записей в потоковую сортировку. Когда накопленные записи
+  // заполняют бюджет памяти, они сортируются и уходят ранном во временный файл.
+  void Push(std::span<const Record> records) {
+    if (bufferCap_ == 0) {
+      bufferCap_ = std::max(streamMemBytes() / kRecordSize, (size_t)1);
+      buffer_.reserve(bufferCap_);
+    }
+
+    while (!records.empty()) {
+      if (buffer_.size() == bufferCap_) spillBuffer();
+      size_t take = std::min(records.size(), bufferCap_ - buffer_.size());
+      buffer_.insert(buffer_.end(), records.begin(), records.begin() + take);
+      records = records.subspan(take);
+    }
+  }
+
+  // Функция завершения потоковой сортировки: возвращает отсортированный поток.
+  // Если все записи поместились в память, временные файлы не создаются. Иначе ранны
+  // сливаются проходами, пока их не станет не больше maxK, а последнее слияние
+  // выполняется лениво при чтении потока. После вызова сортировщик готов к новому вводу.
+  SortedStream Finish();
+
+  // Вариант Finish(), передающий результат пачками в sink(std::span<const Record>)
+  template <typename Sink>
+  void Finish(Sink &&sink) {
+    SortedStream stream = Finish();
+    for (auto part = stream.NextBatch(); !part.empty(); part = stream.NextBatch()) sink(part);
+  }
+
+ private:
+  using Traits = detail::RadixTraits<Key, Compare>;
+
+  // Тело SortFile (SortFile добавляет к нему итог метрик)
+  void sortFile(const std::string &filename) const;
+
+  // Функция вывода хода сортировки в opts_.log
+  template <typename... Args>
+  void log(const Args&... args) const {
+    if (opts_.log) (*opts_.log << ... << args);
+  }
+
+  // Функция завершения фазы, начавшейся в start: время и page fault - в лог, все
+  // счетчики - в opts_.metrics. Возвращает снимок конца фазы (начало следующей).
+  ResourceUsage endPhase(PhaseMetrics phase, const ResourceUsage &start) const {
+    ResourceUsage now = ResourceUsage::Now();
+    phase.Measure(start, now);
+    log("Phase ", phase.name, phase.pass ? " " + std::to_string(phase.pass) : std::string(), ": ", phase.wallSec,
+        " s wall, ", phase.cpuSec, " s CPU, page faults: ", phase.minorFaults, " minor, ", phase.majorFaults,
+        " major\n");
+    if (opts_.metrics) opts_.metrics->phases.push_back(std::move(phase));
+    return now;
+  }
+
+  // Бюджет памяти потокового режима в байтах
+  size_t streamMemBytes() const {
+    size_t mb = opts_.memoryLimitMB ? opts_.memoryLimitMB : kDefaultStreamMemMB;
+    return mb * 1024ULL * 1024ULL;
+  }
+
+  // Функция сброса накопленных записей ранном в файл потокового режима
+  void spillBuffer() {
+    SortInMemory(buffer_.data(), buffer_.data() + buffer_.size());
+    if (!spill_) spill_ = openSpillFile(opts_.tempDir);
+
+    size_t n = buffer_.size();
+    if (ftruncate(spill_.Get(), (spilled_ + n) * kRecordSize) != 0) throwErrno("ftruncate spill file");
+    writeRecords(spill_.Get(), spilled_, buffer_.data(), n);
+    spillRuns_.push_back(RunInfo{spilled_, n});
+    spilled_ += n;
+    buffer_.clear();
+  }
+
+  // Поразрядная сортировка на месте (American flag sort), от старшего байта к младшему
+  void radixSort(Record* first, Record* last, size_t byteIdx) const {
+    const size_t n = last - first;
+    if (n < 64 || byteIdx == 0) {
+      std::sort(first, last, less_);
+      return;
+    }
+
+    const size_t shift = (byteIdx - 1) * 8;
+    auto digit = [&](const Record &r) {
+      return (size_t)((Traits::toBits(less_.key(r)) >> shift) & 0xFF);
+    };
+
+    size_t count[256] = {0};
+    for (Record* p = first; p != last; ++p) count[digit(*p)]++;
+
+    // Все записи в одной корзине - сразу переходим к следующему байту
+    for (size_t d = 0; d < 256; d++) {
+      if (count[d] == n) {
+        radixSort(first, last, byteIdx - 1);
+        return;
+      }
+    }
+
+    size_t head[256], tail[256];
+    size_t sum = 0;
+    for (size_t d = 0; d < 256; d++) {
+      head[d] = sum;
+      sum += count[d];
+      tail[d] = sum;
+    }
+
+    // Раскладываем записи по корзинам циклическими перестановками
+    for (size_t d = 0; d < 256; d++) {
+      while (head[d] < tail[d]) {
+        Record r = first[head[d]];
+        size_t rd = digit(r);
+        while (rd != d) {
+          std::swap(r, first[head[rd]++]);
+          rd = digit(r);
+        }
+        first[head[d]++] = r;
+      }
+    }
+
+    size_t start = 0;
+    for (size_t d = 0; d < 256; d++) {
+      if (count[d] > 1) radixSort(first + start, first + start + count[d], byteIdx - 1);
+      start += count[d];
+    }
+  }
+
+  // Функция для сортировки части файла (чанка)
+  void sortChunkAndWrite(const FileIO &in, const FileIO &out, size_t count, size_t inOffBytes,
+                         size_t outOffBytes, bool inPlace, ScratchBuffer<Record> &scratch) const {
+    size_t mapSizeBytes = count * kRecordSize;
+    int inFD = in.Fd(), outFD = out.Fd();
+
+    if (opts_.hugePages || in.Direct()) {
+      // Сортируем копию чанка в анонимном буфере (буфер живет между чанками; с hugePages -
+      // на огромных страницах): чанк читается и пишется один раз подряд - окнами mmap,
+      // подгруженными целиком, или O_DIRECT прямо из буфера
+      if (scratch.size() < count) {
+        scratch.Reset();
+        scratch = ScratchBuffer<Record>(count, opts_.hugePages);
+      }
+      if (in.Direct()) {
+        in.Read(inOffBytes, scratch.data(), mapSizeBytes);
+      } else {
+        Mapping region(inOffBytes, mapSizeBytes, PROT_READ, inFD, "sortChunk: mmap failed", kMapHuge|kMapPopulate);
+        if (mapSizeBytes > 0) std::memcpy(scratch.data(), region.Data(), mapSizeBytes);
+      }
+      SortInMemory(scratch.data(), scratch.data() + count);
+      size_t outOff = inPlace ? inOffBytes : outOffBytes;
+      if (out.Direct()) {
+        out.Write(outOff, scratch.data(), mapSizeBytes);
+      } else {
+        Mapping outRegion(outOff, mapSizeBytes, PROT_READ|PROT_WRITE, outFD, "sortChunk: mmap out failed",
+                          kMapHuge|kMapPopulate);
+        if (mapSizeBytes > 0) std::memcpy(outRegion.Data(), scratch.data(), mapSizeBytes);
+      }
+      return;
+    }
+
+    if (inPlace) {
+      // Создаем mmap отображение для входных данных и сортируем их в памяти
+      Mapping region(inOffBytes, mapSizeBytes, PROT_READ|PROT_WRITE, inFD, "sortChunk: mmap failed");
+      countRead(mapSizeBytes);
+      Record* ptr = region.As<Record>();
+      SortInMemory(ptr, ptr + count);
+      return;
+    }
+
+    // Иначе копируем чанк в выходной файл и сортируем уже там: вход остается нетронутым
+    Mapping region(inOffBytes, mapSizeBytes, PROT_READ, inFD, "sortChunk: mmap failed");
+    Mapping outRegion(outOffBytes, mapSizeBytes, PROT_READ|PROT_WRITE, outFD, "sortChunk: mmap out failed");
+    if (mapSizeBytes > 0) std::memcpy(outRegion.Data(), region.Data(), mapSizeBytes);
+    region.Reset();
+    Record* ptr = outRegion.As<Record>();
+    SortInMemory(ptr, ptr + count);
+  }
+
+  // Функция для создания начальных отсортированных последовательностей (раннов)
+  std::vector<RunInfo> createInitialRuns(const FileIO &in, const FileIO &out, size_t totalElems,
+                                        size_t chunkBytes) const {
+    std::vector<RunInfo> runs;
+    continueInitialRuns(in, out, totalElems, chunkBytes, runs, nullptr);
+    return runs;
+  }
+
+  // Функция построения раннов-чанков после уже построенных runs; onRun вызывается
+  // после каждого нового ранна (контрольные точки SortOptions::resume)
+  void continueInitialRuns(const FileIO &in, const FileIO &out, size_t totalElems, size_t chunkBytes,
+                           std::vector<RunInfo> &runs, const std::function<void()> &onRun) const {
+    size_t off = runs.empty() ? 0 : runs.back().offset + runs.back().length;
+    size_t chunkElems = chunkBytes / kRecordSize;
+    if (chunkElems < 1) chunkElems = 1;  // Минимум 1 запись
+    ScratchBuffer<Record> scratch;
+
+    // Разбиваем файл на чанки и сортируем каждый (если out совпадает с in - на месте)
+    while (off < totalElems) {
+      size_t c = std::min(chunkElems, totalElems - off);  // Размер текущего чанка
+      size_t offB = off * kRecordSize;                     // Смещение в байтах
+      sortChunkAndWrite(in, out, c, offB, offB, in.Fd() == out.Fd(), scratch);
+      runs.push_back(RunInfo{off, c});
+      off += c;  // Переходим к следующему чанку
+      if (onRun) onRun();
+    }
+  }
+
+  // Функция записи массива записей в файл по смещению (в записях) через mmap
+  static void writeRecords(int outFD, size_t recOffset, const Record* src, size_t count) {
+    writeRecords(FileIO(outFD), recOffset, src, count);
+  }
+
+  static void writeRecords(const FileIO &out, size_t recOffset, const Record* src, size_t count) {
+    out.Write(recOffset * kRecordSize, src, count * kRecordSize);
+  }
+
+  // Функция для создания раннов методом выбора с замещением (replacement selection).
+  // Куча выдает минимальную запись и сразу принимает следующую из входа: если она не
+  // меньше выданной - она продолжает текущий ранн, иначе откладывается до следующего.
+  // На случайных данных средняя длина ранна ~2M (M - объем кучи), на почти
+  // отсортированных получается один ранн.
+  std::vector<RunInfo> createReplacementRuns(int inFD, int outFD, size_t totalElems, size_t memBytes) const {
+    std::vector<RunInfo> runs;
+
+    // Окна чтения и записи берем из того же бюджета, остальное отдаем куче
+    long ps = sysconf(_SC_PAGE_SIZE);
+    if (ps < 1) ps = 4096;
+    size_t ioBytes = std::max(memBytes / 16, (size_t)ps);
+    ioBytes = (ioBytes / ps) * ps;
+    size_t heapBytes = memBytes > 2 * ioBytes ? memBytes - 2 * ioBytes : ioBytes;
+    size_t ioElems = std::max(ioBytes / kRecordSize, (size_t)1);
+    size_t heapCap = std::max(heapBytes / kRecordSize, (size_t)1);
+    if (heapCap > totalElems) heapCap = totalElems;
+
+    // Последовательное чтение входа окнами mmap
+    Mapping inMap;
+    size_t inWinStart = 0, inWinLen = 0, inPos = 0;
+    auto nextInput = [&](Record &x) {
+      if (inPos >= totalElems) return false;
+      if (inPos >= inWinStart + inWinLen) {
+        inMap.Reset();
+        inWinStart = inPos;
+        inWinLen = std::min(ioElems, totalElems - inPos);
+        inMap = Mapping(inWinStart * kRecordSize, inWinLen * kRecordSize, PROT_READ, inFD,
+                        "createReplacementRuns: input mmap failed");
+      }
+      std::memcpy(&x, inMap.As<const char>() + (inPos - inWinStart) * kRecordSize, kRecordSize);
+      inPos++;
+      return true;
+    };
+
+    // Выходной буфер
+    std::vector<Record> outBuf(ioElems);
+    size_t outPos = 0, written = 0, runStart = 0;
+    auto emit = [&](const Record &v) {
+      outBuf[outPos++] = v;
+      if (outPos == outBuf.size()) {
+        writeRecords(outFD, written, outBuf.data(), outPos);
+        written += outPos;
+        outPos = 0;
+      }
+    };
+
+    // heap[0, active) - куча текущего ранна, heap[active, n) - отложенные записи
+    ScratchBuffer<Record> heap(heapCap, opts_.hugePages);  // Произвольный доступ - выигрывает от THP
+    auto cmp = [this](const Record &a, const Record &b) { return Less(b, a); };
+    size_t n = 0;
+    Record x;
+    while (n < heapCap && nextInput(x)) heap[n++] = x;
+    size_t active = n;
+    std::make_heap(heap.begin(), heap.begin() + active, cmp);
+
+    while (n > 0) {
+      if (active == 0) {
+        // Текущий ранн закончился - отложенные записи образуют новую кучу
+        size_t runEnd = written + outPos;
+        runs.push_back(RunInfo{runStart, runEnd - runStart});
+        runStart = runEnd;
+        active = n;
+        std::make_heap(heap.begin(), heap.begin() + active, cmp);
+      }
+
+      std::pop_heap(heap.begin(), heap.begin() + active, cmp);
+      Record v = heap[active - 1];
+      emit(v);
+
+      if (nextInput(x)) {
+        heap[active - 1] = x;
+        if (!Less(x, v)) {
+          std::push_heap(heap.begin(), heap.begin() + active, cmp);
+        } else {
+          active--;  // Запись уходит в следующий ранн
+        }
+      } else {
+        // Вход закончился - закрываем дырку последней отложенной записью
+        heap[active - 1] = heap[n - 1];
+        active--;
+        n--;
+      }
+    }
+
+    if (outPos > 0) {
+      writeRecords(outFD, written, outBuf.data(), outPos);
+      written += outPos;
+    }
+    if (written > runStart) runs.push_back(RunInfo{runStart, written - runStart});
+
+    return runs;
+  }
+
+  // Функция поиска естественного ранна, начинающегося с записи off.
+  // Файл читается окнами по windowElems записей, пока сохраняется порядок.
+  // Возрастающий ранн - неубывающая последовательность, убывающий - строго убывающая
+  // (как в TimSort: после разворота равные записи не меняют взаимный порядок).
+  NaturalRun scanNaturalRun(int fd, size_t off, size_t totalElems, size_t windowElems) const {
+    NaturalRun result{1, false};
+    if (totalElems - off < 2) {
+      result.length = totalElems - off;
+      return result;
+    }
+
+    bool decided = false;
+    Record prev{};
+    size_t pos = off;
+    while (pos < totalElems) {
+      size_t w = std::min(windowElems, totalElems - pos);
+      Mapping inMap(pos * kRecordSize, w * kRecordSize, PROT_READ, fd, "scanNaturalRun: mmap failed");
+      const Record* a = inMap.As<const Record>();
+
+      size_t i = 0;
+      if (pos == off) {
+        prev = a[0];
+        i = 1;
+      }
+      if (!decided && i < w) {
+        result.descending = Less(a[i], prev);
+        decided = true;
+      }
+
+      // Ищем первое нарушение порядка в окне
+      size_t brk = w;
+      if (result.descending) {
+        for (size_t j = i; j < w; j++) {
+          if (!Less(a[j], prev)) { brk = j; break; }
+          prev = a[j];
+        }
+      } else {
+        for (size_t j = i; j < w; j++) {
+          if (Less(a[j], prev)) { brk = j; break; }
+          prev = a[j];
+        }
+      }
+
+      pos += brk;
+      if (brk < w) break;
+    }
+
+    result.length = pos - off;
+    return result;
+  }
+
+  // Функция разворота диапазона [off, off + count) на месте.
+  // Блоки с обоих концов отображаются парой окон по windowElems записей,
+  // разворачиваются и меняются местами.
+  static void reverseRange(int fd, size_t off, size_t count, size_t windowElems) {
+    size_t lo = off, hi = off + count;  // [lo, hi) - еще не развернутая часть
+    if (windowElems < 1) windowElems = 1;
+
+    while (hi - lo > 2 * windowElems) {
+      size_t b = windowElems;
+      Mapping left(lo * kRecordSize, b * kRecordSize, PROT_READ|PROT_WRITE, fd, "reverseRange: mmap failed");
+      Mapping right((hi - b) * kRecordSize, b * kRecordSize, PROT_READ|PROT_WRITE, fd,
+                    "reverseRange: mmap failed");
+
+      countRead(2 * b * kRecordSize);
+      Record* l = left.As<Record>();
+      Record* r = right.As<Record>();
+      std::reverse(l, l + b);
+      std::reverse(r, r + b);
+      std::swap_ranges(l, l + b, r);
+
+      lo += b;
+      hi -= b;
+    }
+
+    // Середина помещается в одно окно (не больше двух блоков)
+    if (hi - lo > 1) {
+      Mapping mid(lo * kRecordSize, (hi - lo) * kRecordSize, PROT_READ|PROT_WRITE, fd,
+                  "reverseRange: mmap failed");
+      countRead((hi - lo) * kRecordSize);
+      Record* m = mid.As<Record>();
+      std::reverse(m, m + (hi - lo));
+    }
+  }
+
+  // Функция для создания раннов с учетом естественной упорядоченности (в стиле TimSort).
+  // Один потоковый проход: естественные ранны не короче чанка берутся как есть
+  // (убывающие разворачиваются на месте), остальное сортируется чанками на месте.
+  // Ранны остаются в исходном файле и сразу идут на слияние.
+  std::vector<RunInfo> createNaturalRuns(int fd, size_t totalElems, size_t chunkBytes) const {
+    std::vector<RunInfo> runs;
+    size_t chunkElems = chunkBytes / kRecordSize;
+    if (chunkElems < 1) chunkElems = 1;
+    size_t scanElems = std::max(chunkElems / 2, (size_t)1);  // Два окна на разворот
+    ScratchBuffer<Record> scratch;
+
+    size_t off = 0;
+    while (off < totalElems) {
+      NaturalRun nr = scanNaturalRun(fd, off, totalElems, scanElems);
+
+      if (nr.length >= chunkElems || off + nr.length == totalElems) {
+        // Естественный ранн длиннее чанка (или хвост файла) - сортировать не нужно
+        if (nr.descending) reverseRange(fd, off, nr.length, scanElems);
+        runs.push_back(RunInfo{off, nr.length});
+        off += nr.length;
+        continue;
+      }
+
+      // Короткий ранн - сортируем чанк на месте
+      size_t c = std::min(chunkElems, totalElems - off);
+      sortChunkAndWrite(FileIO(fd), FileIO(fd), c, off * kRecordSize, off * kRecordSize, true, scratch);
+      runs.push_back(RunInfo{off, c});
+      off += c;
+    }
+
+    return runs;
+  }
+
+  // Функция точной проверки отсортированности файла (с ранним выходом на первом нарушении).
+  // На случайных данных читается лишь начало файла.
+  bool isFileSorted(int fd, size_t totalElems, size_t windowElems) const {
+    if (totalElems < 2) return true;
+    NaturalRun nr = scanNaturalRun(fd, 0, totalElems, windowElems);
+    return nr.length == totalElems && !nr.descending;
+  }
+
+  // Состояние одного ранна при слиянии
+  template <typename Source>
+  struct MergeRunState {
+    Source source;               // Откуда читаются записи ранна
+    std::vector<Record> buffer;  // Буфер для чтения
+    size_t bufLen;               // Сколько записей буфера заполнено последним refill
+    size_t bufPos;               // Текущая позиция в буфере
+    bool done;                   // Флаг завершения
+  };
+
+  // Элемент кучи при слиянии
+  struct HeapItem {
+    Record value;  // Значение записи
+    int runIdx;    // Индекс ранна, из которого взята запись
+  };
+
+  // Курсор k-путевого слияния раннов: выдает записи по порядку пачками.
+  // Source читает записи одного ранна (Fill/Remaining): несжатые окна mmap
+  // или декодирование сжатых блоков. Общий для проходов слияния и финального
+  // слияния потокового режима.
+  template <typename Source>
+  class MergeCursor {
+   public:
+    MergeCursor(RecordLess less, std::vector<Source> sources, size_t bufElems)
+        : less_(std::move(less)) {
+      size_t k = sources.size();
+      st_.reserve(k);
+      for (size_t i = 0; i < k; i++) {
+        std::vector<Record> buffer(std::min(bufElems, sources[i].Remaining()));
+        st_.push_back(MergeRunState<Source>{std::move(sources[i]), std::move(buffer), 0, 0, false});
+      }
+
+      // Первоначальное заполнение буферов и кучи
+      heap_.reserve(k);
+      for (size_t i = 0; i < k; i++) {
+        refill(i);
+        if (!st_[i].done) {
+          heap_.push_back(HeapItem{st_[i].buffer[0], (int)i});
+          st_[i].bufPos = 1;
+        }
+      }
+      std::make_heap(heap_.begin(), heap_.end(), heapCmp());
+    }
+
+    // Функция выдачи до maxCount следующих записей в out; 0 - ранны закончились
+    size_t Read(Record* out, size_t maxCount) {
+      auto cmp = heapCmp();
+      size_t n = 0;
+      while (n < maxCount && !heap_.empty()) {
+        // Извлекаем минимальную запись
+        std::pop_heap(heap_.begin(), heap_.end(), cmp);
+        HeapItem top = heap_.back();
+        heap_.pop_back();
+        out[n++] = top.value;
+
+        int ridx = top.runIdx;
+        MergeRunState<Source> &rs = st_[ridx];
+        if (rs.done) continue;
+
+        // Если буфер текущего ранна закончился - заполняем снова
+        if (rs.bufPos >= rs.bufLen) {
+          refill(ridx);
+          if (rs.done) continue;  // Ранн закончился
+        }
+
+        // Добавляем следующую запись из этого ранна в кучу
+        heap_.push_back(HeapItem{rs.buffer[rs.bufPos], ridx});
+        std::push_heap(heap_.begin(), heap_.end(), cmp);
+        rs.bufPos++;
+      }
+      return n;
+    }
+
+   private:
+    auto heapCmp() const {
+      return [this](const HeapItem &a, const HeapItem &b) { return less_(b.value, a.value); };
+    }
+
+    // Функция заполнения буфера ранна
+    void refill(size_t idx) {
+      MergeRunState<Source> &rs = st_[idx];
+      rs.bufPos = 0;
+      rs.bufLen = rs.source.Fill(rs.buffer.data(), rs.buffer.size());
+      if (rs.bufLen == 0) rs.done = true;  // Ранн закончился
+    }
+
+    RecordLess less_;
+    std::vector<MergeRunState<Source>> st_;
+    std::vector<HeapItem> heap_;
+  };
+
+  // Функция построения источников для раннов несжатого файла
+  static std::vector<PlainRunSource> plainSources(const FileIO &io, const std::vector<RunInfo> &runs) {
+    std::vector<PlainRunSource> sources;
+    sources.reserve(runs.size());
+    for (auto &r : runs) sources.push_back(PlainRunSource{io, r.offset, r.length});
+    return sources;
+  }
+
+  // Сжатый ранн во временном файле
+  struct CompressedRun {
+    size_t byteOffset;  // Смещение в файле (в байтах)
+    size_t bytes;       // Размер (в байтах)
+    size_t length;      // Длина (в записях)
+  };
+
+  // Источник записей сжатого ранна: декодирование блоков и обратное преобразование ключей
+  struct CompressedRunSource {
+    using Bits = typename Traits::Bits;
+
+    CompressedRunReader<Bits> reader;
+    size_t left;               // Сколько записей осталось
+    std::vector<Bits> values;  // Декодированные поразрядные ключи
+
+    size_t Remaining() const { return left; }
+
+    size_t Fill(Record* out, size_t maxCount) {
+      if (values.size() < maxCount) values.resize(maxCount);
+      size_t n = reader.Read(values.data(), maxCount);
+      for (size_t i = 0; i < n; i++) out[i] = Traits::fromBits(values[i]);
+      left -= n;
+      return n;
+    }
+  };
+
+  // Функция построения источников для сжатых раннов; byteBuf - буфер чтения на ранн
+  static std::vector<CompressedRunSource> compressedSources(int fd, const std::vector<CompressedRun> &runs,
+                                                            size_t byteBuf) {
+    std::vector<CompressedRunSource> sources;
+    sources.reserve(runs.size());
+    for (auto &r : runs) {
+      sources.push_back(CompressedRunSource{
+          CompressedRunReader<typename Traits::Bits>(fd, r.byteOffset, r.bytes, r.length, byteBuf), r.length, {}});
+    }
+    return sources;
+  }
+
+  // Функция дозаписи отсортированных записей в сжатый ранн
+  template <typename Writer, typename Bits>
+  static void appendRecords(Writer &writer, const Record* src, size_t count, std::vector<Bits> &scratch) {
+    while (count > 0) {
+      size_t n = std::min(count, scratch.size());
+      for (size_t i = 0; i < n; i++) scratch[i] = Traits::toBits(src[i]);
+      writer.Append(scratch.data(), n);
+      src += n;
+      count -= n;
+    }
+  }
+
+  // Функция сортировки со сжатыми раннами (SortOptions::compressRuns).
+  // Чанки сортируются на месте в исходном файле и сжатыми уходят во временный файл;
+  // промежуточные проходы сливают сжатые ранны в сжатые через второй временный файл,
+  // последний проход распаковывает результат в исходный файл. Сжатые ранны читаются
+  // только последовательно, поэтому слияние идет в один поток. Экономит место на диске,
+  // но не время: кодек и однопоточное слияние медленнее несжатого пути (FileMapperSolution.md).
+  void sortCompressed(int fd, int fdTemp, const std::string &tempName2, size_t totalElems,
+                      size_t memBytes, size_t maxK) const {
+    using Bits = typename Traits::Bits;
+    using Codec = RunCodec<Bits>;
+
+    // Буферы записи сжатых данных и преобразования ключей берем из бюджета
+    size_t ioBytes = std::max(memBytes / 16, (size_t)64 << 10);
+    size_t chunkBytes = memBytes > 4 * ioBytes ? memBytes - 2 * ioBytes : memBytes / 2;
+    size_t chunkElems = std::max(chunkBytes / kRecordSize, (size_t)1);
+    std::vector<Bits> scratch(Codec::kBlock * 64);
+    ResourceUsage phase = ResourceUsage::Now();
+
+    // Фаза 1: сжатые начальные ранны
+    std::vector<CompressedRun> runs;
+    size_t tempBytes = 0;
+    for (size_t off = 0; off < totalElems; off += chunkElems) {
+      size_t c = std::min(chunkElems, totalElems - off);
+      Mapping chunk(off * kRecordSize, c * kRecordSize, PROT_READ|PROT_WRITE, fd, "sortCompressed: mmap failed");
+      countRead(c * kRecordSize);
+      Record* p = chunk.As<Record>();
+      SortInMemory(p, p + c);
+
+      CompressedRunWriter<Bits> writer(fdTemp, tempBytes, ioBytes);
+      appendRecords(writer, p, c, scratch);
+      size_t bytes = writer.Finish();
+      runs.push_back(CompressedRun{tempBytes, bytes, c});
+      tempBytes += bytes;
+    }
+    log("Initial runs: ", runs.size(), " (", countMergePasses(runs.size(), maxK), " merge passes), compressed ",
+        totalElems * kRecordSize, " -> ", tempBytes, " bytes (x",
+        tempBytes ? (double)(totalElems * kRecordSize) / tempBytes : 0.0, ")\n");
+    phase = endPhase({.name = "run_generation", .runsOut = runs.size()}, phase);
+
+    // Буферы слияния k раннов: половина доли ранна - записи, половина - сжатые байты
+    auto bufferSizes = [&](size_t k) {
+      size_t each = memBytes / (k + 1);
+      size_t recBuf = std::max(each / 2 / kRecordSize, Codec::kBlock);
+      return std::pair<size_t, size_t>(recBuf, each / 2);
+    };
+
+    // Фаза 2: промежуточные проходы между двумя временными файлами
+    FileHandle fdTemp2;
+    struct TempGuard {
+      const std::string &name;
+      bool used = false;
+      ~TempGuard() {
+        if (used) remove(name.c_str());
+      }
+    } tempGuard{tempName2};
+
+    int inFD = fdTemp;
+    size_t passK = firstPassFanIn(runs.size(), maxK);
+    size_t pass = 0;
+    while (runs.size() > maxK) {
+      if (!fdTemp2) {
+        fdTemp2 = FileHandle(open(tempName2.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+        if (!fdTemp2) throwErrno("open temp file " + tempName2);
+        tempGuard.used = true;
+      }
+      int outFD = inFD == fdTemp ? fdTemp2.Get() : fdTemp;
+      if (ftruncate(outFD, 0) != 0) throwErrno("ftruncate temp file");
+
+      std::vector<CompressedRun> next;
+      size_t outBytes = 0;
+      for (size_t i = 0; i < runs.size(); i += passK) {
+        size_t grp = std::min(passK, runs.size() - i);
+        std::vector<CompressedRun> group(runs.begin() + i, runs.begin() + i + grp);
+        size_t totalLen = 0;
+        for (auto &r : group) totalLen += r.length;
+
+        auto [recBuf, byteBuf] = bufferSizes(grp);
+        MergeCursor<CompressedRunSource> cursor(less_, compressedSources(inFD, group, byteBuf), recBuf);
+        CompressedRunWriter<Bits> writer(outFD, outBytes, byteBuf);
+        std::vector<Record> outBuf(recBuf);
+        while (size_t n = cursor.Read(outBuf.data(), outBuf.size())) appendRecords(writer, outBuf.data(), n, scratch);
+
+        size_t bytes = writer.Finish();
+        next.push_back(CompressedRun{outBytes, bytes, totalLen});
+        outBytes += bytes;
+      }
+
+      phase = endPhase({.name = "merge_pass", .pass = ++pass, .k = std::min(passK, runs.size()),
+                        .runsIn = runs.size(), .runsOut = next.size()},
+                       phase);
+      runs = std::move(next);
+      passK = maxK;
+      inFD = outFD;
+    }
+
+    // Последний проход: распаковка слияния в исходный файл
+    auto [recBuf, byteBuf] = bufferSizes(runs.size());
+    MergeCursor<CompressedRunSource> cursor(less_, compressedSources(inFD, runs, byteBuf), recBuf);
+    std::vector<Record> outBuf(recBuf);
+    size_t curOut = 0;
+    while (size_t n = cursor.Read(outBuf.data(), outBuf.size())) {
+      writeRecords(fd, curOut, outBuf.data(), n);
+      curOut += n;
+    }
+    endPhase({.name = "merge_pass", .pass = ++pass, .k = runs.size(), .runsIn = runs.size(), .runsOut = 1}, phase);
+  }
+
+  // Функция для многопутевого слияния раннов
+  void multiWayMerge(const FileIO &in, const FileIO &out, const std::vector<RunInfo> &runs,
+                     size_t outOffset, size_t memBytes) const {
+    if (runs.empty()) return;
+
+    size_t k = runs.size();  // Количество раннов для слияния
+
+    // Специальная обработка случая с одним ранном (просто копируем)
+    if (k == 1) {
+      size_t stepB = memBytes > 0 ? memBytes : (1 << 20);  // 1MB шаг по умолчанию
+      FileIO::Copy(in, runs[0].offset * kRecordSize, out, outOffset * kRecordSize, runs[0].length * kRecordSize,
+                   stepB);
+      return;
+    }
+
+    // Вычисляем сколько памяти выделить каждому ранну (+1 для выходного буфера)
+    size_t eachCount = std::max(memBytes / (k + 1) / kRecordSize, (size_t)1);
+
+    MergeCursor<PlainRunSource> cursor(less_, plainSources(in, runs), eachCount);
+    std::vector<Record> outBuf(eachCount);  // Выходной буфер
+    size_t curOut = outOffset;              // Текущая позиция в выходном файле
+
+    // Сливаем пачками размером с выходной буфер
+    while (size_t n = cursor.Read(outBuf.data(), outBuf.size())) {
+      writeRecords(out, curOut, outBuf.data(), n);
+      curOut += n;
+    }
+  }
+
+  // Функция чтения одной записи файла (для бинарного поиска по раннам)
+  static Record readRecord(int fd, size_t recIdx) {
+    Record v;
+    ssize_t rd = pread(fd, &v, kRecordSize, recIdx * kRecordSize);
+    if (rd < 0) throwErrno("readRecord: pread failed");
+    countRead(rd);
+    if (rd != (ssize_t)kRecordSize) throw std::runtime_error("readRecord: unexpected end of file");
+    return v;
+  }
+
+  // Функция бинарного поиска в ранне по файлу: первая позиция в [lo, hi), где запись
+  // не меньше v (upper == false) или больше v (upper == true)
+  size_t searchRun(int fd, const RunInfo &run, size_t lo, size_t hi, const Record &v, bool upper) const {
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      Record x = readRecord(fd, run.offset + mid);
+      if (upper ? !Less(v, x) : Less(x, v)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // Функция поиска точки разбиения раннов (multisequence selection): для каждого ранна j
+  // находит pos[j] так, что сумма pos[j] равна rank и все записи левее разбиения
+  // не больше записей правее. В каждом ранне поддерживается окно [lo, hi), в котором
+  // лежит искомая позиция; опорная запись - взвешенная медиана середин окон, поэтому
+  // каждая итерация отбрасывает не меньше четверти суммарного окна.
+  std::vector<size_t> findSplitPositions(int fd, const std::vector<RunInfo> &runs, size_t rank) const {
+    size_t k = runs.size();
+    std::vector<size_t> lo(k, 0), hi(k);
+    for (size_t j = 0; j < k; j++) hi[j] = runs[j].length;
+
+    std::vector<std::pair<Record, size_t>> mids;  // (середина окна, вес окна)
+    std::vector<size_t> lower(k), upper(k);
+    while (true) {
+      mids.clear();
+      size_t weight = 0;
+      for (size_t j = 0; j < k; j++) {
+        if (lo[j] >= hi[j]) continue;
+        size_t mid = lo[j] + (hi[j] - lo[j]) / 2;
+        mids.emplace_back(readRecord(fd, runs[j].offset + mid), hi[j] - lo[j]);
+        weight += hi[j] - lo[j];
+      }
+      if (mids.empty()) return lo;  // Все окна пусты - разбиение найдено
+
+      // Взвешенная медиана середин
+      std::sort(mids.begin(), mids.end(),
+                [this](const auto &a, const auto &b) { return Less(a.first, b.first); });
+      Record pivot = mids.back().first;
+      size_t acc = 0;
+      for (auto &m : mids) {
+        acc += m.second;
+        if (2 * acc >= weight) {
+          pivot = m.first;
+          break;
+        }
+      }
+
+      // Сколько записей меньше опорной и не больше опорной
+      size_t lowerSum = 0, upperSum = 0;
+      for (size_t j = 0; j < k; j++) {
+        lower[j] = searchRun(fd, runs[j], lo[j], hi[j], pivot, false);
+        upper[j] = searchRun(fd, runs[j], lower[j], hi[j], pivot, true);
+        lowerSum += lower[j];
+        upperSum += upper[j];
+      }
+
+      if (rank < lowerSum) {
+        hi = lower;
+      } else if (rank > upperSum) {
+        lo = upper;
+      } else {
+        // Разбиение проходит по записям, равным опорной - добираем их по порядку раннов
+        size_t need = rank - lowerSum;
+        for (size_t j = 0; j < k; j++) {
+          size_t take = std::min(need, upper[j] - lower[j]);
+          lower[j] += take;
+          need -= take;
+        }
+        return lower;
+      }
+    }
+  }
+
+  // Функция параллельного слияния группы раннов: диапазон результата делится на threads
+  // равных частей, для каждой границы ищется разбиение раннов, и каждый поток сливает
+  // свои под-ранны в заранее известное место выходного файла
+  void parallelMultiWayMerge(const FileIO &in, const FileIO &out, const std::vector<RunInfo> &runs,
+                             size_t outOffset, size_t memBytes, size_t threads) const {
+    size_t totalLen = 0;
+    for (auto &r : runs) totalLen += r.length;
+
+    // Границы частей ищем тоже параллельно: splits[t] - разбиение для ранга t * totalLen / threads
+    std::vector<std::vector<size_t>> splits(threads + 1);
+    splits[0].assign(runs.size(), 0);
+    splits[threads].resize(runs.size());
+    for (size_t j = 0; j < runs.size(); j++) splits[threads][j] = runs[j].length;
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t t = 1; t < threads; t++) {
+      tasks.emplace_back([&, t] {
+        splits[t] = findSplitPositions(in.Fd(), runs, totalLen / threads * t);
+      });
+    }
+    runInThreads(tasks);
+    tasks.clear();
+
+    for (size_t t = 0; t < threads; t++) {
+      std::vector<RunInfo> part;
+      size_t partOut = outOffset;
+      for (size_t j = 0; j < runs.size(); j++) {
+        partOut += splits[t][j];
+        size_t len = splits[t + 1][j] - splits[t][j];
+        if (len > 0) part.push_back(RunInfo{runs[j].offset + splits[t][j], len});
+      }
+      tasks.emplace_back([=, this] {
+        multiWayMerge(in, out, part, partOut, memBytes / threads);
+      });
+    }
+    runInThreads(tasks);
+  }
+
+  // Функция для выполнения одного прохода многопутевого слияния
+  std::vector<RunInfo> multiWayMergePass(const FileIO &in, const FileIO &out, const std::vector<RunInfo> &runs,
+                                         size_t memBytes, size_t maxK, size_t threads) const {
+    std::vector<RunInfo> newRuns;
+    newRuns.reserve((runs.size() + maxK - 1) / maxK);  // Резервируем память
+    continueMergePass(in, out, runs, memBytes, maxK, threads, newRuns, nullptr);
+    return newRuns;
+  }
+
+  // Функция продолжения прохода слияния: newRuns - уже слитые группы (первые
+  // newRuns.size() групп по maxK раннов), onGroup вызывается после каждой новой группы
+  void continueMergePass(const FileIO &in, const FileIO &out, const std::vector<RunInfo> &runs, size_t memBytes,
+                         size_t maxK, size_t threads, std::vector<RunInfo> &newRuns,
+                         const std::function<void()> &onGroup) const {
+    size_t outOff = newRuns.empty() ? 0 : newRuns.back().offset + newRuns.back().length;
+    // Разбиваем ранны на группы по maxK и сливаем каждую группу
+    for (size_t i = newRuns.size() * maxK; i < runs.size(); i += maxK) {
+      size_t grp = std::min(maxK, runs.size() - i);
+      std::vector<RunInfo> group(runs.begin() + i, runs.begin() + i + grp);
+
+      size_t totalLen = 0;
+      for (auto &r : group) totalLen += r.length;
+
+      // Сливаем группу раннов (параллельно, если на каждый поток приходится достаточно данных)
+      if (threads > 1 && grp > 1 && totalLen / threads >= std::max<size_t>(opts_.parallelMergeMinElems, 1)) {
+        parallelMultiWayMerge(in, out, group, outOff, memBytes, threads);
+      } else {
+        multiWayMerge(in, out, group, outOff, memBytes);
+      }
+
+      // Добавляем информацию о новом ранне
+      newRuns.push_back(RunInfo{outOff, totalLen});
+      outOff += totalLen;
+      if (onGroup) onGroup();
+    }
+  }
+
+  // Функция сортировки слиянием с контрольными точками (SortOptions::resume).
+  // Ранны-чанки строятся только во временном файле, а проход слияния не меняет свой вход,
+  // поэтому после сбоя работа продолжается с первого несохраненного ранна или группы.
+  // Перед каждой записью манифеста данные выходного файла сбрасываются на диск (fdatasync).
+  void sortResumable(int fd, const std::string &filename, size_t total, size_t usedMem) const {
+    const size_t fs = total * kRecordSize;
+    const std::string tempName = filename + ".tmp_sort";
+    const std::string manifest = tempName + ".manifest";
+
+    SortCheckpoint cp;
+    bool resumed = loadCheckpoint(manifest, cp);
+    if (resumed) {
+      if (cp.fileSize != fs || cp.recordSize != kRecordSize || cp.memBytes == 0 || cp.maxK < 2) {
+        throw std::runtime_error("sort manifest does not match " + filename + ": " + manifest);
+      }
+      log("Resuming from checkpoint: ",
+          cp.mergePhase ? "merge pass " + std::to_string(cp.pass + 1) : std::string("run generation"), ", ",
+          cp.mergePhase ? cp.done.size() : cp.runs.size(), " runs already written.\n");
+    } else {
+      log("Checking if the file is already sorted...\n");
+      ResourceUsage check = ResourceUsage::Now();
+      bool sorted = isFileSorted(fd, total, std::max(usedMem / kRecordSize, (size_t)1));
+      endPhase({.name = "sorted_check"}, check);
+      if (sorted) {
+        if (opts_.metrics) opts_.metrics->alreadySorted = true;
+        log("✅ File is already sorted. Skipping sorting.\n");
+        return;
+      }
+      cp.fileSize = fs;
+      cp.recordSize = kRecordSize;
+      cp.memBytes = usedMem;
+      cp.maxK = computeMaxK(usedMem);
+    }
+
+    FileHandle fdTemp(open(tempName.c_str(), resumed ? O_RDWR : O_RDWR|O_CREAT|O_TRUNC, 0666));
+    if (!fdTemp) {
+      int err = errno;
+      // Сбой после переноса результата rename(), но до удаления манифеста
+      if (resumed && err == ENOENT && cp.mergePhase && cp.runs.size() <= 1 && cp.done.empty() &&
+          isFileSorted(fd, total, std::max(cp.memBytes / kRecordSize, (size_t)1))) {
+        remove(manifest.c_str());
+        log("✅ Result was already moved from temp file.\n");
+        return;
+      }
+      if (resumed && err == ENOENT) throw std::runtime_error("sort checkpoint is inconsistent: missing " + tempName);
+      throw std::system_error(err, std::generic_category(), "open temp file " + tempName);
+    }
+    if (ftruncate(fdTemp.Get(), fs) != 0) throwErrno("ftruncate temp file");
+
+    FileHandle direct, directTemp;
+    if (opts_.io == IoMode::Direct) {
+      direct = openDirect(filename);
+      directTemp = openDirect(tempName);
+    }
+    FileIO io(fd, direct.Get()), ioTemp(fdTemp.Get(), directTemp.Get());
+
+    auto checkpoint = [&] {
+      saveCheckpoint(manifest, cp);
+      if (opts_.onCheckpoint) opts_.onCheckpoint();
+    };
+    ResourceUsage phase = ResourceUsage::Now();
+
+    // Ранны-чанки: исходный файл только читается
+    if (!cp.mergePhase) {
+      continueInitialRuns(io, ioTemp, total, std::max(cp.memBytes, kRecordSize), cp.runs, [&] {
+        if (fdatasync(fdTemp.Get()) != 0) throwErrno("fdatasync temp file");
+        checkpoint();
+      });
+      cp.mergePhase = true;
+      cp.runsInTemp = true;
+      cp.passK = firstPassFanIn(cp.runs.size(), cp.maxK);
+      checkpoint();
+      log("Initial runs: ", cp.runs.size(), " (", countMergePasses(cp.runs.size(), cp.maxK),
+          " merge passes, checkpoint ", manifest, ")\n");
+      phase = endPhase({.name = "run_generation", .runsOut = cp.runs.size()}, phase);
+    }
+
+    // Проходы слияния; вход прохода не изменяется, пока проход не завершен
+    while (cp.runs.size() > 1) {
+      const FileIO &in = cp.runsInTemp ? ioTemp : io;
+      const FileIO &out = cp.runsInTemp ? io : ioTemp;
+      continueMergePass(in, out, cp.runs, cp.memBytes, cp.passK, opts_.threads, cp.done, [&] {
+        if (fdatasync(out.Fd()) != 0) throwErrno("fdatasync merge output");
+        checkpoint();
+      });
+      size_t runsIn = cp.runs.size();
+      size_t passK = std::min(cp.passK, runsIn);
+      cp.runs = std::move(cp.done);
+      cp.done.clear();
+      cp.runsInTemp = !cp.runsInTemp;
+      cp.pass++;
+      cp.passK = cp.maxK;
+      checkpoint();
+      phase = endPhase({.name = "merge_pass", .pass = cp.pass, .k = passK, .runsIn = runsIn,
+                        .runsOut = cp.runs.size()},
+                       phase);
+    }
+
+    // Манифест удаляем раньше временного файла: временный файл без манифеста -
+    // просто мусор, который следующий запуск перезапишет
+    bool keepTemp = false;
+    if (cp.runsInTemp) {
+      FinishMethod m = finishFromTemp(fd, fdTemp.Get(), filename, tempName, fs);
+      keepTemp = m == FinishMethod::Rename;
+      log("Result moved from temp file via ", finishMethodName(m), ".\n");
+      endPhase({.name = "copy_back", .detail = finishMethodName(m)}, phase);
+    }
+    remove(manifest.c_str());
+    if (!keepTemp) remove(tempName.c_str());
+  }
+
+  // Функция сортировки распределением (sample sort, SortMethod::Distribution).
+  // 1. Случайная выборка записей дает buckets - 1 разделителей.
+  // 2. Один проход по файлу раскладывает записи по корзинам: у каждой корзины буфер,
+  //    заполненный буфер дописывается блоком в конец временного файла.
+  // 3. Корзины сортируются в памяти параллельно (бюджет делится между потоками)
+  //    и пишутся в исходный файл по смещениям из префиксных сумм размеров.
+  // Файл читается и пишется по два раза независимо от размера. Корзина, которая
+  // из-за неудачной выборки или повторов не помещается в память потока,
+  // сортируется слиянием в отдельном временном файле.
+  void sortByDistribution(int fd, int fdTemp, const std::string &filename, size_t totalElems,
+                          size_t memBytes) const {
+    size_t threads = std::max(opts_.threads, (size_t)1);
+    size_t threadElems = std::max(memBytes / threads / kRecordSize, (size_t)1);
+
+    // Корзина в среднем на четверть меньше памяти потока - запас на ошибку выборки
+    size_t targetElems = std::max(threadElems * 3 / 4, (size_t)1);
+    size_t buckets = std::max((totalElems + targetElems - 1) / targetElems, (size_t)1);
+    ResourceUsage phase = ResourceUsage::Now();
+
+    // Выборка: 128 записей на корзину (отклонение размера корзины ~9%), случайные позиции
+    std::vector<Record> splitters;
+    if (buckets > 1) {
+      size_t sampleSize = std::min(totalElems, buckets * 128);
+      std::mt19937_64 gen(totalElems);
+      std::vector<Record> sample(sampleSize);
+      for (auto &x : sample) x = readRecord(fd, gen() % totalElems);
+      SortInMemory(sample.data(), sample.data() + sample.size());
+      for (size_t i = 1; i < buckets; i++) splitters.push_back(sample[i * sampleSize / buckets]);
+    }
+    log("Distribution: ", buckets, " buckets of ~", targetElems, " elements\n");
+
+    // Раскладка: блоки корзин дописываются во временный файл
+    size_t bufElems = std::max(memBytes / 2 / buckets / kRecordSize, (size_t)1);
+    size_t inElems = std::max(memBytes / 2 / kRecordSize, (size_t)1);
+    std::vector<std::vector<Record>> bufs(buckets);
+    std::vector<std::vector<RunInfo>> blocks(buckets);
+    std::vector<size_t> counts(buckets, 0);
+    size_t tempPos = 0;
+
+    auto flush = [&](size_t b) {
+      writeRecords(fdTemp, tempPos, bufs[b].data(), bufs[b].size());
+      blocks[b].push_back(RunInfo{tempPos, bufs[b].size()});
+      tempPos += bufs[b].size();
+      bufs[b].clear();
+    };
+
+    for (auto &b : bufs) b.reserve(std::min(bufElems, totalElems));
+    for (size_t off = 0; off < totalElems; off += inElems) {
+      size_t n = std::min(inElems, totalElems - off);
+      Mapping inMap(off * kRecordSize, n * kRecordSize, PROT_READ, fd, "sortByDistribution: mmap failed");
+      const Record* in = inMap.As<const Record>();
+      for (size_t i = 0; i < n; i++) {
+        size_t b = std::upper_bound(splitters.begin(), splitters.end(), in[i], less_) - splitters.begin();
+        bufs[b].push_back(in[i]);
+        counts[b]++;
+        if (bufs[b].size() == bufElems) flush(b);
+      }
+    }
+    for (size_t b = 0; b < buckets; b++) {
+      if (!bufs[b].empty()) flush(b);
+      std::vector<Record>().swap(bufs[b]);
+    }
+
+    phase = endPhase({.name = "partition", .runsOut = buckets}, phase);
+
+    // Смещения корзин в результате
+    std::vector<size_t> outOff(buckets, 0);
+    for (size_t b = 1; b < buckets; b++) outOff[b] = outOff[b - 1] + counts[b - 1];
+
+    // Сортировка корзин: потоки берут корзины по очереди
+    std::atomic<size_t> nextBucket{0};
+    std::mutex overflowMutex;
+    std::vector<size_t> overflow;
+
+    auto gather = [&](size_t b, Record* dst) {
+      for (auto &blk : blocks[b]) {
+        Mapping m(blk.offset * kRecordSize, blk.length * kRecordSize, PROT_READ, fdTemp,
+                  "sortByDistribution: bucket mmap failed");
+        std::memcpy(dst, m.Data(), blk.length * kRecordSize);
+        dst += blk.length;
+      }
+    };
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t t = 0; t < std::min(threads, buckets); t++) {
+      tasks.emplace_back([&] {
+        std::vector<Record> buf;
+        for (size_t b = nextBucket++; b < buckets; b = nextBucket++) {
+          if (counts[b] == 0) continue;
+          if (counts[b] > threadElems) {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            overflow.push_back(b);
+            continue;
+          }
+          buf.resize(counts[b]);
+          gather(b, buf.data());
+          SortInMemory(buf.data(), buf.data() + buf.size());
+          writeRecords(fd, outOff[b], buf.data(), buf.size());
+        }
+      });
+    }
+    runInThreads(tasks);
+
+    // Переполненные корзины: переносим на место результата и сортируем слиянием
+    // во временном файле корзины
+    if (!overflow.empty()) log("Overflowing buckets: ", overflow.size(), " (sorted by merging)\n");
+    for (size_t b : overflow) {
+      std::string bucketName = filename + ".tmp_bucket";
+      {
+        FileHandle fdBucket(open(bucketName.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+        if (!fdBucket) throwErrno("open temp file " + bucketName);
+        struct BucketGuard {
+          const std::string &name;
+          ~BucketGuard() { remove(name.c_str()); }
+        } bucketGuard{bucketName};
+
+        if (ftruncate(fdBucket.Get(), counts[b] * kRecordSize) != 0) throwErrno("ftruncate bucket file");
+        size_t pos = 0;
+        for (auto &blk : blocks[b]) {
+          Mapping m(blk.offset * kRecordSize, blk.length * kRecordSize, PROT_READ, fdTemp,
+                    "sortByDistribution: bucket mmap failed");
+          writeRecords(fdBucket.Get(), pos, m.As<const Record>(), blk.length);
+          pos += blk.length;
+        }
+
+        SortOptions mergeOpts = opts_;
+        mergeOpts.method = SortMethod::Merge;
+        mergeOpts.log = nullptr;
+        mergeOpts.metrics = nullptr;
+        ExternalSorter(mergeOpts, less_.key, less_.cmp).SortFile(bucketName);
+
+        // Сортированная корзина может лежать в новом inode (rename) - открываем заново
+        FileHandle sorted(open(bucketName.c_str(), O_RDONLY));
+        if (!sorted) throwErrno("open sorted bucket " + bucketName);
+        size_t step = std::max(memBytes / kRecordSize, (size_t)1);
+        for (size_t done = 0; done < counts[b]; done += step) {
+          size_t n = std::min(step, counts[b] - done);
+          Mapping m(done * kRecordSize, n * kRecordSize, PROT_READ, sorted.Get(),
+                    "sortByDistribution: sorted bucket mmap failed");
+          writeRecords(fd, outOff[b] + done, m.As<const Record>(), n);
+        }
+      }
+    }
+    endPhase({.name = "bucket_sort", .runsIn = buckets, .runsOut = 1}, phase);
+  }
+
+  // Функция косвенной сортировки (SortMethod::Indirect) для широких записей.
+  // 1. Проход по файлу выписывает пары (ключ, номер записи) в файл ключей.
+  // 2. Файл ключей сортируется слиянием: проходы двигают пары, а не записи целиком.
+  // 3. Сборка: отсортированные пары читаются пачками размером с бюджет; пачка
+  //    упорядочивается по номерам записей, записи читаются из исходного файла в этом
+  //    порядке (случайные, но возрастающие смещения) и раскладываются в буфер
+  //    результата, который пишется во временный файл одним последовательным блоком.
+  // Возвращает снимок конца сборки (начало переноса результата).
+  ResourceUsage sortIndirect(int fd, int fdTemp, const std::string &filename, size_t totalElems,
+                             size_t memBytes) const {
+    using Entry = detail::IndexEntry<Key>;
+    ResourceUsage phase = ResourceUsage::Now();
+    if (sizeof(Entry) >= kRecordSize) {
+      log("Warning: index entry (", sizeof(Entry), " bytes) is not smaller than the record (", kRecordSize,
+          " bytes).\n");
+    }
+
+    std::string keysName = filename + ".tmp_sort_keys";
+    FileHandle fdKeys(open(keysName.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+    if (!fdKeys) throwErrno("open temp file " + keysName);
+    struct KeysGuard {
+      const std::string &name;
+      ~KeysGuard() { remove(name.c_str()); }
+    } keysGuard{keysName};
+    if (ftruncate(fdKeys.Get(), totalElems * sizeof(Entry)) != 0) throwErrno("ftruncate keys file");
+
+    // Фаза 1: пары (ключ, номер) окнами размером с половину бюджета
+    FileIO keysIO(fdKeys.Get());
+    size_t window = std::max(memBytes / 2 / kRecordSize, (size_t)1);
+    std::vector<Entry> entries(std::min(window, totalElems));
+    for (size_t off = 0; off < totalElems; off += window) {
+      size_t n = std::min(window, totalElems - off);
+      Mapping inMap(off * kRecordSize, n * kRecordSize, PROT_READ, fd, "sortIndirect: mmap failed");
+      const Record* in = inMap.As<const Record>();
+      for (size_t i = 0; i < n; i++) {
+        std::memset(&entries[i], 0, sizeof(Entry));  // Байты выравнивания - в файл без мусора
+        entries[i].key = less_.key(in[i]);
+        entries[i].index = off + i;
+      }
+      keysIO.Write(off * sizeof(Entry), entries.data(), n * sizeof(Entry));
+    }
+    std::vector<Entry>().swap(entries);
+    phase = endPhase({.name = "key_extract"}, phase);
+
+    // Фаза 2: сортировка пар тем же бюджетом и потоками
+    SortOptions keyOpts = opts_;
+    keyOpts.method = SortMethod::Merge;
+    keyOpts.log = nullptr;
+    keyOpts.metrics = nullptr;
+    keyOpts.compressRuns = false;
+    keyOpts.memoryLimitMB = std::max(memBytes >> 20, (size_t)1);
+    ExternalSorter<Entry, detail::IndexKey, Compare>(keyOpts, detail::IndexKey(), less_.cmp).SortFile(keysName);
+    phase = endPhase({.name = "key_sort"}, phase);
+
+    // Результат сортировки ключей мог переехать в новый inode (rename) - открываем заново
+    FileHandle sortedKeys(open(keysName.c_str(), O_RDONLY));
+    if (!sortedKeys) throwErrno("open sorted keys " + keysName);
+    FileIO sortedIO(sortedKeys.Get());
+
+    // Фаза 3: сборка записей. На запись пачки: сама запись, пара и пара (номер, место)
+    size_t batch = std::max(memBytes / (kRecordSize + sizeof(Entry) + 2 * sizeof(uint64_t)), (size_t)1);
+    batch = std::min(batch, totalElems);
+    Mapping inMap(0, totalElems * kRecordSize, PROT_READ, fd, "sortIndirect: mmap input failed");
+    const Record* src = inMap.As<const Record>();
+    ScratchBuffer<Record> out(batch, opts_.hugePages);
+    std::vector<Entry> keys(batch);
+    std::vector<std::pair<uint64_t, uint64_t>> order(batch);  // (номер записи, место в пачке)
+    size_t threads = std::max(std::min(opts_.threads, batch), (size_t)1);
+
+    for (size_t off = 0; off < totalElems; off += batch) {
+      size_t n = std::min(batch, totalElems - off);
+      sortedIO.Read(off * sizeof(Entry), keys.data(), n * sizeof(Entry));
+      for (size_t i = 0; i < n; i++) order[i] = {keys[i].index, i};
+      std::sort(order.begin(), order.begin() + n);
+
+      std::vector<std::function<void()>> tasks;
+      for (size_t t = 0; t < threads; t++) {
+        tasks.emplace_back([&, t] {
+          size_t from = n * t / threads, to = n * (t + 1) / threads;
+          for (size_t i = from; i < to; i++) out[order[i].second] = src[order[i].first];
+        });
+      }
+      runInThreads(tasks);
+      writeRecords(fdTemp, off, out.data(), n);
+#ifdef MADV_DONTNEED
+      // Прочитанные страницы входа не держим в RSS процесса (page cache они не покидают)
+      madvise(const_cast<Record*>(src), totalElems * kRecordSize, MADV_DONTNEED);
+#endif
+    }
+    return endPhase({.name = "gather", .detail = std::to_string((totalElems + batch - 1) / batch) + " batches"}, phase);
+  }
+
+  SortOptions opts_;
+  RecordLess less_;
+
+  // Состояние потокового режима
+  std::vector<Record> buffer_;      // Накопленные и еще не сброшенные записи
+  size_t bufferCap_ = 0;            // Емкость буфера (в записях), 0 - еще не выделен
+  FileHandle spill_;                // Файл раннов
+  size_t spilled_ = 0;              // Сколько записей уже в файле
+  std::vector<RunInfo> spillRuns_;  // Ранны файла
+};
+
+template <typename Record, typename KeyExtractor, typename Compare>
+void ExternalSorter<Record, KeyExtractor, Compare>::sortFile(const std::string &filename) const {
+  // Открываем входной файл
+  FileHandle fd(open(filename.c_str(), O_RDWR));
+  if (!fd) throwErrno("open " + filename);
+
+  if (opts_.compressRuns && !kCompressible) {
+    throw std::invalid_argument("compressed runs require arithmetic records ordered by std::less/std::greater");
+  }
+  if (opts_.resume && (opts_.method != SortMethod::Merge || opts_.compressRuns)) {
+    throw std::invalid_argument("resume supports only merge sort with uncompressed runs");
+  }
+  if (opts_.io == IoMode::Direct && (opts_.method != SortMethod::Merge || opts_.compressRuns)) {
+    throw std::invalid_argument("direct I/O supports only merge sort with uncompressed runs");
+  }
+
+  // Получаем размер файла и проверяем его
+  size_t fs = getFileSize(filename);
+  if (fs % kRecordSize != 0) {
+    throw std::runtime_error("File size not multiple of record size (" + std::to_string(kRecordSize) +
+                             " bytes): " + filename);
+  }
+
+  size_t total = fs / kRecordSize;  // Количество записей
+  if (total <= 1) {
+    log("File has <= 1 element, already sorted.\n");
+    return;
+  }
+
+  // Определяем объем используемой памяти
+  size_t usedMem = 0;
+  if (opts_.memoryLimitMB == 0) {
+    // Если лимит не задан, используем 10% от размера файла
+    usedMem = fs / 10;
+    long ps = sysconf(_SC_PAGE_SIZE);
+    if (ps < 1) ps = 4096;
+    if (usedMem < (size_t)ps) usedMem = ps;  // Не меньше размера страницы
+  } else {
+    usedMem = opts_.memoryLimitMB * 1024ULL * 1024ULL;  // Конвертируем MB в байты
+  }
+
+  bool direct = opts_.io == IoMode::Direct;
+  if (SortMetrics* m = opts_.metrics) {
+    m->fileBytes = fs;
+    m->records = total;
+    m->recordSize = kRecordSize;
+    m->memoryBytes = usedMem;
+    m->threads = opts_.threads;
+    m->maxK = computeMaxK(usedMem);
+    m->method = opts_.method == SortMethod::Distribution ? "distribute"
+                : opts_.method == SortMethod::Indirect   ? "indirect"
+                : opts_.resume                           ? "merge_resumable"
+                : opts_.compressRuns                     ? "merge_compressed"
+                                                         : "merge";
+    // Direct и resume строят ранны только чанками
+    RunStrategy strategy = direct || opts_.resume ? RunStrategy::Chunk : opts_.strategy;
+    m->strategy = strategy == RunStrategy::Natural ? "natural" : strategy == RunStrategy::Chunk ? "chunk" : "replace";
+    m->io = direct ? "direct" : "mmap";
+  }
+
+  // Сортировка с контрольными точками: свой временный файл и манифест
+  if (opts_.resume) {
+    log("File has ", total, " elements (", fs, " bytes). Using up to ", usedMem / (1024.0 * 1024.0),
+        " MB of mmap.\n");
+    log("🔹 Starting resumable external multi-way mergesort...\n");
+    sortResumable(fd.Get(), filename, total, usedMem);
+    log("Sorting complete.\n");
+    return;
+  }
+
+  // Для чанков и выбора с замещением проверяем, не отсортирован ли файл уже.
+  // Проверка точная и останавливается на первом нарушении порядка; при построении
+  // естественных раннов она не нужна - сортированный файл дает один ранн.
+  if (opts_.strategy != RunStrategy::Natural || opts_.compressRuns || opts_.method != SortMethod::Merge || direct) {
+    log("Checking if the file is already sorted...\n");
+    size_t windowElems = std::max(usedMem / kRecordSize, (size_t)1);
+    ResourceUsage check = ResourceUsage::Now();
+    bool sorted = isFileSorted(fd.Get(), total, windowElems);
+    endPhase({.name = "sorted_check"}, check);
+    if (sorted) {
+      if (opts_.metrics) opts_.metrics->alreadySorted = true;
+      log("✅ File is already sorted. Skipping sorting.\n");
+      return;
+    }
+  }
+
+  log("File has ", total, " elements (", fs, " bytes). Using up to ", usedMem / (1024.0 * 1024.0),
+      " MB of mmap.\n");
+  log(opts_.method == SortMethod::Distribution ? "🔹 Starting external distribution sort...\n"
+      : opts_.method == SortMethod::Indirect   ? "🔹 Starting external indirect (key, index) sort...\n"
+                                               : "🔹 Starting external multi-way mergesort...\n");
+
+  // Создаем временный файл; при выходе (в том числе по исключению) он удаляется
+  std::string tempName = filename + ".tmp_sort";
+  FileHandle fdTemp(open(tempName.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+  if (!fdTemp) throwErrno("open temp file " + tempName);
+
+  struct TempGuard {
+    const std::string &name;
+    bool keep = false;
+    ~TempGuard() {
+      if (!keep) remove(name.c_str());
+    }
+  } tempGuard{tempName};
+
+  size_t maxK = computeMaxK(usedMem);
+
+  // Сжатые ранны занимают во временном файле столько, сколько получится после сжатия
+  if (opts_.compressRuns && opts_.method == SortMethod::Merge) {
+    if constexpr (kCompressible) {
+      sortCompressed(fd.Get(), fdTemp.Get(), filename + ".tmp_sort2", total, usedMem, maxK);
+    }
+    log("Sorting complete.\n");
+    return;
+  }
+
+  // Устанавливаем размер временного файла
+  if (ftruncate(fdTemp.Get(), fs) != 0) throwErrno("ftruncate temp file");
+
+  // Распределение по корзинам пишет результат сразу в исходный файл
+  if (opts_.method == SortMethod::Distribution) {
+    sortByDistribution(fd.Get(), fdTemp.Get(), filename, total, usedMem);
+    log("Sorting complete.\n");
+    return;
+  }
+
+  // Косвенная сортировка собирает результат во временном файле
+  if (opts_.method == SortMethod::Indirect) {
+    ResourceUsage phase = sortIndirect(fd.Get(), fdTemp.Get(), filename, total, usedMem);
+    FinishMethod m = finishFromTemp(fd.Get(), fdTemp.Get(), filename, tempName, fs);
+    tempGuard.keep = m == FinishMethod::Rename;
+    log("Result moved from temp file via ", finishMethodName(m), ".\n");
+    endPhase({.name = "copy_back", .detail = finishMethodName(m)}, phase);
+    log("Sorting complete.\n");
+    return;
+  }
+
+  // Создаем начальные отсортированные последовательности.
+  // Ранны кладем в тот файл, из которого четное число проходов приведет результат
+  // в исходный: при нечетном числе проходов - во временный, иначе - на место.
+  size_t chunkBytes = std::max(usedMem, kRecordSize);
+  size_t chunkElems = std::max(chunkBytes / kRecordSize, (size_t)1);
+  ResourceUsage phase = ResourceUsage::Now();
+
+  // O_DIRECT: второй дескриптор каждого файла; естественные ранны ищутся окнами mmap,
+  // поэтому ранны строятся только чанками
+  FileHandle directFd, directTemp;
+  RunStrategy strategy = opts_.strategy;
+  if (direct) {
+    directFd = openDirect(filename);
+    directTemp = openDirect(tempName);
+    strategy = RunStrategy::Chunk;
+    log("Direct I/O: page cache is bypassed, runs are built from chunks.\n");
+  }
+  FileIO io(fd.Get(), directFd.Get()), ioTemp(fdTemp.Get(), directTemp.Get());
+
+  std::vector<RunInfo> runs;
+  const FileIO* in = &ioTemp;  // Файл, в котором лежат текущие ранны
+  const FileIO* out = &io;
+  if (strategy == RunStrategy::Natural) {
+    runs = createNaturalRuns(fd.Get(), total, chunkBytes);
+    std::swap(in, out);  // Естественные ранны остаются в исходном файле
+  } else {
+    // Число раннов известно заранее для чанков; для выбора с замещением - оценка
+    // по средней длине ранна 2M (ошибка оценки обходится finishFromTemp)
+    size_t runElems = strategy == RunStrategy::Replacement ? 2 * chunkElems : chunkElems;
+    size_t plannedRuns = (total + runElems - 1) / runElems;
+    if (countMergePasses(plannedRuns, maxK) % 2 == 0) std::swap(in, out);
+
+    // Выбор с замещением пишет не дальше прочитанного, поэтому тоже может работать на месте
+    if (strategy == RunStrategy::Replacement) {
+      runs = createReplacementRuns(fd.Get(), in->Fd(), total, chunkBytes);
+    } else {
+      runs = createInitialRuns(io, *in, total, chunkBytes);
+    }
+  }
+  log("Initial runs: ", runs.size(), " (", countMergePasses(runs.size(), maxK), " merge passes, runs in ",
+      in == &io ? "original" : "temp", " file)\n");
+  phase = endPhase({.name = "run_generation", .runsOut = runs.size()}, phase);
+
+  std::vector<RunInfo> currentRuns = runs;
+  size_t passK = firstPassFanIn(currentRuns.size(), maxK);
+  size_t pass = 0;
+
+  // Основной цикл слияния, пока не останется один ранн
+  while (currentRuns.size() > 1) {
+    // Устанавливаем размер выходного файла
+    if (ftruncate(out->Fd(), fs) != 0) throwErrno("ftruncate merge output");
+
+    // Выполняем проход слияния
+    size_t runsIn = currentRuns.size();
+    currentRuns = multiWayMergePass(*in, *out, currentRuns, usedMem, passK, opts_.threads);
+    phase = endPhase({.name = "merge_pass", .pass = ++pass, .k = std::min(passK, runsIn), .runsIn = runsIn,
+                      .runsOut = currentRuns.size()},
+                     phase);
+    passK = maxK;
+
+    // Меняем файлы местами
+    std::swap(in, out);
+  }
+
+  // Если результат остался во временном файле - переносим его в исходный
+  if (in == &ioTemp) {
+    FinishMethod m = finishFromTemp(fd.Get(), fdTemp.Get(), filename, tempName, fs);
+    tempGuard.keep = m == FinishMethod::Rename;
+    log("Result moved from temp file via ", finishMethodName(m), ".\n");
+    endPhase({.name = "copy_back", .detail = finishMethodName(m)}, phase);
+  }
+
+  log("Sorting complete.\n");
+}
+
+template <typename Record, typename KeyExtractor, typename Compare>
+typename ExternalSorter<Record, KeyExtractor, Compare>::SortedStream
+ExternalSorter<Record, KeyExtractor, Compare>::Finish() {
+  SortedStream stream;
+
+  // Все записи в памяти - сортируем буфер и отдаем его целиком
+  if (spillRuns_.empty()) {
+    SortInMemory(buffer_.data(), buffer_.data() + buffer_.size());
+    stream.memory_ = std::move(buffer_);
+    stream.view_ = stream.memory_;
+    buffer_ = std::vector<Record>();
+    bufferCap_ = 0;
+    return stream;
+  }
+
+  if (!buffer_.empty()) spillBuffer();
+  buffer_ = std::vector<Record>();  // Память буфера уходит на слияние
+  bufferCap_ = 0;
+
+  size_t memBytes = streamMemBytes();
+  size_t maxK = computeMaxK(memBytes);
+  std::vector<RunInfo> runs = std::move(spillRuns_);
+  spillRuns_.clear();
+  FileHandle in = std::move(spill_);
+  FileHandle out;
+
+  // Промежуточные проходы, пока раннов больше, чем может слить финальный курсор
+  if (runs.size() > maxK) {
+    out = openSpillFile(opts_.tempDir);
+    if (ftruncate(out.Get(), spilled_ * kRecordSize) != 0) throwErrno("ftruncate spill file");
+
+    size_t passK = firstPassFanIn(runs.size(), maxK);
+    while (runs.size() > maxK) {
+      runs = multiWayMergePass(FileIO(in.Get()), FileIO(out.Get()), runs, memBytes, passK, opts_.threads);
+      passK = maxK;
+      std::swap(in, out);
+    }
+  }
+  spilled_ = 0;
+
+  size_t eachCount = std::max(memBytes / (runs.size() + 1) / kRecordSize, (size_t)1);
+  stream.cursor_ = std::make_unique<MergeCursor<PlainRunSource>>(less_, plainSources(FileIO(in.Get()), runs), eachCount);
+  stream.files_[0] = std::move(in);
+  stream.files_[1] = std::move(out);
+  return stream;
+}
+
+}  // namespace extsort
@@ -0,0 +1,116 @@
+// Бенчмарк бэкендов ввода-вывода: сортировка одного и того же файла через окна mmap
+// и через O_DIRECT. Каждый прогон идет в отдельном процессе (fork), чтобы пиковый RSS
+// и page fault считались для него одного; рост page cache берется из /proc/meminfo.
+// Перед каждым прогоном файл генерируется заново и выгоняется из page cache.
+// Для честного сравнения файл должен быть больше оперативной памяти.
+//
+// Использование: io_backend_bench [sizeMB] [limitMB] [threads] [path]
+//   sizeMB  - размер файла int64 (по умолчанию 2048)
+//   limitMB - бюджет памяти сортировки (по умолчанию 256)
+//   threads - потоки слияния (по умолчанию 1)
+//   path    - файл для теста (по умолчанию io_backend_bench.bin в текущем каталоге)
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "external_sorter.hpp"
+
+using namespace extsort;
+using Clock = std::chrono::steady_clock;
+
+// Функция чтения поля /proc/meminfo в килобайтах (-1 - нет такого файла или поля)
+static long meminfoKB(const std::string &field) {
+  std::ifstream ifs("/proc/meminfo");
+  std::string key;
+  long value;
+  std::string unit;
+  while (ifs >> key >> value) {
+    std::getline(ifs, unit);
+    if (key == field + ":") return value;
+  }
+  return -1;
+}
+
+static void generate(const std::string &path, size_t count) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  std::mt19937_64 gen(42);
+  std::vector<int64_t> block(1 << 20);
+  for (size_t done = 0; done < count; done += block.size()) {
+    size_t n = std::min(block.size(), count - done);
+    for (size_t i = 0; i < n; i++) block[i] = (int64_t)gen();
+    ofs.write(reinterpret_cast<const char*>(block.data()), n * sizeof(int64_t));
+  }
+  ofs.close();
+  if (!ofs) throw std::runtime_error("cannot write " + path);
+
+  // Выгоняем сгенерированный файл из page cache: оба прогона начинают с холодного кэша
+  FileHandle fd(open(path.c_str(), O_RDONLY));
+  if (!fd) throwErrno("open " + path);
+  if (fsync(fd.Get()) != 0) throwErrno("fsync " + path);
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd.Get(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+// Функция прогона сортировки в дочернем процессе
+static void runChild(const std::string &path, IoMode mode, size_t limitMB, size_t threads) {
+  long cachedBefore = meminfoKB("Cached");
+  auto start = Clock::now();
+
+  pid_t pid = fork();
+  if (pid < 0) throwErrno("fork");
+  if (pid == 0) {
+    try {
+      SortOptions opts;
+      opts.memoryLimitMB = limitMB;
+      opts.threads = threads;
+      opts.io = mode;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      _exit(0);
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      _exit(1);
+    }
+  }
+
+  int status = 0;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) < 0) throwErrno("wait4");
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) throw std::runtime_error("sort process failed");
+  long cachedAfter = meminfoKB("Cached");
+
+  std::cout << "  " << (mode == IoMode::Direct ? "direct" : "mmap  ") << ": " << sec << " s"
+            << ", max RSS " << ru.ru_maxrss / 1024 << " MB"
+            << ", faults " << ru.ru_minflt << " minor / " << ru.ru_majflt << " major";
+  if (cachedBefore >= 0) std::cout << ", page cache " << (cachedAfter - cachedBefore) / 1024 << " MB";
+  std::cout << "\n";
+}
+
+int main(int argc, char* argv[]) try {
+  size_t sizeMB = argc > 1 ? std::stoull(argv[1]) : 2048;
+  size_t limitMB = argc > 2 ? std::stoull(argv[2]) : 256;
+  size_t threads = argc > 3 ? std::stoull(argv[3]) : 1;
+  std::string path = argc > 4 ? argv[4] : "io_backend_bench.bin";
+
+  long memKB = meminfoKB("MemTotal");
+  std::cout << "sort " << sizeMB << " MB of int64, limit " << limitMB << " MB, " << threads << " thread(s)";
+  if (memKB > 0) std::cout << ", RAM " << memKB / 1024 << " MB";
+  std::cout << "\n";
+
+  for (IoMode mode : {IoMode::Mmap, IoMode::Direct}) {
+    generate(path, sizeMB * (1 << 20) / sizeof(int64_t));
+    runChild(path, mode, limitMB, threads);
+  }
+  remove(path.c_str());
+  return 0;
+} catch (const std::exception &e) {
+  std::cerr << "Error: " << e.what() << "\n";
+  return 1;
+}
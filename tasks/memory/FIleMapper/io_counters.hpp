@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace extsort {
+
+// Счетчики ввода-вывода процесса для метрик сортировки (SortMetrics).
+// Общие для всех потоков и сортировок процесса; фазы считают разность снимков.
+// Байты окна mmap считаются прочитанными, если окно только для чтения, и записанными,
+// если оно доступно для записи; сортировка на месте дочитывает свои окна явно.
+struct IoCounters {
+  std::atomic<uint64_t> bytesRead{0};
+  std::atomic<uint64_t> bytesWritten{0};
+  std::atomic<uint64_t> mmapCalls{0};
+  std::atomic<uint64_t> munmapCalls{0};
+};
+
+inline IoCounters& ioCounters() {
+  static IoCounters counters;
+  return counters;
+}
+
+inline void countRead(uint64_t bytes) {
+  ioCounters().bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void countWritten(uint64_t bytes) {
+  ioCounters().bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void countMmap() {
+  ioCounters().mmapCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void countMunmap() {
+  ioCounters().munmapCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace extsort
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+
+#include "io_counters.hpp"
+
+namespace extsort {
+
+// Кодек отсортированных раннов: дельты + упаковка битов (frame of reference).
+// Значения - беззнаковые Bits, неубывающие внутри ранна. Ранн делится на блоки
+// по kBlock значений, каждый блок независим:
+//   [Bits first][uint8 width][(n - 1) дельт по width бит, плотно]
+// width - число бит наибольшей дельты блока; ширины больше 56 хранятся как 64
+// (сырые значения), чтобы любая дельта читалась одной невыровненной 64-битной загрузкой.
+// Распаковка блока - цикл без ветвлений и зависимостей между итерациями,
+// за ним префиксная сумма; компилятор векторизует его под целевую архитектуру.
+template <typename Bits>
+struct RunCodec {
+  static_assert(std::is_unsigned_v<Bits>, "Bits must be unsigned");
+
+  static constexpr size_t kBlock = 128;                       // Значений в блоке
+  static constexpr size_t kHeader = sizeof(Bits) + 1;         // first + width
+  static constexpr size_t kSlack = 8;                          // Хвост для 64-битных загрузок
+  static constexpr size_t kMaxBlockBytes = kHeader + (kBlock - 1) * 8;
+
+  // Размер упакованных дельт блока из n значений
+  static size_t PayloadBytes(size_t n, unsigned width) {
+    return ((n - 1) * width + 7) / 8;
+  }
+
+  // Функция кодирования блока из n (1..kBlock) значений; возвращает число записанных байт.
+  // В out должно быть не меньше kMaxBlockBytes + kSlack байт.
+  static size_t EncodeBlock(const Bits* values, size_t n, uint8_t* out) {
+    uint64_t deltas[kBlock];
+    uint64_t all = 0;
+    for (size_t i = 1; i < n; i++) {
+      deltas[i - 1] = (uint64_t)(Bits)(values[i] - values[i - 1]);
+      all |= deltas[i - 1];
+    }
+
+    unsigned width = 0;
+    while (width < 64 && (all >> width) != 0) width++;
+    if (width > 56) width = 64;
+
+    std::memcpy(out, &values[0], sizeof(Bits));
+    out[sizeof(Bits)] = (uint8_t)width;
+    uint8_t* payload = out + kHeader;
+    size_t bytes = PayloadBytes(n, width);
+
+    if (width == 64) {
+      std::memcpy(payload, deltas, (n - 1) * 8);
+    } else if (width > 0) {
+      std::memset(payload, 0, bytes + kSlack);
+      for (size_t i = 0; i + 1 < n; i++) {
+        size_t bit = i * width;
+        uint64_t word;
+        std::memcpy(&word, payload + (bit >> 3), 8);
+        word |= deltas[i] << (bit & 7);
+        std::memcpy(payload + (bit >> 3), &word, 8);
+      }
+    }
+    return kHeader + bytes;
+  }
+
+  // Функция декодирования блока из n значений; возвращает число прочитанных байт.
+  // За концом блока в in должно быть kSlack доступных для чтения байт.
+  static size_t DecodeBlock(const uint8_t* in, size_t n, Bits* out) {
+    Bits first;
+    std::memcpy(&first, in, sizeof(Bits));
+    unsigned width = in[sizeof(Bits)];
+    const uint8_t* payload = in + kHeader;
+
+    uint64_t deltas[kBlock];
+    if (width == 64) {
+      std::memcpy(deltas, payload, (n - 1) * 8);
+    } else {
+      const uint64_t mask = width ? (~0ULL >> (64 - width)) : 0;
+      for (size_t i = 0; i + 1 < n; i++) {
+        size_t bit = i * width;
+        uint64_t word;
+        std::memcpy(&word, payload + (bit >> 3), 8);
+        deltas[i] = (word >> (bit & 7)) & mask;
+      }
+    }
+
+    Bits v = first;
+    out[0] = v;
+    for (size_t i = 1; i < n; i++) {
+      v = Bits(v + deltas[i - 1]);
+      out[i] = v;
+    }
+    return kHeader + PayloadBytes(n, width);
+  }
+};
+
+// Потоковая запись сжатого ранна в файл начиная с байтового смещения
+template <typename Bits>
+class CompressedRunWriter {
+  using Codec = RunCodec<Bits>;
+
+ public:
+  CompressedRunWriter(int fd, size_t byteOffset, size_t bufBytes)
+      : fd_(fd), fileOffset_(byteOffset),
+        bytes_(std::max(bufBytes, 2 * (Codec::kMaxBlockBytes + Codec::kSlack))) {}
+
+  // Функция добавления значений ранна (неубывающих)
+  void Append(const Bits* values, size_t count) {
+    while (count > 0) {
+      size_t take = std::min(count, Codec::kBlock - pendingLen_);
+      std::copy(values, values + take, pending_ + pendingLen_);
+      pendingLen_ += take;
+      values += take;
+      count -= take;
+      if (pendingLen_ == Codec::kBlock) encodePending();
+    }
+  }
+
+  // Функция завершения ранна: дописывает неполный блок; возвращает размер ранна в байтах
+  size_t Finish() {
+    if (pendingLen_ > 0) encodePending();
+    flush();
+    return written_;
+  }
+
+ private:
+  void encodePending() {
+    if (bytesLen_ + Codec::kMaxBlockBytes + Codec::kSlack > bytes_.size()) flush();
+    bytesLen_ += Codec::EncodeBlock(pending_, pendingLen_, bytes_.data() + bytesLen_);
+    pendingLen_ = 0;
+  }
+
+  void flush() {
+    size_t done = 0;
+    while (done < bytesLen_) {
+      ssize_t wr = pwrite(fd_, bytes_.data() + done, bytesLen_ - done, fileOffset_ + written_ + done);
+      if (wr < 0) throw std::system_error(errno, std::generic_category(), "write compressed run");
+      countWritten(wr);
+      done += wr;
+    }
+    written_ += bytesLen_;
+    bytesLen_ = 0;
+  }
+
+  int fd_;
+  size_t fileOffset_;
+  size_t written_ = 0;
+  std::vector<uint8_t> bytes_;
+  size_t bytesLen_ = 0;
+  Bits pending_[Codec::kBlock];
+  size_t pendingLen_ = 0;
+};
+
+// Потоковое чтение сжатого ранна из файла целыми блоками
+template <typename Bits>
+class CompressedRunReader {
+  using Codec = RunCodec<Bits>;
+
+ public:
+  CompressedRunReader(int fd, size_t byteOffset, size_t byteLength, size_t count, size_t bufBytes)
+      : fd_(fd), fileOffset_(byteOffset), fileLeft_(byteLength), left_(count),
+        bytes_(std::max(bufBytes, Codec::kMaxBlockBytes) + Codec::kSlack) {}
+
+  // Функция декодирования целых блоков, пока они помещаются в out (maxCount не меньше
+  // kBlock, иначе блок может не поместиться). Возвращает число значений, 0 - ранн закончился.
+  size_t Read(Bits* out, size_t maxCount) {
+    size_t n = 0;
+    while (left_ > 0) {
+      size_t blockLen = std::min(Codec::kBlock, left_);
+      if (maxCount - n < blockLen) break;
+
+      ensure(Codec::kHeader);
+      unsigned width = bytes_[pos_ + sizeof(Bits)];
+      ensure(Codec::kHeader + Codec::PayloadBytes(blockLen, width));
+      pos_ += Codec::DecodeBlock(bytes_.data() + pos_, blockLen, out + n);
+      n += blockLen;
+      left_ -= blockLen;
+    }
+    return n;
+  }
+
+ private:
+  // Функция подкачки: в буфере должно быть need непрочитанных байт
+  void ensure(size_t need) {
+    if (len_ - pos_ >= need) return;
+    std::memmove(bytes_.data(), bytes_.data() + pos_, len_ - pos_);
+    len_ -= pos_;
+    pos_ = 0;
+
+    size_t room = bytes_.size() - Codec::kSlack;
+    while (len_ < need) {
+      size_t want = std::min(room - len_, fileLeft_);
+      if (want == 0) throw std::runtime_error("compressed run is truncated");
+      ssize_t rd = pread(fd_, bytes_.data() + len_, want, fileOffset_);
+      if (rd < 0) throw std::system_error(errno, std::generic_category(), "read compressed run");
+      if (rd == 0) throw std::runtime_error("compressed run is truncated");
+      countRead(rd);
+      len_ += rd;
+      fileOffset_ += rd;
+      fileLeft_ -= rd;
+    }
+  }
+
+  int fd_;
+  size_t fileOffset_;  // Следующий байт файла для чтения
+  size_t fileLeft_;    // Сколько байт ранна еще не прочитано из файла
+  size_t left_;        // Сколько значений еще не декодировано
+  std::vector<uint8_t> bytes_;
+  size_t pos_ = 0, len_ = 0;
+};
+
+}  // namespace extsort
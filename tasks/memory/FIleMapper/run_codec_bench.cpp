@@ -0,0 +1,105 @@
+// Бенчмарк сжатия раннов: степень сжатия и скорость кодека на отсортированных
+// раннах, затем сортировка файла целиком без сжатия и со сжатием раннов.
+//
+// Использование: run_codec_bench [count] [range] [limitMB]
+//   count   - число int64 (по умолчанию 16M)
+//   range   - значения равномерно в [0, range) (по умолчанию 1e9; 0 - весь диапазон int64)
+//   limitMB - бюджет памяти сортировки (по умолчанию 16)
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "external_sorter.hpp"
+
+using namespace extsort;
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<int64_t> generate(size_t count, uint64_t range) {
+  std::mt19937_64 gen(42);
+  std::vector<int64_t> data(count);
+  for (auto &x : data) x = range ? (int64_t)(gen() % range) : (int64_t)gen();
+  return data;
+}
+
+static void writeFile(const std::string &path, const std::vector<int64_t> &data) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(int64_t));
+  if (!ofs) throw std::runtime_error("cannot write " + path);
+}
+
+int main(int argc, char* argv[]) try {
+  size_t count = argc > 1 ? std::stoull(argv[1]) : (16u << 20);
+  uint64_t range = argc > 2 ? (uint64_t)std::stod(argv[2]) : 1000000000ULL;
+  size_t limitMB = argc > 3 ? std::stoull(argv[3]) : 16;
+
+  using Traits = detail::RadixTraits<int64_t, std::less<>>;
+  using Codec = RunCodec<uint64_t>;
+  auto data = generate(count, range);
+  const double plainBytes = (double)count * sizeof(int64_t);
+
+  // 1. Кодек на раннах размером с бюджет памяти
+  size_t runElems = std::max<size_t>(limitMB * (1 << 20) / sizeof(int64_t), Codec::kBlock);
+  std::vector<uint64_t> bits(count);
+  for (size_t off = 0; off < count; off += runElems) {
+    size_t n = std::min(runElems, count - off);
+    std::vector<int64_t> run(data.begin() + off, data.begin() + off + n);
+    std::sort(run.begin(), run.end());
+    for (size_t i = 0; i < n; i++) bits[off + i] = Traits::toBits(run[i]);
+  }
+
+  std::vector<uint8_t> encoded(count * sizeof(uint64_t) + count / Codec::kBlock * Codec::kHeader + 4096);
+  auto start = Clock::now();
+  size_t bytes = 0;
+  for (size_t off = 0; off < count; off += runElems) {
+    size_t end = std::min(off + runElems, count);
+    for (size_t b = off; b < end; b += Codec::kBlock) {
+      bytes += Codec::EncodeBlock(bits.data() + b, std::min(Codec::kBlock, end - b), encoded.data() + bytes);
+    }
+  }
+  double encodeSec = secondsSince(start);
+
+  std::vector<uint64_t> decoded(count);
+  start = Clock::now();
+  size_t pos = 0;
+  for (size_t off = 0; off < count; off += runElems) {
+    size_t end = std::min(off + runElems, count);
+    for (size_t b = off; b < end; b += Codec::kBlock) {
+      pos += Codec::DecodeBlock(encoded.data() + pos, std::min(Codec::kBlock, end - b), decoded.data() + b);
+    }
+  }
+  double decodeSec = secondsSince(start);
+  if (decoded != bits) throw std::runtime_error("codec round trip mismatch");
+
+  std::cout << "codec: " << count << " int64 in runs of " << runElems << ", range "
+            << (range ? std::to_string(range) : std::string("full")) << "\n"
+            << "  size:   " << (size_t)plainBytes << " -> " << bytes << " bytes (x" << plainBytes / bytes << ")\n"
+            << "  encode: " << plainBytes / encodeSec / 1e9 << " GB/s\n"
+            << "  decode: " << plainBytes / decodeSec / 1e9 << " GB/s\n";
+
+  // 2. Сортировка файла: несжатые ранны против сжатых (один поток, одинаковый бюджет)
+  const std::string path = "run_codec_bench.bin";
+  std::cout << "sort " << (size_t)plainBytes << " bytes, limit " << limitMB << " MB:\n";
+  for (bool compress : {false, true}) {
+    writeFile(path, data);
+    SortOptions opts;
+    opts.memoryLimitMB = limitMB;
+    opts.strategy = RunStrategy::Chunk;
+    opts.compressRuns = compress;
+    start = Clock::now();
+    ExternalSorter<int64_t>(opts).SortFile(path);
+    std::cout << "  " << (compress ? "compressed" : "plain     ") << ": " << secondsSince(start) << " s\n";
+  }
+  remove(path.c_str());
+  return 0;
+} catch (const std::exception &e) {
+  std::cerr << "Error: " << e.what() << "\n";
+  return 1;
+}
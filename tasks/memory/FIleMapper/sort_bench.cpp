@@ -0,0 +1,241 @@
+// Бенчмарк сортировки файла: перебор размеров файла, бюджетов памяти (в процентах от
+// размера), числа потоков, распределений и стратегий; каждая комбинация - строка CSV.
+// Каждый прогон идет в отдельном процессе (fork): пиковый RSS и page fault считаются
+// для него одного. Перед прогоном файл генерируется заново с тем же зерном и выгоняется
+// из page cache, после прогона проверяется сортировка.
+//
+// Использование: sort_bench [опции]
+//   --sizes=1G,4G        - размеры файлов int64 (суффиксы K, M, G; по умолчанию 1G)
+//   --mem=1,5,20         - бюджеты памяти в процентах от размера файла (по умолчанию 1,5,20)
+//   --threads=1,4        - потоки сортировки (по умолчанию 1 и число ядер)
+//   --dist=uniform,zipf  - распределения генератора (по умолчанию uniform)
+//   --strategies=...     - natural, chunk, replace, distribute, compress, direct (по умолчанию все)
+//   --repeat=N           - повторов каждой комбинации (по умолчанию 1)
+//   --seed=S             - зерно генератора (по умолчанию 1)
+//   --dir=path           - каталог файла (по умолчанию текущий)
+//   --out=results.csv    - CSV; дописывается, заголовок - только в новый файл (по умолчанию sort_bench.csv)
+//   --label=text         - метка прогона в первой колонке (например, коммит)
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "data_tools.hpp"
+#include "external_sorter.hpp"
+
+using namespace extsort;
+
+// Стратегия бенчмарка: сочетание опций сортировки
+struct Strategy {
+  const char* name;
+  void (*apply)(SortOptions &opts);
+};
+
+static const Strategy kStrategies[] = {
+    {"natural", [](SortOptions &o) { o.strategy = RunStrategy::Natural; }},
+    {"chunk", [](SortOptions &o) { o.strategy = RunStrategy::Chunk; }},
+    {"replace", [](SortOptions &o) { o.strategy = RunStrategy::Replacement; }},
+    {"distribute", [](SortOptions &o) { o.method = SortMethod::Distribution; }},
+    {"compress", [](SortOptions &o) { o.compressRuns = true; }},
+    {"direct", [](SortOptions &o) { o.io = IoMode::Direct; }},
+};
+
+// Итог прогона: метрики дочерний процесс передает родителю через pipe, проверку делает родитель
+struct RunResult {
+  double wallSec = 0;
+  double cpuSec = 0;
+  size_t initialRuns = 0;
+  size_t mergePasses = 0;
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  bool sorted = false;
+};
+
+// Функция разбора опции вида prefix=value
+static bool option(const std::string &arg, const std::string &prefix, std::string &value) {
+  if (arg.rfind(prefix, 0) != 0) return false;
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+static std::vector<std::string> splitList(const std::string &s) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  for (std::string item; std::getline(ss, item, ',');) {
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+// Функция разбора размера с суффиксом K, M или G (степени 1024)
+static size_t parseSize(const std::string &s) {
+  size_t pos = 0;
+  double value = std::stod(s, &pos);
+  std::string suffix = s.substr(pos);
+  if (suffix == "K" || suffix == "k") value *= 1 << 10;
+  else if (suffix == "M" || suffix == "m") value *= 1 << 20;
+  else if (suffix == "G" || suffix == "g") value *= 1 << 30;
+  else if (!suffix.empty()) throw std::invalid_argument("bad size " + s);
+  return (size_t)value;
+}
+
+static void dropCache(const std::string &path) {
+  FileHandle fd(open(path.c_str(), O_RDONLY));
+  if (!fd) throwErrno("open " + path);
+  if (fsync(fd.Get()) != 0) throwErrno("fsync " + path);
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd.Get(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+// Функция прогона сортировки в дочернем процессе: итог - через pipe, ресурсы - wait4
+static RunResult runChild(const std::string &path, const SortOptions &opts, size_t records, struct rusage &ru) {
+  int fds[2];
+  if (pipe(fds) != 0) throwErrno("pipe");
+
+  pid_t pid = fork();
+  if (pid < 0) throwErrno("fork");
+  if (pid == 0) {
+    close(fds[0]);
+    try {
+      SortMetrics metrics;
+      SortOptions childOpts = opts;
+      childOpts.metrics = &metrics;
+      ExternalSorter<int64_t>(childOpts).SortFile(path);
+
+      RunResult r;
+      r.wallSec = metrics.total.wallSec;
+      r.cpuSec = metrics.total.cpuSec;
+      r.initialRuns = metrics.initialRuns;
+      r.mergePasses = metrics.mergePasses;
+      r.bytesRead = metrics.total.bytesRead;
+      r.bytesWritten = metrics.total.bytesWritten;
+      if (write(fds[1], &r, sizeof(r)) != (ssize_t)sizeof(r)) _exit(2);
+      _exit(0);
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      _exit(1);
+    }
+  }
+
+  close(fds[1]);
+  RunResult r;
+  ssize_t got = read(fds[0], &r, sizeof(r));
+  close(fds[0]);
+  int status = 0;
+  if (wait4(pid, &status, 0, &ru) < 0) throwErrno("wait4");
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || got != (ssize_t)sizeof(r)) {
+    throw std::runtime_error("sort process failed");
+  }
+
+  // Проверка - в родителе, чтобы окна проверки не попали в пиковый RSS сортировки
+  FileHandle fd(open(path.c_str(), O_RDONLY));
+  if (!fd) throwErrno("open " + path);
+  r.sorted = findUnsorted<int64_t>(fd.Get(), records, std::less<>(), opts.threads) == records;
+  return r;
+}
+
+int main(int argc, char* argv[]) try {
+  size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::string> sizes = {"1G"}, mems = {"1", "5", "20"}, dists = {"uniform"};
+  std::vector<std::string> threadList = {"1"}, strategies;
+  if (cores > 1) threadList.push_back(std::to_string(cores));
+  for (auto &s : kStrategies) strategies.push_back(s.name);
+  size_t repeat = 1;
+  uint64_t seed = 1;
+  std::string dir = ".", out = "sort_bench.csv", label;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i], v;
+    if (option(arg, "--sizes=", v)) sizes = splitList(v);
+    else if (option(arg, "--mem=", v)) mems = splitList(v);
+    else if (option(arg, "--threads=", v)) threadList = splitList(v);
+    else if (option(arg, "--dist=", v)) dists = splitList(v);
+    else if (option(arg, "--strategies=", v)) strategies = splitList(v);
+    else if (option(arg, "--repeat=", v)) repeat = std::stoull(v);
+    else if (option(arg, "--seed=", v)) seed = std::stoull(v);
+    else if (option(arg, "--dir=", v)) dir = v;
+    else if (option(arg, "--out=", v)) out = v;
+    else if (option(arg, "--label=", v)) label = v;
+    else throw std::invalid_argument("unknown option " + arg);
+  }
+
+  // Проверяем списки до первого долгого прогона
+  std::vector<Distribution> distValues;
+  for (auto &d : dists) {
+    Distribution dist;
+    if (!parseDistribution(d, dist)) throw std::invalid_argument("unknown distribution " + d);
+    distValues.push_back(dist);
+  }
+  std::vector<const Strategy*> strategyValues;
+  for (auto &name : strategies) {
+    const Strategy* found = nullptr;
+    for (auto &s : kStrategies) {
+      if (name == s.name) found = &s;
+    }
+    if (!found) throw std::invalid_argument("unknown strategy " + name);
+    strategyValues.push_back(found);
+  }
+
+  bool newFile = access(out.c_str(), F_OK) != 0;
+  std::ofstream csv(out, std::ios::app);
+  if (!csv) throw std::runtime_error("cannot open " + out);
+  if (newFile) {
+    csv << "label,file_mb,records,mem_pct,mem_mb,threads,dist,strategy,run,wall_sec,mb_per_sec,cpu_sec,"
+           "initial_runs,merge_passes,read_mb,written_mb,max_rss_mb,minor_faults,major_faults,sorted\n";
+  }
+
+  const std::string path = dir + "/sort_bench.bin";
+  for (auto &sizeStr : sizes) {
+    size_t records = parseSize(sizeStr) / sizeof(int64_t);
+    double fileMB = records * sizeof(int64_t) / double(1 << 20);
+    for (size_t d = 0; d < dists.size(); d++) {
+      for (auto &memStr : mems) {
+        double pct = std::stod(memStr);
+        size_t memMB = std::max((size_t)(fileMB * pct / 100), (size_t)1);
+        for (auto &threadStr : threadList) {
+          size_t threads = std::max((size_t)std::stoull(threadStr), (size_t)1);
+          for (const Strategy* strategy : strategyValues) {
+            for (size_t run = 1; run <= repeat; run++) {
+              GenOptions gen;
+              gen.dist = distValues[d];
+              gen.threads = cores;
+              gen.seed = seed;
+              generateData<int64_t>(path, records, gen);
+              dropCache(path);
+
+              SortOptions opts;
+              opts.memoryLimitMB = memMB;
+              opts.threads = threads;
+              strategy->apply(opts);
+              struct rusage ru;
+              RunResult r = runChild(path, opts, records, ru);
+
+              double mbps = r.wallSec > 0 ? fileMB / r.wallSec : 0;
+              csv << label << "," << fileMB << "," << records << "," << pct << "," << memMB << "," << threads << ","
+                  << dists[d] << "," << strategy->name << "," << run << "," << r.wallSec << "," << mbps << ","
+                  << r.cpuSec << "," << r.initialRuns << "," << r.mergePasses << ","
+                  << r.bytesRead / double(1 << 20) << "," << r.bytesWritten / double(1 << 20) << ","
+                  << ru.ru_maxrss / 1024 << "," << ru.ru_minflt << "," << ru.ru_majflt << ","
+                  << (r.sorted ? "yes" : "no") << std::endl;
+              std::cout << sizeStr << " " << dists[d] << " mem " << pct << "% (" << memMB << " MB) " << threads
+                        << " thread(s) " << strategy->name << ": " << r.wallSec << " s, " << mbps << " MB/s"
+                        << (r.sorted ? "" : " NOT SORTED") << "\n";
+              if (!r.sorted) throw std::runtime_error("result is not sorted");
+            }
+          }
+        }
+      }
+    }
+  }
+  remove(path.c_str());
+  return 0;
+} catch (const std::exception &e) {
+  std::cerr << "Error: " << e.what() << "\n";
+  return 1;
+}
@@ -3,7 +3,7 @@
 set -e
 
 echo "================= Compilation: Compiling supaBigSort.cpp ================="
-g++ -std=c++17 -o supaBigSort supaBigSort.cpp
+g++ -std=c++20 -pthread -o supaBigSort supaBigSort.cpp
 echo "✅ Compilation successful!"
 
 echo "================= Test 1: Generate Random Data ================="
@@ -39,7 +39,93 @@ echo "================= Test 6: Large Dataset (10 million numbers) =============
 ./supaBigSort bigAssData.bin 100
 ./supaBigSort --check bigAssData.bin
 
-echo "================= Test 7: Invalid Inputs ================="
+echo "================= Test 7: Replacement Selection Runs ================="
+./supaBigSort --gen replData.bin 2000000
+./supaBigSort replData.bin 2 --runs=replace
+./supaBigSort --check replData.bin
+
+echo "================= Test 8: Natural Runs On Partially Sorted Data ================="
+./supaBigSort --gen naturalData.bin 2000000 sorted
+./supaBigSort --gen tailData.bin 100000
+cat tailData.bin >> naturalData.bin
+./supaBigSort naturalData.bin 2 --runs=natural
+./supaBigSort --check naturalData.bin
+
+echo "================= Test 9: Parallel Merge ================="
+./supaBigSort --gen parallelData.bin 10000000
+./supaBigSort parallelData.bin 8 --runs=chunk --threads=4
+./supaBigSort --check parallelData.bin
+
+echo "================= Test 10: Other Element Types And Descending Order ================="
+./supaBigSort --gen floatData.bin 2000000 --type=f32
+./supaBigSort floatData.bin 1 --type=f32 --desc
+./supaBigSort --check floatData.bin --type=f32 --desc
+./supaBigSort --gen u32Data.bin 2000000 --type=u32
+./supaBigSort u32Data.bin 1 --type=u32 --runs=replace
+./supaBigSort --check u32Data.bin --type=u32
+
+echo "================= Test 11: Compressed Runs ================="
+./supaBigSort --gen compressData.bin 8000000
+./supaBigSort compressData.bin 1 --compress
+./supaBigSort --check compressData.bin
+./supaBigSort --gen compressF32.bin 2000000 --type=f32
+./supaBigSort compressF32.bin 1 --compress --type=f32 --desc
+./supaBigSort --check compressF32.bin --type=f32 --desc
+
+echo "================= Test 12: Distribution Sort ================="
+./supaBigSort --gen distData.bin 10000000
+./supaBigSort distData.bin 8 --method=distribute --threads=4
+./supaBigSort --check distData.bin
+
+echo "================= Test 13: Resume After Crash ================="
+./supaBigSort --gen resumeData.bin 20000000
+./supaBigSort resumeData.bin 4 --resume --threads=2 > /dev/null &
+sleep 1
+kill -9 $! 2>/dev/null || true
+wait $! 2>/dev/null || true
+./supaBigSort resumeData.bin 4 --resume --threads=2
+./supaBigSort --check resumeData.bin
+
+echo "================= Test 14: Huge Pages ================="
+./supaBigSort --gen hugeData.bin 10000000
+./supaBigSort hugeData.bin 16 --runs=chunk --hugepages
+./supaBigSort --check hugeData.bin
+
+echo "================= Test 15: Direct I/O ================="
+./supaBigSort --gen directData.bin 10000001
+./supaBigSort directData.bin 8 --io=direct --threads=4
+./supaBigSort --check directData.bin
+
+echo "================= Test 16: Phase Metrics ================="
+./supaBigSort --gen metricsData.bin 10000000
+./supaBigSort metricsData.bin 8 --runs=chunk --threads=4 --metrics=metrics.json
+grep -q '"name": "merge_pass"' metrics.json
+./supaBigSort metricsData.bin 8 --threads=4 --metrics=- 2> /dev/null > metrics_stdout.json
+[ "$(head -c 1 metrics_stdout.json)" = "{" ]
+[ "$(tail -c 2 metrics_stdout.json)" = "}" ]
+./supaBigSort --check metricsData.bin
+
+echo "================= Test 17: Generator Distributions ================="
+for dist in uniform nearly-sorted zipf many-duplicates; do
+  ./supaBigSort --gen dist_$dist.bin 5000000 --dist=$dist --seed=1 --threads=4
+  ./supaBigSort dist_$dist.bin 4 --threads=4
+  ./supaBigSort --check dist_$dist.bin --threads=4
+done
+./supaBigSort --gen distSorted.bin 5000000 --dist=sorted --type=f32
+./supaBigSort --check distSorted.bin --type=f32
+
+echo "================= Test 18: Indirect Sort ================="
+./supaBigSort --gen indirectData.bin 5000000
+./supaBigSort indirectData.bin 4 --method=indirect --threads=4
+./supaBigSort --check indirectData.bin
+
+echo "================= Test 19: Invalid Inputs ================="
+# Flags only, no mode and no file: usage and exit code 1
+for flags in "--desc" "--type=u32" "--threads=2 --type=f32 --desc"; do
+  rc=0
+  ./supaBigSort $flags 2> /dev/null || rc=$?
+  [ $rc -eq 1 ]
+done
 ./supaBigSort sorted_data.bin abc
 ./supaBigSort
 
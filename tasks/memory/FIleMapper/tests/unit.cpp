@@ -0,0 +1,634 @@
+#include "data_tools.hpp"
+#include "external_sorter.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <catch2/catch_all.hpp>
+
+using namespace extsort;
+
+namespace {
+
+// Запись с ключом и полезной нагрузкой
+struct Wide {
+  uint64_t key;
+  char payload[4088];
+};
+
+struct WideKey {
+  uint64_t operator()(const Wide &w) const { return w.key; }
+};
+
+// Запись 128 байт с ключом 8 байт (косвенная сортировка)
+struct Record128 {
+  uint64_t key;
+  uint64_t origin;  // Номер записи до сортировки
+  char payload[112];
+};
+
+struct Record128Key {
+  uint64_t operator()(const Record128 &r) const { return r.key; }
+};
+
+std::vector<int64_t> randomData(size_t count, uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::vector<int64_t> data(count);
+  for (auto &x : data) x = (int64_t)gen();
+  return data;
+}
+
+std::string tempPath(const std::string &name) {
+  const char* tmp = getenv("TMPDIR");
+  return std::string(tmp && *tmp ? tmp : "/tmp") + "/extsort_test_" + name;
+}
+
+template <typename T>
+void writeFile(const std::string &path, const std::vector<T> &data) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+}
+
+template <typename T>
+std::vector<T> readFile(const std::string &path) {
+  std::vector<T> data(getFileSize(path) / sizeof(T));
+  std::ifstream ifs(path, std::ios::binary);
+  ifs.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(T));
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("sort in memory", "[extsort,unit]") {
+  SECTION("radix ascending and descending") {
+    auto data = randomData(100000, 1);
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    ExternalSorter<int64_t>().SortInMemory(data.data(), data.data() + data.size());
+    REQUIRE(data == expected);
+
+    ExternalSorter<int64_t, IdentityKey, std::greater<>>().SortInMemory(data.data(), data.data() + data.size());
+    std::reverse(expected.begin(), expected.end());
+    REQUIRE(data == expected);
+  }
+
+  SECTION("floats with negative values") {
+    std::vector<float> data = {3.5f, -1.0f, 0.0f, -7.25f, 2.0f, -0.5f};
+    ExternalSorter<float>().SortInMemory(data.data(), data.data() + data.size());
+    REQUIRE(std::is_sorted(data.begin(), data.end()));
+  }
+}
+
+TEST_CASE("sort file", "[extsort,unit]") {
+  const std::string path = tempPath("file.bin");
+  auto data = randomData(1 << 19, 2);  // 4MB
+  auto expected = data;
+  std::sort(expected.begin(), expected.end());
+
+  for (RunStrategy strategy : {RunStrategy::Natural, RunStrategy::Chunk, RunStrategy::Replacement}) {
+    for (size_t threads : {1, 4}) {
+      writeFile(path, data);
+      SortOptions opts;
+      opts.memoryLimitMB = 1;
+      opts.strategy = strategy;
+      opts.threads = threads;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      REQUIRE(readFile<int64_t>(path) == expected);
+    }
+  }
+
+  SECTION("parallel merge splits runs, including inside runs of equal keys") {
+    // Порог снижен, чтобы 4 ранна по 1MB сливались 4 потоками через findSplitPositions;
+    // при 7 различных ключах границы частей попадают внутрь серий равных ключей
+    std::mt19937_64 gen(19);
+    std::vector<int64_t> duplicates(1 << 19);
+    for (auto &x : duplicates) x = (int64_t)(gen() % 7) - 3;
+    for (const auto *input : {&data, &duplicates}) {
+      auto sorted = *input;
+      std::sort(sorted.begin(), sorted.end());
+      writeFile(path, *input);
+      SortOptions opts;
+      opts.memoryLimitMB = 1;
+      opts.strategy = RunStrategy::Chunk;
+      opts.threads = 4;
+      opts.parallelMergeMinElems = 1 << 10;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      REQUIRE(readFile<int64_t>(path) == sorted);
+    }
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE("finish keeps owner and mode", "[extsort,unit]") {
+  const std::string path = tempPath("finish.bin");
+  const std::string temp = path + ".tmp_sort";
+  auto data = randomData(1 << 12, 3);
+  auto sorted = data;
+  std::sort(sorted.begin(), sorted.end());
+  writeFile(path, data);
+  writeFile(temp, sorted);
+  REQUIRE(chmod(path.c_str(), 0640) == 0);
+  // Под root проверяем и передачу владельца: временный файл создан от root
+  const bool root = geteuid() == 0;
+  if (root) REQUIRE(chown(path.c_str(), 12345, 23456) == 0);
+
+  int fd = open(path.c_str(), O_RDWR);
+  int fdTemp = open(temp.c_str(), O_RDWR);
+  REQUIRE(fd >= 0);
+  REQUIRE(fdTemp >= 0);
+  FinishMethod m = finishFromTemp(fd, fdTemp, path, temp, sorted.size() * sizeof(int64_t));
+  close(fdTemp);
+  close(fd);
+
+  struct stat st;
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  REQUIRE((st.st_mode & 07777) == 0640);
+  if (root) {
+    REQUIRE(st.st_uid == 12345);
+    REQUIRE(st.st_gid == 23456);
+  }
+  REQUIRE(readFile<int64_t>(path) == sorted);
+  REQUIRE((access(temp.c_str(), F_OK) != 0) == (m == FinishMethod::Rename));
+  remove(temp.c_str());
+  remove(path.c_str());
+}
+
+TEST_CASE("huge pages", "[extsort,unit]") {
+  SECTION("scratch buffer is 2MB aligned") {
+    ScratchBuffer<int64_t> buf(3 << 18, true);  // 6MB
+    REQUIRE(reinterpret_cast<uintptr_t>(buf.data()) % kHugePageSize == 0);
+    REQUIRE(buf.size() == (3 << 18));
+    buf[buf.size() - 1] = 42;
+    REQUIRE(buf[buf.size() - 1] == 42);
+  }
+
+  SECTION("sort file") {
+    const std::string path = tempPath("huge.bin");
+    auto data = randomData(1 << 19, 14);
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    for (RunStrategy strategy : {RunStrategy::Natural, RunStrategy::Chunk, RunStrategy::Replacement}) {
+      writeFile(path, data);
+      SortOptions opts;
+      opts.memoryLimitMB = 1;
+      opts.strategy = strategy;
+      opts.hugePages = true;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      REQUIRE(readFile<int64_t>(path) == expected);
+    }
+    remove(path.c_str());
+  }
+}
+
+TEST_CASE("direct io", "[extsort,unit]") {
+  const std::string path = tempPath("direct.bin");
+
+  SECTION("unaligned reads and writes") {
+    std::vector<char> data(3 * FileIO::kAlign + 123);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (char)(i * 7);
+    writeFile(path, std::vector<char>(data.size(), 0));
+
+    FileHandle fd(open(path.c_str(), O_RDWR));
+    FileHandle direct = openDirect(path);
+    FileIO io(fd.Get(), direct.Get());
+    REQUIRE(io.Direct());
+    io.Write(0, data.data(), 100);  // Только неполный блок
+    io.Write(100, data.data() + 100, data.size() - 100 - 5);  // Голова, середина, хвост
+    io.Write(data.size() - 5, data.data() + data.size() - 5, 5);  // Конец файла
+
+    std::vector<char> back(data.size());
+    io.Read(1, back.data() + 1, back.size() - 1);
+    io.Read(0, back.data(), 1);
+    REQUIRE(back == data);
+    REQUIRE(readFile<char>(path) == data);
+  }
+
+  SECTION("sort file") {
+    auto data = randomData((1 << 19) + 3, 15);  // Размер не кратен блоку
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    for (size_t threads : {1, 4}) {
+      writeFile(path, data);
+      SortOptions opts;
+      opts.memoryLimitMB = 1;
+      opts.threads = threads;
+      opts.io = IoMode::Direct;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      REQUIRE(readFile<int64_t>(path) == expected);
+    }
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE("distribution sort", "[extsort,unit]") {
+  const std::string path = tempPath("distribution.bin");
+
+  SECTION("random data") {
+    auto data = randomData(1 << 20, 11);  // 8MB
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    for (size_t threads : {1, 3}) {
+      writeFile(path, data);
+      SortOptions opts;
+      opts.memoryLimitMB = 1;
+      opts.method = SortMethod::Distribution;
+      opts.threads = threads;
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      REQUIRE(readFile<int64_t>(path) == expected);
+    }
+  }
+
+  SECTION("many duplicates overflow buckets") {
+    std::mt19937_64 gen(12);
+    std::vector<uint32_t> data(1 << 21);
+    for (auto &x : data) x = gen() % 5;
+    auto expected = data;
+    std::sort(expected.begin(), expected.end(), std::greater<>());
+
+    writeFile(path, data);
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    opts.method = SortMethod::Distribution;
+    ExternalSorter<uint32_t, IdentityKey, std::greater<>>(opts).SortFile(path);
+    REQUIRE(readFile<uint32_t>(path) == expected);
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE("indirect sort", "[extsort,unit]") {
+  const std::string path = tempPath("indirect.bin");
+  std::mt19937_64 gen(19);
+  std::vector<Record128> data(100000);  // 12.8MB
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i].key = gen() % 50000;  // С повторами
+    data[i].origin = i;
+    std::memset(data[i].payload, (int)(i % 251), sizeof(data[i].payload));
+  }
+
+  for (size_t threads : {1, 3}) {
+    writeFile(path, data);
+    SortMetrics metrics;
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    opts.method = SortMethod::Indirect;
+    opts.threads = threads;
+    opts.metrics = &metrics;
+    ExternalSorter<Record128, Record128Key, std::greater<>>(opts, Record128Key()).SortFile(path);
+
+    auto sorted = readFile<Record128>(path);
+    REQUIRE(sorted.size() == data.size());
+    std::vector<bool> seen(data.size(), false);
+    bool ordered = true, intact = true;
+    for (size_t i = 0; i < sorted.size(); i++) {
+      if (i && sorted[i - 1].key < sorted[i].key) ordered = false;
+      size_t origin = sorted[i].origin;
+      if (origin >= data.size() || seen[origin] || std::memcmp(&data[origin], &sorted[i], sizeof(Record128)) != 0) {
+        intact = false;
+        break;
+      }
+      seen[origin] = true;
+    }
+    REQUIRE(ordered);
+    REQUIRE(intact);  // Каждая запись перенесена целиком и ровно один раз
+
+    // Проходы слияния двигают пары по 16 байт, записи - только при сборке
+    REQUIRE(metrics.method == "indirect");
+    std::vector<std::string> names;
+    for (auto &p : metrics.phases) names.push_back(p.name);
+    REQUIRE(names == std::vector<std::string>{"sorted_check", "key_extract", "key_sort", "gather", "copy_back"});
+    REQUIRE(metrics.phases[2].bytesWritten < data.size() * sizeof(Record128));
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE("resume after crash", "[extsort,unit]") {
+  const std::string path = tempPath("resume.bin");
+  // 72 ранна по 1MB при k = 63: первый проход сливает группы по 2, второй - все разом
+  auto data = randomData(9 << 20, 13);
+  auto expected = data;
+  std::sort(expected.begin(), expected.end());
+
+  // Каждый запуск падает сразу после первой новой контрольной точки и продолжается следующим
+  writeFile(path, data);
+  SortOptions opts;
+  opts.memoryLimitMB = 1;
+  opts.threads = 2;
+  opts.resume = true;
+  opts.onCheckpoint = [] { throw std::runtime_error("crash"); };
+  size_t crashes = 0;
+  for (;;) {
+    try {
+      ExternalSorter<int64_t>(opts).SortFile(path);
+      break;
+    } catch (const std::runtime_error&) {
+      crashes++;
+    }
+  }
+  REQUIRE(crashes == 72 + 1 + 36 + 1 + 1 + 1);  // Ранны, фаза, группы и концы двух проходов
+  REQUIRE(readFile<int64_t>(path) == expected);
+  REQUIRE(access((path + ".tmp_sort.manifest").c_str(), F_OK) != 0);
+  REQUIRE(access((path + ".tmp_sort").c_str(), F_OK) != 0);
+
+  opts.method = SortMethod::Distribution;
+  ExternalSorter<int64_t> distribution(opts);
+  REQUIRE_THROWS_AS(distribution.SortFile(path), std::invalid_argument);
+  remove(path.c_str());
+}
+
+TEST_CASE("metrics", "[extsort,unit]") {
+  const std::string path = tempPath("metrics.bin");
+  const size_t bytes = (2 << 20) * sizeof(int64_t);  // 16 раннов по 1MB - один проход
+  writeFile(path, randomData(2 << 20, 17));
+
+  SortMetrics metrics;
+  SortOptions opts;
+  opts.memoryLimitMB = 1;
+  opts.strategy = RunStrategy::Chunk;
+  opts.metrics = &metrics;
+  ExternalSorter<int64_t>(opts).SortFile(path);
+
+  REQUIRE(metrics.records == (2 << 20));
+  REQUIRE(metrics.method == "merge");
+  REQUIRE(metrics.strategy == "chunk");
+  REQUIRE(metrics.initialRuns == 16);
+  REQUIRE(metrics.mergePasses == 1);
+  REQUIRE(!metrics.alreadySorted);
+  REQUIRE(metrics.phases.size() == 3);
+  REQUIRE(metrics.phases[0].name == "sorted_check");
+  const PhaseMetrics &runs = metrics.phases[1];
+  REQUIRE(runs.name == "run_generation");
+  REQUIRE(runs.runsOut == 16);
+  REQUIRE(runs.bytesRead >= bytes);
+  REQUIRE(runs.bytesWritten >= bytes);
+  REQUIRE(runs.mmapCalls >= 16);
+  const PhaseMetrics &merge = metrics.phases[2];
+  REQUIRE(merge.name == "merge_pass");
+  REQUIRE(merge.pass == 1);
+  REQUIRE(merge.k == 16);
+  REQUIRE(merge.runsIn == 16);
+  REQUIRE(merge.runsOut == 1);
+  REQUIRE(merge.bytesRead >= bytes);
+  REQUIRE(merge.bytesWritten >= bytes);
+  REQUIRE(metrics.total.wallSec >= merge.wallSec);
+  REQUIRE(metrics.total.bytesWritten >= runs.bytesWritten + merge.bytesWritten);
+
+  std::string json = metrics.ToJson();
+  for (const char* key : {"\"file_bytes\": 16777216", "\"initial_runs\": 16", "\"name\": \"merge_pass\"",
+                          "\"bytes_read\"", "\"minor_faults\"", "\"already_sorted\": false"}) {
+    INFO(key);
+    REQUIRE(json.find(key) != std::string::npos);
+  }
+
+  // Повторная сортировка заканчивается проверкой
+  ExternalSorter<int64_t>(opts).SortFile(path);
+  REQUIRE(metrics.alreadySorted);
+  REQUIRE(metrics.phases.size() == 1);
+  REQUIRE(metrics.initialRuns == 0);
+
+  opts.method = SortMethod::Distribution;
+  writeFile(path, randomData(2 << 20, 18));
+  ExternalSorter<int64_t>(opts).SortFile(path);
+  REQUIRE(metrics.method == "distribute");
+  REQUIRE(metrics.phases.size() == 3);
+  REQUIRE(metrics.phases[1].name == "partition");
+  REQUIRE(metrics.phases[2].name == "bucket_sort");
+  remove(path.c_str());
+}
+
+TEST_CASE("data tools", "[extsort,unit]") {
+  const std::string path = tempPath("data.bin");
+  const size_t count = (3 << 20) + 5;  // Неполный последний блок генератора
+
+  SECTION("generator does not depend on thread count") {
+    for (auto dist : {Distribution::Uniform, Distribution::Sorted, Distribution::NearlySorted, Distribution::Zipf,
+                      Distribution::ManyDuplicates}) {
+      GenOptions gen;
+      gen.dist = dist;
+      gen.seed = 5;
+      generateData<int64_t>(path, count, gen);
+      auto single = readFile<int64_t>(path);
+      gen.threads = 3;
+      generateData<int64_t>(path, count, gen);
+      auto data = readFile<int64_t>(path);
+      REQUIRE(data == single);
+      REQUIRE(data.size() == count);
+
+      bool sorted = std::is_sorted(data.begin(), data.end());
+      REQUIRE(sorted == (dist == Distribution::Sorted));
+      FileHandle fd(open(path.c_str(), O_RDONLY));
+      size_t expected = std::is_sorted_until(data.begin(), data.end()) - data.begin();
+      REQUIRE(findUnsorted<int64_t>(fd.Get(), count, std::less<>(), 3, 1 << 16) == expected);
+    }
+  }
+
+  SECTION("check finds the first descent") {
+    GenOptions gen;
+    gen.dist = Distribution::Sorted;
+    generateData<float>(path, count, gen);
+    auto data = readFile<float>(path);
+    REQUIRE(std::is_sorted(data.begin(), data.end()));
+
+    // Окна по 4096 записей: нарушения на стыке окон, внутри блока и в хвосте
+    for (size_t pos : {(size_t)1, (size_t)4096, (size_t)4097, (size_t)300000, count - 1}) {
+      auto broken = data;
+      broken[pos] = broken[pos - 1] - 1000;  // Шаг float около 1e9 - 64
+      broken[count / 2 + 7] = broken[count / 2 + 6] - 1000;  // Дальнейшее нарушение не мешает
+      writeFile(path, broken);
+      FileHandle fd(open(path.c_str(), O_RDONLY));
+      for (size_t threads : {1, 4}) {
+        INFO(pos << " " << threads);
+        REQUIRE(findUnsorted<float>(fd.Get(), count, std::less<>(), threads, 4096 * sizeof(float)) ==
+                std::min(pos, count / 2 + 7));
+      }
+    }
+    std::reverse(data.begin(), data.end());
+    writeFile(path, data);
+    FileHandle fd(open(path.c_str(), O_RDONLY));
+    REQUIRE(findUnsorted<float>(fd.Get(), count, std::greater<>(), 2) == count);
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE("errors", "[extsort,unit]") {
+  SECTION("missing file") {
+    REQUIRE_THROWS_AS(ExternalSorter<int64_t>().SortFile(tempPath("missing.bin")), std::system_error);
+  }
+
+  SECTION("size not multiple of record") {
+    const std::string path = tempPath("bad.bin");
+    writeFile(path, std::vector<char>{'a', 'b', 'c'});
+    REQUIRE_THROWS_AS(ExternalSorter<int64_t>().SortFile(path), std::runtime_error);
+    remove(path.c_str());
+  }
+
+  SECTION("missing spill directory") {
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    opts.tempDir = tempPath("no/such/dir");
+    ExternalSorter<int64_t> sorter(opts);
+    auto data = randomData(1 << 18, 3);  // Два буфера - нужен файл раннов
+    REQUIRE_THROWS_AS(sorter.Push(data), std::system_error);
+  }
+}
+
+TEST_CASE("streaming", "[extsort,unit]") {
+  SECTION("fits in memory") {
+    auto data = randomData(1000, 4);
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    ExternalSorter<int64_t> sorter;
+    sorter.Push(std::span<const int64_t>(data).first(300));
+    sorter.Push(std::span<const int64_t>(data).subspan(300));
+    std::vector<int64_t> result;
+    for (int64_t x : sorter.Finish()) result.push_back(x);
+    REQUIRE(result == expected);
+  }
+
+  SECTION("spills runs") {
+    auto data = randomData(1 << 20, 5);  // 8MB при бюджете 1MB
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    ExternalSorter<int64_t> sorter(opts);
+    for (size_t off = 0; off < data.size(); off += 12345) {
+      sorter.Push(std::span<const int64_t>(data).subspan(off, std::min<size_t>(12345, data.size() - off)));
+    }
+
+    auto stream = sorter.Finish();
+    std::vector<int64_t> result(data.size() + 1);
+    REQUIRE(stream.Read(result) == data.size());
+    result.pop_back();
+    REQUIRE(result == expected);
+  }
+
+  SECTION("sink and reuse") {
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    ExternalSorter<int64_t, IdentityKey, std::greater<>> sorter(opts);
+
+    for (uint64_t seed : {6, 7}) {
+      auto data = randomData(300000, seed);
+      auto expected = data;
+      std::sort(expected.begin(), expected.end(), std::greater<>());
+
+      sorter.Push(data);
+      std::vector<int64_t> result;
+      sorter.Finish([&](std::span<const int64_t> part) { result.insert(result.end(), part.begin(), part.end()); });
+      REQUIRE(result == expected);
+    }
+  }
+
+  SECTION("intermediate merge passes") {
+    // 256 записей по 4KB на ранн и больше maxK = 63 раннов
+    const size_t count = 256 * 80;
+    std::mt19937_64 gen(8);
+    std::vector<uint64_t> keys;
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    opts.threads = 2;
+    ExternalSorter<Wide, WideKey> sorter(opts);
+
+    Wide w{};
+    for (size_t i = 0; i < count; i++) {
+      w.key = gen() % 1000;
+      w.payload[0] = (char)w.key;
+      keys.push_back(w.key);
+      sorter.Push(std::span<const Wide>(&w, 1));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    size_t i = 0;
+    for (const Wide &r : sorter.Finish()) {
+      REQUIRE(i < count);
+      REQUIRE(r.key == keys[i]);
+      REQUIRE(r.payload[0] == (char)r.key);
+      i++;
+    }
+    REQUIRE(i == count);
+  }
+}
+
+TEST_CASE("run codec", "[extsort,unit]") {
+  using Codec = RunCodec<uint64_t>;
+
+  auto roundTrip = [](const std::vector<uint64_t> &values) {
+    std::vector<uint8_t> bytes(Codec::kMaxBlockBytes + Codec::kSlack);
+    std::vector<uint64_t> decoded(values.size());
+    size_t written = Codec::EncodeBlock(values.data(), values.size(), bytes.data());
+    REQUIRE(Codec::DecodeBlock(bytes.data(), values.size(), decoded.data()) == written);
+    REQUIRE(decoded == values);
+    return written;
+  };
+
+  SECTION("equal values take only the header") {
+    REQUIRE(roundTrip(std::vector<uint64_t>(Codec::kBlock, 7)) == Codec::kHeader);
+  }
+
+  SECTION("widths from 1 to 64 bits") {
+    for (unsigned width = 1; width <= 64; width++) {
+      std::mt19937_64 gen(width);
+      uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+      std::vector<uint64_t> values(Codec::kBlock);
+      values[0] = gen() & mask;
+      for (size_t i = 1; i < values.size(); i++) {
+        uint64_t delta = (gen() & mask) >> 7;  // Без переполнения суммы
+        values[i] = values[i - 1] + delta;
+      }
+      roundTrip(values);
+    }
+    roundTrip({0, ~0ULL});
+    roundTrip({42});
+  }
+
+  SECTION("writer and reader across buffer refills") {
+    const std::string path = tempPath("codec.bin");
+    FileHandle fd(open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+    REQUIRE(fd);
+
+    std::vector<uint64_t> values(100003);
+    std::mt19937_64 gen(9);
+    for (size_t i = 1; i < values.size(); i++) values[i] = values[i - 1] + gen() % 5000;
+
+    CompressedRunWriter<uint64_t> writer(fd.Get(), 100, 4096);
+    writer.Append(values.data(), 777);
+    writer.Append(values.data() + 777, values.size() - 777);
+    size_t bytes = writer.Finish();
+    REQUIRE(bytes < values.size() * 2);
+
+    CompressedRunReader<uint64_t> reader(fd.Get(), 100, bytes, values.size(), 4096);
+    std::vector<uint64_t> decoded(values.size());
+    size_t n = 0;
+    while (size_t got = reader.Read(decoded.data() + n, std::min<size_t>(1000, decoded.size() - n))) n += got;
+    REQUIRE(n == values.size());
+    REQUIRE(decoded == values);
+    remove(path.c_str());
+  }
+
+  SECTION("sort file with compressed runs") {
+    const std::string path = tempPath("compressed.bin");
+    auto data = randomData(1 << 19, 10);
+    auto expected = data;
+    std::sort(expected.begin(), expected.end(), std::greater<>());
+
+    writeFile(path, data);
+    SortOptions opts;
+    opts.memoryLimitMB = 1;
+    opts.compressRuns = true;
+    ExternalSorter<int64_t, IdentityKey, std::greater<>>(opts).SortFile(path);
+    REQUIRE(readFile<int64_t>(path) == expected);
+
+    ExternalSorter<Wide, WideKey> wide(opts);
+    REQUIRE_THROWS_AS(wide.SortFile(path), std::invalid_argument);
+    remove(path.c_str());
+  }
+}